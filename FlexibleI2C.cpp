@@ -1,15 +1,40 @@
 #include "FlexibleI2C.h"
-
-FlexibleI2C::FlexibleI2C() : i2c_timeout(1000), last_error(SUCCESS), endpoints_ptr(nullptr) {
+#if defined(ESP_PLATFORM)
+#include <esp_timer.h>
+#endif
+
+const uint32_t I2CDeviceStats::latency_bounds_us[I2CDeviceStats::LATENCY_BUCKETS - 1] = {
+    50, 100, 200, 500, 1000, 2000, 5000, 10000, 50000
+};
+
+FlexibleI2C::FlexibleI2C() : i2c_timeout(1000), last_error(SUCCESS), endpoints_ptr(nullptr),
+    registry_version(1), bus_config_version(1),
+    quarantine_threshold(0), quarantine_probe_ms(1000), presence_probe(),
+    next_session_id(1),
+    next_periodic_id(1),
+    deferred_writes_enabled(false), deferred_write_deadline_ms(10),
+    deferred_write_count(0), coalesced_burst_count(0), deferred_write_errors(0), device_index_version(0), next_fifo_id(1),
+    trace_next(0), trace_count(0), update_task(nullptr) {
+    // Created up front so concurrent beginSession() calls never race to create them
+    for (auto& session : sessions) {
+        session.gate = xSemaphoreCreateBinary();
+        xSemaphoreGive(session.gate);
+    }
 }
 
 FlexibleI2C::~FlexibleI2C() {
+    flush();
     for (auto& bus_pair : buses) {
         I2CBusConfig& config = bus_pair.second;
         if (config.initialized && config.wire_instance) {
             config.wire_instance->end();
         }
     }
+    for (auto& session : sessions) {
+        if (session.gate) {
+            vSemaphoreDelete(session.gate);
+        }
+    }
 }
 
 void FlexibleI2C::init(FlexibleEndpoints& endpoints) {
@@ -29,6 +54,11 @@ bool FlexibleI2C::initBus(uint8_t bus_id, uint8_t sda_pin, uint8_t scl_pin, uint
         return true;
     }
 
+    if (getTarget(bus_id)) {
+        setError(INVALID_PARAMETERS);
+        return false;
+    }
+
     TwoWire* wire_instance = (bus_id == 0) ? &Wire : &Wire1;
 
     I2CBusConfig config(sda_pin, scl_pin, frequency);
@@ -38,6 +68,7 @@ bool FlexibleI2C::initBus(uint8_t bus_id, uint8_t sda_pin, uint8_t scl_pin, uint
     if (success) {
         config.initialized = true;
         buses[bus_id] = config;
+        bus_config_version++;
         setError(SUCCESS);
         return true;
     } else {
@@ -54,8 +85,151 @@ bool FlexibleI2C::isBusInitialized(uint8_t bus_id) {
 TwoWire* FlexibleI2C::getBus(uint8_t bus_id) {
     auto it = buses.find(bus_id);
     if (it != buses.end() && it->second.initialized) {
+        // A failed re-initialization leaves OTHER_ERROR from wakeBus(); callers return false
+        if (it->second.powered_down && !wakeBus(bus_id)) {
+            return nullptr;
+        }
+        it->second.last_activity = millis();
         return it->second.wire_instance;
     }
+    setError(BUS_NOT_INITIALIZED);
+    return nullptr;
+}
+
+FlexibleI2C::BusGuard::BusGuard(FlexibleI2C& i2c, uint8_t bus_id, uint32_t timeout_ms)
+    : i2c(i2c), bus_id(bus_id), guard(i2c.getBusLock(bus_id), timeout_ms),
+      wire(guard && bus_id <= 1 ? i2c.getBus(bus_id) : nullptr) {
+}
+
+FlexibleI2C::TransactionGuard::TransactionGuard(FlexibleI2C& i2c, uint8_t bus_mask, uint16_t address)
+    : i2c(i2c), bus_mask(bus_mask & 0x03), locked(false) {
+    // A session begun between the wait and the lock is caught by the re-check; the locks
+    // are dropped again so its owner is not kept off the bus while this task waits
+    for (;;) {
+        for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+            if ((this->bus_mask & (1 << bus_id)) && !i2c.waitForSession(bus_id, address)) {
+                return;
+            }
+        }
+        bool blocked = false;
+        for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+            if (this->bus_mask & (1 << bus_id)) {
+                i2c.bus_locks[bus_id].lock();
+                blocked = blocked || i2c.sessionBlocks(bus_id, address);
+            }
+        }
+        if (!blocked) {
+            locked = true;
+            return;
+        }
+        unlock();
+    }
+}
+
+FlexibleI2C::TransactionGuard::~TransactionGuard() {
+    if (locked) {
+        unlock();
+    }
+}
+
+void FlexibleI2C::TransactionGuard::unlock() {
+    for (uint8_t bus_id = 2; bus_id-- > 0;) {
+        if (bus_mask & (1 << bus_id)) {
+            i2c.bus_locks[bus_id].unlock();
+        }
+    }
+}
+
+FlexibleI2C::BusGuard::~BusGuard() {
+    // The idle time counts from the end of the section; the lock kept update() from ending
+    // the peripheral meanwhile
+    if (wire) {
+        i2c.getBus(bus_id);
+    }
+}
+
+void FlexibleI2C::setIdlePowerDown(uint8_t bus_id, uint32_t idle_ms) {
+    auto it = buses.find(bus_id);
+    if (it == buses.end()) {
+        setError(BUS_NOT_INITIALIZED);
+        return;
+    }
+    it->second.idle_timeout_ms = idle_ms;
+    it->second.last_activity = millis();
+    bus_config_version++;
+    setError(SUCCESS);
+}
+
+void FlexibleI2C::markBusActivity(uint8_t bus_id) {
+    auto it = buses.find(bus_id);
+    if (it != buses.end()) {
+        it->second.last_activity = millis();
+    }
+}
+
+bool FlexibleI2C::isBusPoweredDown(uint8_t bus_id) {
+    auto it = buses.find(bus_id);
+    return it != buses.end() && it->second.powered_down;
+}
+
+void FlexibleI2C::powerDownBus(uint8_t bus_id) {
+    I2CBusConfig& config = buses[bus_id];
+    config.wire_instance->end();
+    // Hi-Z so the external pull-ups hold the lines idle without the pins sinking current
+    pinMode(config.sda_pin, INPUT);
+    pinMode(config.scl_pin, INPUT);
+    config.powered_down = true;
+    I2CBusLock::Guard state_guard(state_lock);
+    bus_stats[bus_id].power_downs++;
+}
+
+bool FlexibleI2C::wakeBus(uint8_t bus_id) {
+    I2CBusConfig& config = buses[bus_id];
+    uint32_t start_us = micros();
+    bool success = config.wire_instance->begin(config.sda_pin, config.scl_pin, config.frequency);
+    uint32_t elapsed_us = micros() - start_us;
+
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        I2CBusStats& stats = bus_stats[bus_id];
+        stats.wakeups++;
+        stats.wake_us += elapsed_us;
+        stats.last_wake_us = elapsed_us;
+        if (elapsed_us > stats.max_wake_us) {
+            stats.max_wake_us = elapsed_us;
+        }
+    }
+
+    if (!success) {
+        setError(OTHER_ERROR);
+        return false;
+    }
+    config.powered_down = false;
+    return true;
+}
+
+bool FlexibleI2C::initTarget(uint8_t bus_id, I2CTarget& target, uint8_t address, uint8_t sda_pin, uint8_t scl_pin, uint32_t frequency) {
+    if (bus_id > 1 || isBusInitialized(bus_id) || getTarget(bus_id)) {
+        setError(INVALID_PARAMETERS);
+        return false;
+    }
+
+    if (!target.begin(bus_id, address, sda_pin, scl_pin, frequency)) {
+        setError(OTHER_ERROR);
+        return false;
+    }
+
+    targets[bus_id] = &target;
+    bus_config_version++;
+    setError(SUCCESS);
+    return true;
+}
+
+I2CTarget* FlexibleI2C::getTarget(uint8_t bus_id) {
+    auto it = targets.find(bus_id);
+    if (it != targets.end() && it->second->isActive()) {
+        return it->second;
+    }
     return nullptr;
 }
 
@@ -67,6 +241,12 @@ std::vector<uint8_t> FlexibleI2C::scanBus(uint8_t bus_id) {
         return found_addresses;
     }
 
+    // A scan probes every address, so it queues behind any session on the bus
+    TransactionGuard bus_guard(*this, 1 << bus_id, 0);
+    if (!bus_guard) {
+        return found_addresses;
+    }
+
     TwoWire* wire = getBus(bus_id);
     if (!wire) {
         setError(BUS_NOT_INITIALIZED);
@@ -74,95 +254,275 @@ std::vector<uint8_t> FlexibleI2C::scanBus(uint8_t bus_id) {
     }
 
     for (uint8_t address = 1; address < 127; address++) {
+        uint32_t start_us = micros();
         wire->beginTransmission(address);
         uint8_t error = wire->endTransmission();
+        presence_probe[bus_id] = true;
+        recordTransaction(bus_id, address, start_us, 1, 1, wireError(error));
+        presence_probe[bus_id] = false;
 
         if (error == 0) {
             found_addresses.push_back(address);
             onDeviceFound(bus_id, address);
-
-            bool device_exists = false;
-            for (auto& device : known_devices) {
-                if (device.address == address && device.bus_id == bus_id) {
-                    device.responsive = true;
-                    device.last_seen = millis();
-                    device_exists = true;
-                    break;
-                }
-            }
-
-            if (!device_exists) {
-                I2CDeviceInfo new_device(address, bus_id, "Unknown Device");
-                new_device.responsive = true;
-                new_device.last_seen = millis();
-                known_devices.push_back(new_device);
-            }
+            registerDevice(bus_id, address);
         }
     }
 
-    for (auto& device : known_devices) {
-        if (device.bus_id == bus_id) {
-            bool found = false;
-            for (uint8_t addr : found_addresses) {
-                if (addr == device.address) {
-                    found = true;
-                    break;
+    // onDeviceLost() runs after the registry is released, like the other callbacks
+    std::vector<uint16_t> lost;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        for (auto& device : known_devices) {
+            if (device.bus_id == bus_id && !isTenBitAddress(device.address)) {
+                bool found = false;
+                for (uint8_t addr : found_addresses) {
+                    if (addr == device.address) {
+                        found = true;
+                        break;
+                    }
+                }
+                if (!found && device.responsive) {
+                    device.responsive = false;
+                    markRegistryChanged();
+                    lost.push_back(device.address);
                 }
-            }
-            if (!found && device.responsive) {
-                device.responsive = false;
-                onDeviceLost(bus_id, device.address);
             }
         }
     }
+    for (uint16_t address : lost) {
+        onDeviceLost(bus_id, address);
+    }
 
     setError(SUCCESS);
     return found_addresses;
 }
 
 std::vector<I2CDeviceInfo> FlexibleI2C::getAllDevices() {
+    I2CBusLock::Guard state_guard(state_lock);
     return known_devices;
 }
 
-bool FlexibleI2C::isDevicePresent(uint8_t bus_id, uint8_t address) {
+I2CDeviceInfo* FlexibleI2C::findDevice(uint8_t bus_id, uint16_t address) {
+    if (device_index_version != registry_version || device_index.size() != known_devices.size()) {
+        device_index.clear();
+        for (size_t i = 0; i < known_devices.size(); i++) {
+            device_index[deviceKey(known_devices[i].bus_id, known_devices[i].address)] = i;
+        }
+        device_index_version = registry_version;
+    }
+
+    auto it = device_index.find(deviceKey(bus_id, address));
+    return it != device_index.end() ? &known_devices[it->second] : nullptr;
+}
+
+void FlexibleI2C::registerDevice(uint8_t bus_id, uint16_t address) {
+    I2CBusLock::Guard state_guard(state_lock);
+    I2CDeviceInfo* device = findDevice(bus_id, address);
+    if (device) {
+        // last_seen is part of the listing, so a refresh is a change for since_version too
+        device->responsive = true;
+        device->last_seen = millis();
+        device->last_seen_us = timestampUs();
+        markRegistryChanged();
+        device_index_version = registry_version; // positions are unchanged
+        return;
+    }
+
+    I2CDeviceInfo new_device(address, bus_id, "Unknown Device");
+    new_device.responsive = true;
+    new_device.last_seen = millis();
+    new_device.last_seen_us = timestampUs();
+    known_devices.push_back(new_device);
+    device_index[deviceKey(bus_id, address)] = known_devices.size() - 1;
+    markRegistryChanged();
+    device_index_version = registry_version;
+}
+
+bool FlexibleI2C::beginTenBitScan(uint8_t bus_id, uint8_t probes_per_update) {
+    if (!isBusInitialized(bus_id)) {
+        setError(BUS_NOT_INITIALIZED);
+        return false;
+    }
+    if (probes_per_update == 0) {
+        setError(INVALID_PARAMETERS);
+        return false;
+    }
+
+    TenBitScan& scan = ten_bit_scans[bus_id];
+    scan.active = true;
+    scan.next_address = 0;
+    scan.group_checked = false;
+    scan.probes_per_update = probes_per_update;
+    scan.found = 0;
+    scan.started_at = millis();
+    setError(SUCCESS);
+    return true;
+}
+
+bool FlexibleI2C::isTenBitScanRunning(uint8_t bus_id) {
+    return bus_id <= 1 && ten_bit_scans[bus_id].active;
+}
+
+void FlexibleI2C::advanceTenBitScan(uint8_t bus_id) {
+    TenBitScan& scan = ten_bit_scans[bus_id];
+
+    // Never block update() behind a session or another Wire user; pick up again once the bus is free
+    if (sessions[bus_id].id) {
+        return;
+    }
+    I2CBusLock::Guard bus_guard(bus_locks[bus_id], 0);
+    if (!bus_guard) {
+        return;
+    }
+
+    TwoWire* wire = getBus(bus_id);
+    if (!wire) {
+        scan.active = false;
+        return;
+    }
+
+    for (uint8_t probe = 0; probe < scan.probes_per_update && scan.next_address <= 0x3FF; probe++) {
+        uint16_t address = ADDR_10BIT | scan.next_address;
+        uint32_t start_us = micros();
+
+        if ((scan.next_address & 0xFF) == 0 && !scan.group_checked) {
+            // The header byte alone, as a 7-bit write with no data: every target sharing these
+            // two high address bits acknowledges it. The driver reports every NACK as the same
+            // code, so a full frame could not tell a missing group from a missing low byte.
+            wire->beginTransmission(tenBitHeader(address));
+            uint8_t error = wire->endTransmission();
+            recordBusTransaction(bus_id, tenBitHeader(address), start_us, 1, 1, wireError(error));
+            if (error != 0) {
+                scan.next_address += 0x100;
+            } else {
+                scan.group_checked = true;
+            }
+            continue;
+        }
+
+        beginFrame(wire, address);
+        uint8_t error = wire->endTransmission();
+        presence_probe[bus_id] = true;
+        recordTransaction(bus_id, address, start_us, 1, 1, wireError(error));
+        presence_probe[bus_id] = false;
+
+        scan.next_address++;
+        scan.group_checked = (scan.next_address & 0xFF) != 0;
+        if (error == 0) {
+            scan.found++;
+            onDeviceFound(bus_id, address);
+            registerDevice(bus_id, address);
+        }
+    }
+
+    if (scan.next_address <= 0x3FF) {
+        return;
+    }
+
+    scan.active = false;
+    std::vector<uint16_t> lost;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        for (auto& device : known_devices) {
+            if (device.bus_id == bus_id && isTenBitAddress(device.address) && device.responsive &&
+                (long)(device.last_seen - scan.started_at) < 0) {
+                device.responsive = false;
+                markRegistryChanged();
+                lost.push_back(device.address);
+            }
+        }
+    }
+    for (uint16_t address : lost) {
+        onDeviceLost(bus_id, address);
+    }
+}
+
+bool FlexibleI2C::isDevicePresent(uint8_t bus_id, uint16_t address) {
     if (!validateBusAndAddress(bus_id, address)) {
         return false;
     }
 
+    TransactionGuard bus_guard(*this, 1 << bus_id, address);
+    if (!bus_guard) {
+        return false;
+    }
+
+    uint32_t start_us = micros();
     TwoWire* wire = getBus(bus_id);
-    wire->beginTransmission(address);
+    if (!wire) {
+        return false;
+    }
+    beginFrame(wire, address);
     uint8_t error = wire->endTransmission();
+    presence_probe[bus_id] = true;
+    recordTransaction(bus_id, address, start_us, 1, 1, wireError(error));
+    presence_probe[bus_id] = false;
 
     return (error == 0);
 }
 
-bool FlexibleI2C::writeRegister(uint8_t bus_id, uint8_t device_address, uint8_t reg_address, uint8_t data) {
+bool FlexibleI2C::writeRegister(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t data) {
     if (!validateBusAndAddress(bus_id, device_address)) {
         return false;
     }
 
+    if (rejectQuarantined(bus_id, device_address)) {
+        return false;
+    }
+
+    if (deferWrite(bus_id, device_address, reg_address, &data, 1)) {
+        return last_error == SUCCESS;
+    }
+
+    TransactionGuard bus_guard(*this, 1 << bus_id, device_address);
+    if (!bus_guard) {
+        return false;
+    }
+
+    uint32_t start_us = micros();
     TwoWire* wire = getBus(bus_id);
-    wire->beginTransmission(device_address);
+    if (!wire) {
+        return false;
+    }
+    beginFrame(wire, device_address);
     wire->write(reg_address);
     wire->write(data);
     uint8_t error = wire->endTransmission();
 
     if (error == 0) {
         setError(SUCCESS);
-        return true;
     } else {
-        setError(static_cast<I2CError>(error));
-        return false;
+        setError(wireError(error));
     }
+    recordTransaction(bus_id, device_address, start_us, 3, 1, last_error);
+    return error == 0;
 }
 
-bool FlexibleI2C::writeRegister16(uint8_t bus_id, uint8_t device_address, uint8_t reg_address, uint16_t data) {
+bool FlexibleI2C::writeRegister16(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint16_t data) {
     if (!validateBusAndAddress(bus_id, device_address)) {
         return false;
     }
 
+    if (rejectQuarantined(bus_id, device_address)) {
+        return false;
+    }
+
+    uint8_t bytes[2] = { (uint8_t)(data >> 8), (uint8_t)(data & 0xFF) };
+    if (deferWrite(bus_id, device_address, reg_address, bytes, 2)) {
+        return last_error == SUCCESS;
+    }
+
+    TransactionGuard bus_guard(*this, 1 << bus_id, device_address);
+    if (!bus_guard) {
+        return false;
+    }
+
+    uint32_t start_us = micros();
     TwoWire* wire = getBus(bus_id);
-    wire->beginTransmission(device_address);
+    if (!wire) {
+        return false;
+    }
+    beginFrame(wire, device_address);
     wire->write(reg_address);
     wire->write(data >> 8);
     wire->write(data & 0xFF);
@@ -170,560 +530,4183 @@ bool FlexibleI2C::writeRegister16(uint8_t bus_id, uint8_t device_address, uint8_
 
     if (error == 0) {
         setError(SUCCESS);
-        return true;
     } else {
-        setError(static_cast<I2CError>(error));
-        return false;
+        setError(wireError(error));
     }
+    recordTransaction(bus_id, device_address, start_us, 4, 1, last_error);
+    return error == 0;
 }
 
-bool FlexibleI2C::writeBytes(uint8_t bus_id, uint8_t device_address, uint8_t reg_address, const uint8_t* data, size_t length) {
+bool FlexibleI2C::writeBytes(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, const uint8_t* data, size_t length) {
     if (!validateBusAndAddress(bus_id, device_address) || !data || length == 0) {
         setError(INVALID_PARAMETERS);
         return false;
     }
 
+    if (rejectQuarantined(bus_id, device_address)) {
+        return false;
+    }
+
+    if (deferWrite(bus_id, device_address, reg_address, data, length)) {
+        return last_error == SUCCESS;
+    }
+
+    TransactionGuard bus_guard(*this, 1 << bus_id, device_address);
+    if (!bus_guard) {
+        return false;
+    }
+
+    uint32_t start_us = micros();
     TwoWire* wire = getBus(bus_id);
-    wire->beginTransmission(device_address);
-    wire->write(reg_address);
-    for (size_t i = 0; i < length; i++) {
-        wire->write(data[i]);
+    if (!wire) {
+        return false;
     }
+    beginFrame(wire, device_address);
+    wire->write(reg_address);
+    wire->write(data, length);
     uint8_t error = wire->endTransmission();
 
     if (error == 0) {
         setError(SUCCESS);
-        return true;
     } else {
-        setError(static_cast<I2CError>(error));
-        return false;
+        setError(wireError(error));
     }
+    recordTransaction(bus_id, device_address, start_us, 2 + length, 1, last_error);
+    return error == 0;
 }
 
-uint8_t FlexibleI2C::readRegister(uint8_t bus_id, uint8_t device_address, uint8_t reg_address) {
+uint8_t FlexibleI2C::readRegister(uint8_t bus_id, uint16_t device_address, uint8_t reg_address) {
     if (!validateBusAndAddress(bus_id, device_address)) {
         return 0;
     }
 
+    if (rejectQuarantined(bus_id, device_address)) {
+        return 0;
+    }
+
+    if (!flushOverlapping(bus_id, device_address, reg_address, 1)) {
+        return 0;
+    }
+
+    TransactionGuard bus_guard(*this, 1 << bus_id, device_address);
+    if (!bus_guard) {
+        return 0;
+    }
+
+    uint32_t start_us = micros();
     TwoWire* wire = getBus(bus_id);
+    if (!wire) {
+        return 0;
+    }
 
-    wire->beginTransmission(device_address);
+    beginFrame(wire, device_address);
     wire->write(reg_address);
     uint8_t error = wire->endTransmission(false);
 
     if (error != 0) {
-        setError(static_cast<I2CError>(error));
+        setError(wireError(error));
+        recordTransaction(bus_id, device_address, start_us, 2, 1, last_error);
         return 0;
     }
 
-    uint8_t bytes_received = wire->requestFrom(device_address, (uint8_t)1, (uint8_t)true);
+    uint8_t value = 0;
+    uint8_t bytes_received = requestFrame(wire, device_address, 1, true);
     if (bytes_received == 1) {
+        value = wire->read();
         setError(SUCCESS);
-        return wire->read();
     } else {
         setError(TIMEOUT);
-        return 0;
     }
+    recordTransaction(bus_id, device_address, start_us, 4, 2, last_error);
+    return value;
 }
 
-uint16_t FlexibleI2C::readRegister16(uint8_t bus_id, uint8_t device_address, uint8_t reg_address) {
+uint16_t FlexibleI2C::readRegister16(uint8_t bus_id, uint16_t device_address, uint8_t reg_address) {
     if (!validateBusAndAddress(bus_id, device_address)) {
         return 0;
     }
 
+    if (rejectQuarantined(bus_id, device_address)) {
+        return 0;
+    }
+
+    if (!flushOverlapping(bus_id, device_address, reg_address, 2)) {
+        return 0;
+    }
+
+    TransactionGuard bus_guard(*this, 1 << bus_id, device_address);
+    if (!bus_guard) {
+        return 0;
+    }
+
+    uint32_t start_us = micros();
     TwoWire* wire = getBus(bus_id);
+    if (!wire) {
+        return 0;
+    }
 
-    wire->beginTransmission(device_address);
+    beginFrame(wire, device_address);
     wire->write(reg_address);
     uint8_t error = wire->endTransmission(false);
 
     if (error != 0) {
-        setError(static_cast<I2CError>(error));
+        setError(wireError(error));
+        recordTransaction(bus_id, device_address, start_us, 2, 1, last_error);
         return 0;
     }
 
-    uint8_t bytes_received = wire->requestFrom(device_address, (uint8_t)2, (uint8_t)true);
+    uint16_t result = 0;
+    uint8_t bytes_received = requestFrame(wire, device_address, 2, true);
     if (bytes_received == 2) {
-        uint16_t result = wire->read() << 8;
+        result = wire->read() << 8;
         result |= wire->read();
         setError(SUCCESS);
-        return result;
     } else {
         setError(TIMEOUT);
-        return 0;
     }
+    recordTransaction(bus_id, device_address, start_us, 5, 2, last_error);
+    return result;
 }
 
-bool FlexibleI2C::readBytes(uint8_t bus_id, uint8_t device_address, uint8_t reg_address, uint8_t* data, size_t length) {
+bool FlexibleI2C::readBytes(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t* data, size_t length) {
     if (!validateBusAndAddress(bus_id, device_address) || !data || length == 0) {
         setError(INVALID_PARAMETERS);
         return false;
     }
 
+    if (rejectQuarantined(bus_id, device_address)) {
+        return false;
+    }
+
+    if (!flushOverlapping(bus_id, device_address, reg_address, length)) {
+        return false;
+    }
+
+    TransactionGuard bus_guard(*this, 1 << bus_id, device_address);
+    if (!bus_guard) {
+        return false;
+    }
+
+    uint32_t start_us = micros();
     TwoWire* wire = getBus(bus_id);
+    if (!wire) {
+        return false;
+    }
 
-    wire->beginTransmission(device_address);
+    beginFrame(wire, device_address);
     wire->write(reg_address);
     uint8_t error = wire->endTransmission(false);
 
     if (error != 0) {
-        setError(static_cast<I2CError>(error));
+        setError(wireError(error));
+        recordTransaction(bus_id, device_address, start_us, 2, 1, last_error);
         return false;
     }
 
-    uint8_t bytes_received = wire->requestFrom(device_address, (uint8_t)length, (uint8_t)true);
+    uint8_t bytes_received = requestFrame(wire, device_address, length, true);
     if (bytes_received == length) {
         for (size_t i = 0; i < length; i++) {
             data[i] = wire->read();
         }
         setError(SUCCESS);
-        return true;
     } else {
         setError(TIMEOUT);
-        return false;
     }
+    recordTransaction(bus_id, device_address, start_us, 3 + length, 2, last_error);
+    return last_error == SUCCESS;
 }
 
-bool FlexibleI2C::beginTransmission(uint8_t bus_id, uint8_t address) {
-    if (!validateBusAndAddress(bus_id, address)) {
+bool FlexibleI2C::generalCall(uint8_t bus_id, const uint8_t* data, size_t length) {
+    if (bus_id > 1) {
+        setError(INVALID_PARAMETERS);
         return false;
     }
-
-    TwoWire* wire = getBus(bus_id);
-    wire->beginTransmission(address);
-    return true;
+    return broadcastTrigger(1 << bus_id, GENERAL_CALL, data, length);
 }
 
-bool FlexibleI2C::endTransmission(uint8_t bus_id, bool stop) {
-    if (!isBusInitialized(bus_id)) {
-        setError(BUS_NOT_INITIALIZED);
+bool FlexibleI2C::broadcastTrigger(uint8_t bus_mask, uint8_t address, const uint8_t* data, size_t length, uint32_t* trigger_us) {
+    if (!(bus_mask & 0x03) || (bus_mask & ~0x03) || address > 0x7F || !data || length == 0 || length > 127) {
+        setError(INVALID_PARAMETERS);
         return false;
     }
 
-    TwoWire* wire = getBus(bus_id);
-    uint8_t error = wire->endTransmission(stop);
+    TwoWire* wires[2] = { nullptr, nullptr };
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (!(bus_mask & (1 << bus_id))) {
+            continue;
+        }
+        if (!isBusInitialized(bus_id)) {
+            setError(BUS_NOT_INITIALIZED);
+            return false;
+        }
 
-    if (error == 0) {
-        setError(SUCCESS);
-        return true;
-    } else {
-        setError(static_cast<I2CError>(error));
-        return false;
+        // Buffered writes go out first so the trigger cannot overtake them
+        for (uint32_t key : pendingKeys(bus_id)) {
+            flushPending(key);
+        }
     }
-}
 
-bool FlexibleI2C::requestFrom(uint8_t bus_id, uint8_t address, uint8_t quantity, bool stop) {
-    if (!validateBusAndAddress(bus_id, address)) {
+    // Every target may act on the frame, so it queues behind any session on either bus.
+    // Both buses stay locked from loading the frames to the last STOP.
+    TransactionGuard bus_guard(*this, bus_mask, 0);
+    if (!bus_guard) {
         return false;
     }
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (bus_mask & (1 << bus_id)) {
+            wires[bus_id] = getBus(bus_id);
+            if (!wires[bus_id]) {
+                setError(BUS_NOT_INITIALIZED);
+                return false;
+            }
+        }
+    }
 
-    TwoWire* wire = getBus(bus_id);
-    uint8_t bytes_received = wire->requestFrom(address, quantity, (uint8_t)stop);
+    // Load both frames first, so only the first transfer separates the two triggers
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (wires[bus_id]) {
+            wires[bus_id]->beginTransmission(address);
+            wires[bus_id]->write(data, length);
+        }
+    }
 
-    return (bytes_received == quantity);
+    uint32_t start_us[2] = { 0, 0 };
+    uint32_t done_us[2] = { 0, 0 };
+    uint8_t errors[2] = { 0, 0 };
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (wires[bus_id]) {
+            start_us[bus_id] = micros();
+            errors[bus_id] = wires[bus_id]->endTransmission();
+            done_us[bus_id] = micros();
+        }
+    }
+
+    I2CError result = SUCCESS;
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (!wires[bus_id]) {
+            continue;
+        }
+        I2CError error = wireError(errors[bus_id]);
+        // Addressed to every listener, not a device: no device stats, health or registry entry,
+        // so a broadcast no target acknowledges cannot quarantine a phantom
+        recordBusTransaction(bus_id, address, start_us[bus_id], 1 + length, 1, error);
+        if (trigger_us) {
+            trigger_us[bus_id] = done_us[bus_id];
+        }
+        if (result == SUCCESS) {
+            result = error;
+        }
+    }
+
+    setError(result);
+    return result == SUCCESS;
 }
 
-String FlexibleI2C::getErrorString(I2CError error) {
-    switch (error) {
-        case SUCCESS: return "Success";
-        case TIMEOUT: return "Timeout";
-        case NACK_ADDRESS: return "NACK on address";
-        case NACK_DATA: return "NACK on data";
-        case OTHER_ERROR: return "Other error";
-        case BUS_NOT_INITIALIZED: return "Bus not initialized";
-        case INVALID_PARAMETERS: return "Invalid parameters";
-        default: return "Unknown error";
+bool FlexibleI2C::triggerAndRead(uint8_t bus_mask, uint8_t address, const uint8_t* data, size_t length,
+                                 std::vector<I2CSyncRead>& reads, uint32_t settle_us, uint32_t* trigger_us) {
+    for (const auto& read : reads) {
+        if (read.bus_id > 1 || !(bus_mask & (1 << read.bus_id)) || read.length == 0 || read.length > I2CSyncRead::DATA_MAX) {
+            setError(INVALID_PARAMETERS);
+            return false;
+        }
+    }
+
+    uint32_t triggered_us[2] = { 0, 0 };
+    if (!broadcastTrigger(bus_mask, address, data, length, triggered_us)) {
+        return false;
+    }
+    if (trigger_us) {
+        trigger_us[0] = triggered_us[0];
+        trigger_us[1] = triggered_us[1];
+    }
+
+    bool all_success = true;
+    for (auto& read : reads) {
+        uint32_t reference = triggered_us[read.bus_id];
+        int32_t remaining;
+        while ((remaining = (int32_t)(reference + settle_us - micros())) > 0) {
+            // Sleep through long settle times, spin only for the last stretch
+            if (remaining >= 2000) {
+                delay(remaining / 1000 - 1);
+            } else {
+                delayMicroseconds(remaining);
+            }
+        }
+
+        read.request_offset_us = micros() - reference;
+        read.success = readBytes(read.bus_id, read.device_address, read.reg_address, read.data, read.length);
+        read.offset_us = micros() - reference;
+        if (!read.success) {
+            all_success = false;
+        }
+    }
+    return all_success;
+}
+
+bool FlexibleI2C::beginTransmission(uint8_t bus_id, uint16_t address) {
+    // A failed repeated START ends a transaction the caller left open
+    if (!validateBusAndAddress(bus_id, address)) {
+        releaseRawLock(bus_id);
+        return false;
+    }
+    // Held until the transaction ends with a STOP, in endTransmission() or requestFrom().
+    // While it is held no session can begin, so only taking it needs the session re-check.
+    RawTransaction& raw = raw_transactions[bus_id];
+    while (raw.owner != xTaskGetCurrentTaskHandle()) {
+        if (!waitForSession(bus_id, address)) {
+            return false;
+        }
+        bus_locks[bus_id].lock();
+        if (sessionBlocks(bus_id, address)) {
+            bus_locks[bus_id].unlock();
+        } else {
+            raw.owner = xTaskGetCurrentTaskHandle();
+        }
+    }
+
+    TwoWire* wire = getBus(bus_id);
+    if (!wire) {
+        releaseRawLock(bus_id);
+        return false;
     }
+    beginFrame(wire, address);
+    raw.start_us = micros();
+    raw.address = address;
+    raw.open = false;
+    return true;
 }
 
-bool FlexibleI2C::validateBusAndAddress(uint8_t bus_id, uint8_t address) {
+bool FlexibleI2C::endTransmission(uint8_t bus_id, bool stop) {
+    if (bus_id > 1) {
+        setError(BUS_NOT_INITIALIZED);
+        return false;
+    }
+    // Nested for the owner; a task without a raw transaction waits for the owner's STOP
+    I2CBusLock::Guard bus_guard(bus_locks[bus_id]);
+    RawTransaction& raw = raw_transactions[bus_id];
     if (!isBusInitialized(bus_id)) {
+        releaseRawLock(bus_id);
         setError(BUS_NOT_INITIALIZED);
         return false;
     }
 
-    if (address == 0 || address > 127) {
+    TwoWire* wire = getBus(bus_id);
+    if (!wire) {
+        releaseRawLock(bus_id);
+        return false;
+    }
+    uint8_t error = wire->endTransmission(stop);
+
+    if (error == 0) {
+        setError(SUCCESS);
+    } else {
+        setError(wireError(error));
+    }
+    // Payload written directly through getBus() is not visible here; only the address byte is counted
+    recordTransaction(bus_id, raw.address, raw.start_us, 1, 1, last_error);
+    raw.open = error == 0 && !stop;
+    if (!raw.open) {
+        releaseRawLock(bus_id);
+    }
+    return error == 0;
+}
+
+void FlexibleI2C::releaseRawLock(uint8_t bus_id) {
+    // Only the task that opened the transaction holds the lock for it
+    if (bus_id > 1 || raw_transactions[bus_id].owner != xTaskGetCurrentTaskHandle()) {
+        return;
+    }
+    raw_transactions[bus_id].owner = nullptr;
+    raw_transactions[bus_id].open = false;
+    bus_locks[bus_id].unlock();
+}
+
+bool FlexibleI2C::requestFrom(uint8_t bus_id, uint16_t address, uint8_t quantity, bool stop) {
+    // A failed call ends the caller's raw transaction, so the lock goes with it
+    if (!validateBusAndAddress(bus_id, address)) {
+        releaseRawLock(bus_id);
+        return false;
+    }
+    TransactionGuard bus_guard(*this, 1 << bus_id, address);
+    if (!bus_guard) {
+        releaseRawLock(bus_id);
+        return false;
+    }
+
+    // A 10-bit target stays addressed after endTransmission(false); otherwise it is addressed here
+    RawTransaction& raw = raw_transactions[bus_id];
+    bool addressed = raw.owner == xTaskGetCurrentTaskHandle() && raw.open && raw.address == address;
+    raw.open = false;
+
+    uint32_t start_us = micros();
+    TwoWire* wire = getBus(bus_id);
+    if (!wire) {
+        releaseRawLock(bus_id);
+        return false;
+    }
+    uint8_t bytes_received = requestFrame(wire, address, quantity, addressed, stop);
+    uint8_t starts = addressed ? 1 : addressBytes(address);
+    size_t wire_bytes = starts + quantity;
+    if (addressed && isTenBitAddress(address)) {
+        wire_bytes--; // header-only repeated START, no low address byte
+    }
+    recordTransaction(bus_id, address, start_us, wire_bytes, starts, bytes_received == quantity ? SUCCESS : TIMEOUT);
+    if (stop || bytes_received != quantity) {
+        releaseRawLock(bus_id);
+    }
+
+    return (bytes_received == quantity);
+}
+
+uint8_t FlexibleI2C::smbusPec(uint16_t device_address, uint8_t command, const uint8_t* data, size_t length, bool read_phase) {
+    const I2CCrc8& crc8 = I2CCrc8::smbus();
+    uint8_t crc = crc8.begin();
+    if (isTenBitAddress(device_address)) {
+        crc = crc8.update(crc, (uint8_t)(tenBitHeader(device_address) << 1));
+        crc = crc8.update(crc, (uint8_t)(device_address & 0xFF));
+    } else {
+        crc = crc8.update(crc, (uint8_t)(device_address << 1));
+    }
+    crc = crc8.update(crc, command);
+    if (read_phase) {
+        crc = crc8.update(crc, smbusReadAddress(device_address));
+    }
+    crc = crc8.update(crc, data, length);
+    return crc8.finish(crc);
+}
+
+bool FlexibleI2C::smbusWriteWord(uint8_t bus_id, uint16_t device_address, uint8_t command, uint16_t value, bool use_pec) {
+    uint8_t buffer[3] = { (uint8_t)(value & 0xFF), (uint8_t)(value >> 8), 0 };
+    if (use_pec) {
+        buffer[2] = smbusPec(device_address, command, buffer, 2, false);
+    }
+    return writeBytes(bus_id, device_address, command, buffer, use_pec ? 3 : 2);
+}
+
+bool FlexibleI2C::smbusReadWord(uint8_t bus_id, uint16_t device_address, uint8_t command, uint16_t& value, bool use_pec) {
+    uint8_t buffer[3];
+    if (!readBytes(bus_id, device_address, command, buffer, use_pec ? 3 : 2)) {
+        return false;
+    }
+
+    if (use_pec && smbusPec(device_address, command, buffer, 2, true) != buffer[2]) {
+        setError(PEC_ERROR);
+        return false;
+    }
+
+    value = buffer[0] | (buffer[1] << 8);
+    return true;
+}
+
+bool FlexibleI2C::smbusBlockWrite(uint8_t bus_id, uint16_t device_address, uint8_t command, const uint8_t* data, uint8_t length, bool use_pec) {
+    if (!data || length == 0 || length > SMBUS_BLOCK_MAX) {
+        setError(INVALID_PARAMETERS);
+        return false;
+    }
+
+    uint8_t buffer[SMBUS_BLOCK_MAX + 2];
+    buffer[0] = length;
+    memcpy(buffer + 1, data, length);
+    size_t total = length + 1;
+    if (use_pec) {
+        buffer[total] = smbusPec(device_address, command, buffer, total, false);
+        total++;
+    }
+    return writeBytes(bus_id, device_address, command, buffer, total);
+}
+
+bool FlexibleI2C::smbusBlockRead(uint8_t bus_id, uint16_t device_address, uint8_t command, uint8_t* data, uint8_t& length, bool use_pec) {
+    if (!data || length == 0) {
+        setError(INVALID_PARAMETERS);
+        return false;
+    }
+
+    // The controller cannot stop mid-transfer on the count byte, so read the
+    // largest block the caller can accept and trim to the reported count.
+    uint8_t capacity = length > SMBUS_BLOCK_MAX ? SMBUS_BLOCK_MAX : length;
+    uint8_t buffer[SMBUS_BLOCK_MAX + 2];
+    if (!readBytes(bus_id, device_address, command, buffer, capacity + (use_pec ? 2 : 1))) {
+        return false;
+    }
+
+    uint8_t count = buffer[0];
+    if (count == 0 || count > capacity) {
         setError(INVALID_PARAMETERS);
         return false;
     }
 
+    if (use_pec && smbusPec(device_address, command, buffer, count + 1, true) != buffer[count + 1]) {
+        setError(PEC_ERROR);
+        return false;
+    }
+
+    memcpy(data, buffer + 1, count);
+    length = count;
     return true;
 }
 
-void FlexibleI2C::registerBuiltinEndpoints(FlexibleEndpoints& endpoints) {
-    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
-        .route("/initI2C")
-        .summary("Initialize I2C bus")
-        .description("Initialize an I2C bus with specified pins and frequency")
-        .params({
-            REQUIRED_INT_PARAM("bus_id", "Bus ID (0 or 1)"),
-            REQUIRED_INT_PARAM("sda_pin", "SDA pin number"),
-            REQUIRED_INT_PARAM("scl_pin", "SCL pin number"),
-            INT_PARAM("frequency", "Bus frequency in Hz (default 100000)")
-        })
-        .responseType(JSON_RESPONSE)
-        .handler([this](std::map<String, String>& params) {
-            return handleInitBus(params);
-        })
-    );
+bool FlexibleI2C::smbusProcessCall(uint8_t bus_id, uint16_t device_address, uint8_t command, uint16_t value, uint16_t& result, bool use_pec) {
+    if (!validateBusAndAddress(bus_id, device_address)) {
+        return false;
+    }
 
-    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
-        .route("/scanI2C")
-        .summary("Scan I2C bus for devices")
-        .description("Scan the specified I2C bus for responsive devices")
-        .params({
-            REQUIRED_INT_PARAM("bus_id", "Bus ID to scan")
-        })
-        .responseType(JSON_RESPONSE)
-        .handler([this](std::map<String, String>& params) {
-            return handleScanBus(params);
-        })
-    );
+    if (rejectQuarantined(bus_id, device_address)) {
+        return false;
+    }
 
-    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
-        .route("/getI2CDevices")
-        .summary("Get all known devices")
-        .description("Get information about all known I2C devices")
-        .responseType(JSON_RESPONSE)
-        .handler([this](std::map<String, String>& params) {
-            return handleDeviceInfo(params);
-        })
-    );
+    if (!flushDevice(bus_id, device_address)) {
+        return false;
+    }
 
-    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
-        .route("/readI2C")
-        .summary("Read register from device")
-        .description("Read a register value from an I2C device")
-        .params({
-            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
-            REQUIRED_STR_PARAM("device_addr", "Device address (hex format, e.g., '0x48')"),
-            REQUIRED_STR_PARAM("reg_addr", "Register address (hex format)")
-        })
-        .responseType(JSON_RESPONSE)
-        .handler([this](std::map<String, String>& params) {
-            return handleReadRegister(params);
-        })
-    );
+    uint8_t out[2] = { (uint8_t)(value & 0xFF), (uint8_t)(value >> 8) };
 
-    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
-        .route("/writeI2C")
-        .summary("Write register to device")
-        .description("Write a value to a register on an I2C device")
-        .params({
-            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
-            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
-            REQUIRED_STR_PARAM("reg_addr", "Register address (hex format)"),
-            REQUIRED_STR_PARAM("value", "Value to write (hex format)")
-        })
-        .responseType(JSON_RESPONSE)
-        .handler([this](std::map<String, String>& params) {
-            return handleWriteRegister(params);
-        })
-    );
+    TransactionGuard bus_guard(*this, 1 << bus_id, device_address);
+    if (!bus_guard) {
+        return false;
+    }
 
-    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
-        .route("/pingI2C")
-        .summary("Ping I2C device")
-        .description("Check if an I2C device is responding")
-        .params({
-            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
-            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)")
-        })
-        .responseType(JSON_RESPONSE)
-        .handler([this](std::map<String, String>& params) {
-            return handlePingDevice(params);
-        })
-    );
+    uint32_t start_us = micros();
+    TwoWire* wire = getBus(bus_id);
+    if (!wire) {
+        return false;
+    }
+    beginFrame(wire, device_address);
+    wire->write(command);
+    wire->write(out, 2);
+    uint8_t error = wire->endTransmission(false);
 
-    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
-        .route("/readI2CBytes")
-        .summary("Read multiple bytes from device")
-        .description("Read multiple bytes from a register on an I2C device")
-        .params({
-            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
-            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
-            REQUIRED_STR_PARAM("reg_addr", "Register address (hex format)"),
-            REQUIRED_INT_PARAM("length", "Number of bytes to read")
-        })
-        .responseType(JSON_RESPONSE)
-        .handler([this](std::map<String, String>& params) {
-            return handleReadBytes(params);
-        })
-    );
+    if (error != 0) {
+        setError(wireError(error));
+        recordTransaction(bus_id, device_address, start_us, 4, 1, last_error);
+        return false;
+    }
 
-    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
-        .route("/writeI2CBytes")
-        .summary("Write multiple bytes to device")
-        .description("Write multiple bytes to a register on an I2C device")
-        .params({
-            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
-            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
-            REQUIRED_STR_PARAM("reg_addr", "Register address (hex format)"),
-            REQUIRED_STR_PARAM("data", "Comma-separated hex values (e.g., '0x01,0x02,0x03')")
-        })
-        .responseType(JSON_RESPONSE)
-        .handler([this](std::map<String, String>& params) {
-            return handleWriteBytes(params);
-        })
-    );
+    uint8_t quantity = use_pec ? 3 : 2;
+    uint8_t in[3];
+    uint8_t bytes_received = requestFrame(wire, device_address, quantity, true);
+    if (bytes_received != quantity) {
+        setError(TIMEOUT);
+        recordTransaction(bus_id, device_address, start_us, 5 + quantity, 2, last_error);
+        return false;
+    }
+    for (uint8_t i = 0; i < quantity; i++) {
+        in[i] = wire->read();
+    }
+    recordTransaction(bus_id, device_address, start_us, 5 + quantity, 2, SUCCESS);
+
+    if (use_pec) {
+        const I2CCrc8& crc8 = I2CCrc8::smbus();
+        uint8_t crc = smbusPec(device_address, command, out, 2, false);
+        crc = crc8.update(crc, smbusReadAddress(device_address));
+        crc = crc8.finish(crc8.update(crc, in, 2));
+        if (crc != in[2]) {
+            setError(PEC_ERROR);
+            return false;
+        }
+    }
+
+    result = in[0] | (in[1] << 8);
+    setError(SUCCESS);
+    return true;
 }
 
-std::pair<String, int> FlexibleI2C::handleInitBus(std::map<String, String>& params) {
-    JsonDocument response;
+size_t FlexibleI2C::verifyWordsCrc(const uint8_t* raw, size_t count, uint16_t* words, std::vector<size_t>* failed_words, const I2CCrc8& crc8) {
+    size_t failures = 0;
+    uint8_t init = crc8.begin();
+    for (size_t i = 0; i < count; i++, raw += 3) {
+        uint8_t crc = crc8.finish(crc8.update(crc8.update(init, raw[0]), raw[1]));
+        if (crc == raw[2]) {
+            words[i] = (raw[0] << 8) | raw[1];
+        } else {
+            failures++;
+            if (failed_words) {
+                failed_words->push_back(i);
+            }
+        }
+    }
+    return failures;
+}
 
-    if (params.find("bus_id") == params.end() || params.find("sda_pin") == params.end() || params.find("scl_pin") == params.end()) {
-        response["success"] = false;
-        response["error"] = "Missing required parameters";
-        String output;
-        serializeJson(response, output);
-        return {output, 400};
+bool FlexibleI2C::readWordsCrc(uint8_t bus_id, uint16_t device_address, uint16_t command, uint16_t* words, size_t count,
+                               std::vector<size_t>* failed_words, uint8_t retries, uint16_t delay_ms, const I2CCrc8& crc8) {
+    // Until a read verifies, every word counts as failed
+    if (failed_words) {
+        failed_words->clear();
+        for (size_t i = 0; i < count && i < CRC_WORDS_MAX; i++) {
+            failed_words->push_back(i);
+        }
     }
 
-    uint8_t bus_id = params["bus_id"].toInt();
-    uint8_t sda_pin = params["sda_pin"].toInt();
-    uint8_t scl_pin = params["scl_pin"].toInt();
-    uint32_t frequency = params.find("frequency") != params.end() ? params["frequency"].toInt() : 100000;
+    if (!validateBusAndAddress(bus_id, device_address)) {
+        return false;
+    }
 
-    bool success = initBus(bus_id, sda_pin, scl_pin, frequency);
+    if (rejectQuarantined(bus_id, device_address)) {
+        return false;
+    }
+    if (!words || count == 0 || count > CRC_WORDS_MAX) {
+        setError(INVALID_PARAMETERS);
+        return false;
+    }
+    if (!flushDevice(bus_id, device_address)) {
+        return false;
+    }
 
-    response["success"] = success;
-    response["bus_id"] = bus_id;
-    response["sda_pin"] = sda_pin;
-    response["scl_pin"] = scl_pin;
-    response["frequency"] = frequency;
+    uint8_t raw[CRC_WORDS_MAX * 3];
+    uint16_t received[CRC_WORDS_MAX];
+    uint8_t quantity = count * 3;
+    std::vector<size_t> failing;
+
+    for (uint8_t attempt = 0; attempt <= retries; attempt++) {
+        // Every attempt is a complete command + read, so the words always come from one
+        // measurement and devices that only answer after a command see one each time
+        uint8_t error;
+        {
+            TransactionGuard bus_guard(*this, 1 << bus_id, device_address);
+            TwoWire* wire = bus_guard ? getBus(bus_id) : nullptr;
+            if (!wire) {
+                return false;
+            }
+            uint32_t start_us = micros();
+            beginFrame(wire, device_address);
+            wire->write(command >> 8);
+            wire->write(command & 0xFF);
+            error = wire->endTransmission();
+            recordTransaction(bus_id, device_address, start_us, 3, 1, wireError(error));
+            // The idle timer restarts at the end of the command, so the delay does not count
+            // towards a power-down
+            markBusActivity(bus_id);
+        }
+        if (error != 0) {
+            setError(wireError(error));
+            return false;
+        }
+
+        // The bus is free for other devices while the command executes
+        if (delay_ms) {
+            delay(delay_ms);
+        }
+
+        {
+            // Fetched again under the lock: update() may have powered the bus down meanwhile
+            TransactionGuard bus_guard(*this, 1 << bus_id, device_address);
+            TwoWire* wire = bus_guard ? getBus(bus_id) : nullptr;
+            if (!wire) {
+                return false;
+            }
+            uint32_t start_us = micros();
+            // The write phase ended with a STOP, so a 10-bit target has to be addressed again
+            uint8_t bytes_received = requestFrame(wire, device_address, quantity, false);
+            recordTransaction(bus_id, device_address, start_us, addressBytes(device_address) + quantity, addressBytes(device_address),
+                              bytes_received == quantity ? SUCCESS : TIMEOUT);
+            if (bytes_received != quantity) {
+                setError(TIMEOUT);
+                return false;
+            }
+            for (uint8_t i = 0; i < quantity; i++) {
+                raw[i] = wire->read();
+            }
+        }
+
+        memcpy(received, words, count * sizeof(uint16_t));
+        failing.clear();
+        if (verifyWordsCrc(raw, count, received, &failing, crc8) == 0) {
+            break;
+        }
+    }
+
+    // Verified words of the last read only; failed words keep the caller's values
+    memcpy(words, received, count * sizeof(uint16_t));
+    if (failed_words) {
+        *failed_words = failing;
+    }
+
+    if (!failing.empty()) {
+        setError(PEC_ERROR);
+        return false;
+    }
+
+    setError(SUCCESS);
+    return true;
+}
+
+uint32_t FlexibleI2C::beginSession(uint8_t bus_id, uint16_t device_address, uint32_t lease_ms, uint32_t wait_ms) {
+    if (!isBusInitialized(bus_id) || (device_address != 0 && !isValidAddress(device_address)) || lease_ms == 0) {
+        setError(bus_id > 1 || !isBusInitialized(bus_id) ? BUS_NOT_INITIALIZED : INVALID_PARAMETERS);
+        return 0;
+    }
+
+    // HTTP handlers and update() do not queue, as in waitForSession()
+    uint32_t http_session_id;
+    bool from_http = httpSession(http_session_id);
+    if (from_http || update_task == xTaskGetCurrentTaskHandle()) {
+        wait_ms = 0;
+    }
+
+    I2CSession& session = sessions[bus_id];
+    // Queue behind an open session; a session whose lease has run out is closed on its behalf
+    uint32_t wait_start = micros();
+    unsigned long deadline = millis() + wait_ms;
+    while (xSemaphoreTake(session.gate, 0) != pdTRUE) {
+        long until_expiry = session.id ? (long)(session.expires_at - millis()) : 0;
+        long until_deadline = (long)(deadline - millis());
+        if (session.id && until_expiry <= 0) {
+            closeSession(bus_id, true);
+            continue;
+        }
+        if (until_deadline <= 0) {
+            I2CBusLock::Guard state_guard(state_lock);
+            bus_stats[bus_id].session_rejects += wait_ms == 0;
+            setError(wait_ms == 0 ? SESSION_BUSY : TIMEOUT);
+            return 0;
+        }
+        long wait = until_expiry > 0 && until_expiry < until_deadline ? until_expiry : until_deadline;
+        if (xSemaphoreTake(session.gate, pdMS_TO_TICKS(wait)) == pdTRUE) {
+            break;
+        }
+    }
+    {
+        // Published under the bus lock: a transaction already holding it finishes first, and
+        // one taking it afterwards sees the session on its re-check
+        I2CBusLock::Guard bus_guard(bus_locks[bus_id]);
+        session.id = next_session_id++;
+        session.device_address = device_address;
+        session.owner_task = from_http ? nullptr : xTaskGetCurrentTaskHandle();
+        session.expires_at = millis() + lease_ms;
+        session.started_us = micros();
+    }
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        bus_stats[bus_id].session_wait_us += session.started_us - wait_start;
+        bus_stats[bus_id].sessions++;
+    }
+
+    setError(SUCCESS);
+    return session.id;
+}
+
+bool FlexibleI2C::extendSession(uint32_t session_id, uint32_t lease_ms) {
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (session_id != 0 && sessions[bus_id].id == session_id) {
+            if (!mayEndSession(sessions[bus_id])) {
+                setError(SESSION_BUSY);
+                return false;
+            }
+            sessions[bus_id].expires_at = millis() + lease_ms;
+            return true;
+        }
+    }
+    setError(INVALID_PARAMETERS);
+    return false;
+}
+
+bool FlexibleI2C::endSession(uint32_t session_id) {
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (session_id != 0 && sessions[bus_id].id == session_id) {
+            if (!mayEndSession(sessions[bus_id])) {
+                setError(SESSION_BUSY);
+                return false;
+            }
+            closeSession(bus_id, false);
+            return true;
+        }
+    }
+    setError(INVALID_PARAMETERS);
+    return false;
+}
+
+bool FlexibleI2C::mayEndSession(const I2CSession& session) {
+    // A session opened over HTTP is ended by id from any request, as /endSession does
+    return !session.owner_task || isSessionOwner(session);
+}
+
+void FlexibleI2C::closeSession(uint8_t bus_id, bool expired) {
+    I2CSession& session = sessions[bus_id];
+    if (!session.id) {
+        return;
+    }
+
+    uint32_t hold_us = micros() - session.started_us;
+    I2CBusLock::Guard state_guard(state_lock);
+    I2CBusStats& stats = bus_stats[bus_id];
+    stats.session_hold_us += hold_us;
+    if (hold_us > stats.session_max_hold_us) {
+        stats.session_max_hold_us = hold_us;
+    }
+    if (expired) {
+        stats.sessions_expired++;
+    }
+
+    session.id = 0;
+    session.owner_task = nullptr;
+    xSemaphoreGive(session.gate);
+}
+
+bool FlexibleI2C::sessionBlocks(uint8_t bus_id, uint16_t address) {
+    const I2CSession& session = sessions[bus_id];
+    return session.id && !isSessionOwner(session) &&
+           (session.device_address == 0 || address == 0 || session.device_address == address);
+}
+
+bool FlexibleI2C::isSessionOwner(const I2CSession& session) {
+    if (session.owner_task) {
+        return session.owner_task == xTaskGetCurrentTaskHandle();
+    }
+    uint32_t http_session_id;
+    return httpSession(http_session_id) && session.id == http_session_id;
+}
+
+bool FlexibleI2C::waitForSession(uint8_t bus_id, uint16_t address) {
+    if (bus_id > 1) {
+        return true;
+    }
+
+    // HTTP handlers and update() share their task with everything else, so they are turned
+    // away rather than parked for the rest of the lease
+    uint32_t http_session_id;
+    bool fail_fast = httpSession(http_session_id) || update_task == xTaskGetCurrentTaskHandle();
+
+    I2CSession& session = sessions[bus_id];
+    uint32_t wait_start = 0;
+    while (sessionBlocks(bus_id, address)) {
+        long until_expiry = (long)(session.expires_at - millis());
+        if (until_expiry <= 0) {
+            closeSession(bus_id, true);
+            break;
+        }
+        if (fail_fast) {
+            I2CBusLock::Guard state_guard(state_lock);
+            bus_stats[bus_id].session_rejects++;
+            setError(SESSION_BUSY);
+            return false;
+        }
+        if (!wait_start) {
+            wait_start = micros();
+        }
+        // Pass through the gate once the owner releases it, then let the next waiter in
+        if (xSemaphoreTake(session.gate, pdMS_TO_TICKS(until_expiry)) == pdTRUE) {
+            xSemaphoreGive(session.gate);
+        }
+    }
+
+    if (wait_start) {
+        I2CBusLock::Guard state_guard(state_lock);
+        bus_stats[bus_id].session_wait_us += micros() - wait_start;
+    }
+    return true;
+}
+
+void FlexibleI2C::setDeferredWrites(bool enabled, uint32_t deadline_ms) {
+    if (!enabled) {
+        flush();
+    }
+    deferred_writes_enabled = enabled;
+    deferred_write_deadline_ms = deadline_ms;
+}
+
+void FlexibleI2C::setWriteCoalescing(uint8_t bus_id, uint16_t device_address, bool enabled) {
+    uint32_t key = deviceKey(bus_id, device_address);
+    if (enabled) {
+        I2CBusLock::Guard state_guard(state_lock);
+        coalescing_disabled.erase(key);
+    } else {
+        flushDevice(bus_id, device_address);
+        I2CBusLock::Guard state_guard(state_lock);
+        coalescing_disabled[key] = true;
+    }
+}
+
+bool FlexibleI2C::deferWrite(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, const uint8_t* data, size_t length) {
+    uint32_t key = deviceKey(bus_id, device_address);
+    bool buffered = deferred_writes_enabled && reg_address + length <= 256;
+    bool flush_first;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        auto it = pending_writes.find(key);
+        if (it != pending_writes.end() && it->second.flushing == xTaskGetCurrentTaskHandle()) {
+            return false; // the flush's own writes go out directly
+        }
+        buffered = buffered && coalescing_disabled.find(key) == coalescing_disabled.end();
+        flush_first = it != pending_writes.end() && !it->second.runs.empty() &&
+                      (!buffered || it->second.bytes + length > DEFERRED_BYTES_MAX);
+    }
+
+    // A direct write or a full buffer waits for the buffered writes; if they cannot be
+    // written the new write is refused rather than sent ahead of them
+    if (flush_first && !flushPending(key)) {
+        return true;
+    }
+    if (!buffered) {
+        return false;
+    }
+
+    I2CBusLock::Guard state_guard(state_lock);
+    PendingWrites& pending = pending_writes[key];
+    if (pending.runs.empty()) {
+        pending.first_write = millis();
+    }
+
+    // Writes stay in program order; only a write continuing the previous one at the next
+    // register joins its burst, so repeated writes to a register all reach the device
+    for (size_t i = 0; i < length;) {
+        uint8_t reg = reg_address + i;
+        PendingRun* run = pending.runs.empty() ? nullptr : &pending.runs.back();
+        if (!run || run->reg_address + run->data.size() != reg || run->data.size() == DEFERRED_BURST_MAX) {
+            pending.runs.push_back(PendingRun());
+            run = &pending.runs.back();
+            run->reg_address = reg;
+        }
+        size_t chunk = DEFERRED_BURST_MAX - run->data.size();
+        if (chunk > length - i) {
+            chunk = length - i;
+        }
+        run->data.insert(run->data.end(), data + i, data + i + chunk);
+        pending.bytes += chunk;
+        i += chunk;
+    }
+
+    deferred_write_count++;
+    setError(SUCCESS);
+    return true;
+}
+
+bool FlexibleI2C::flushPending(uint32_t key) {
+    uint8_t bus_id = key >> 16;
+    uint16_t device_address = key & 0xFFFF;
+    TaskHandle_t self = xTaskGetCurrentTaskHandle();
+
+    // The runs are taken out under state_lock and written without it; writes buffered by
+    // other tasks meanwhile queue behind them
+    std::vector<PendingRun> runs;
+    state_lock.lock();
+    for (;;) {
+        auto it = pending_writes.find(key);
+        if (it == pending_writes.end() || it->second.runs.empty() || it->second.flushing == self) {
+            state_lock.unlock();
+            return true;
+        }
+        if (!it->second.flushing) {
+            runs.swap(it->second.runs);
+            it->second.bytes = 0;
+            it->second.flushing = self;
+            break;
+        }
+        // Another task is flushing this device; its runs reach the device first
+        state_lock.unlock();
+        delay(1);
+        state_lock.lock();
+    }
+    state_lock.unlock();
+
+    size_t written = 0;
+    while (written < runs.size()) {
+        const PendingRun& run = runs[written];
+        if (!writeBytes(bus_id, device_address, run.reg_address, run.data.data(), run.data.size())) {
+            break;
+        }
+        written++;
+    }
+
+    I2CBusLock::Guard state_guard(state_lock);
+    PendingWrites& pending = pending_writes[key];
+    pending.flushing = nullptr;
+    coalesced_burst_count += written;
+    if (written == runs.size()) {
+        return true;
+    }
+
+    // The failed run and everything after it go back ahead of anything buffered since;
+    // writeBytes() left the error in last_error and the retry waits another deadline. A
+    // session holding the device is not a write error.
+    runs.erase(runs.begin(), runs.begin() + written);
+    for (const PendingRun& run : runs) {
+        pending.bytes += run.data.size();
+    }
+    runs.insert(runs.end(), pending.runs.begin(), pending.runs.end());
+    pending.runs.swap(runs);
+    if (last_error != SESSION_BUSY) {
+        deferred_write_errors++;
+    }
+    pending.first_write = millis();
+    return false;
+}
+
+std::vector<uint32_t> FlexibleI2C::pendingKeys(int bus_id) {
+    I2CBusLock::Guard state_guard(state_lock);
+    std::vector<uint32_t> keys;
+    for (const auto& entry : pending_writes) {
+        if (!entry.second.runs.empty() && (bus_id < 0 || (int)(entry.first >> 16) == bus_id)) {
+            keys.push_back(entry.first);
+        }
+    }
+    return keys;
+}
+
+bool FlexibleI2C::flushDevice(uint8_t bus_id, uint16_t device_address) {
+    return flushPending(deviceKey(bus_id, device_address));
+}
+
+bool FlexibleI2C::flushOverlapping(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, size_t length) {
+    uint32_t key = deviceKey(bus_id, device_address);
+    bool overlaps = false;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        auto it = pending_writes.find(key);
+        if (it == pending_writes.end()) {
+            return true;
+        }
+        for (const PendingRun& run : it->second.runs) {
+            if (run.reg_address < reg_address + length && reg_address < run.reg_address + run.data.size()) {
+                overlaps = true;
+                break;
+            }
+        }
+    }
+    // Flush the whole device so earlier writes still reach it first
+    return !overlaps || flushPending(key);
+}
+
+bool FlexibleI2C::flush() {
+    bool success = true;
+    for (uint32_t key : pendingKeys(-1)) {
+        if (!flushPending(key)) {
+            success = false;
+        }
+    }
+    return success;
+}
+
+int FlexibleI2C::addPeriodicRead(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t length,
+                                 uint32_t fastest_interval_ms, uint32_t slowest_interval_ms, uint32_t deadband, bool is_signed) {
+    if (length == 0 || length > 4 || fastest_interval_ms == 0 || slowest_interval_ms < fastest_interval_ms ||
+        !isValidAddress(device_address)) {
+        setError(INVALID_PARAMETERS);
+        return -1;
+    }
+
+    I2CPeriodicRead read;
+    read.bus_id = bus_id;
+    read.device_address = device_address;
+    read.reg_address = reg_address;
+    read.length = length;
+    read.is_signed = is_signed;
+    read.fastest_interval_ms = fastest_interval_ms;
+    read.slowest_interval_ms = slowest_interval_ms;
+    read.deadband = deadband;
+    read.interval_ms = fastest_interval_ms;
+    read.created_at = millis();
+    read.next_due = read.created_at;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        read.id = next_periodic_id++;
+        periodic_reads.push_back(read);
+    }
+
+    setError(SUCCESS);
+    return read.id;
+}
+
+std::vector<I2CPeriodicRead> FlexibleI2C::getPeriodicReads() {
+    I2CBusLock::Guard state_guard(state_lock);
+    return periodic_reads;
+}
+
+bool FlexibleI2C::removePeriodicRead(uint16_t id) {
+    I2CBusLock::Guard state_guard(state_lock);
+    for (auto it = periodic_reads.begin(); it != periodic_reads.end(); ++it) {
+        if (it->id == id) {
+            periodic_reads.erase(it);
+            sample_histories.erase(id);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FlexibleI2C::enableSampleHistory(uint16_t read_id, size_t capacity_bytes, uint32_t resolution_us,
+                                      I2CSampleStore::ValueEncoding encoding) {
+    I2CBusLock::Guard state_guard(state_lock);
+    bool known = false;
+    for (const auto& read : periodic_reads) {
+        known = known || read.id == read_id;
+    }
+    if (!known || capacity_bytes < sizeof(I2CSampleStore::Block) || resolution_us == 0) {
+        setError(INVALID_PARAMETERS);
+        return false;
+    }
+
+    sample_histories.erase(read_id);
+    sample_histories.emplace(read_id, I2CSampleStore(capacity_bytes, resolution_us, encoding));
+    setError(SUCCESS);
+    return true;
+}
+
+void FlexibleI2C::disableSampleHistory(uint16_t read_id) {
+    I2CBusLock::Guard state_guard(state_lock);
+    sample_histories.erase(read_id);
+}
+
+const I2CSampleStore* FlexibleI2C::getSampleHistory(uint16_t read_id) const {
+    auto it = sample_histories.find(read_id);
+    return it != sample_histories.end() ? &it->second : nullptr;
+}
+
+bool FlexibleI2C::beginFlashLog(fs::FS& fs, const I2CFlashLogConfig& config) {
+    if (!flash_log.begin(fs, config)) {
+        setError(INVALID_PARAMETERS);
+        return false;
+    }
+    setError(SUCCESS);
+    return true;
+}
+
+bool FlexibleI2C::setPeriodicReadLogging(uint16_t read_id, bool enabled) {
+    I2CBusLock::Guard state_guard(state_lock);
+    for (auto& read : periodic_reads) {
+        if (read.id == read_id) {
+            read.logged = enabled;
+            return true;
+        }
+    }
+    setError(INVALID_PARAMETERS);
+    return false;
+}
+
+void FlexibleI2C::update() {
+    unsigned long now = millis();
+    // Work done here skips devices reserved by another task's session instead of waiting
+    update_task = xTaskGetCurrentTaskHandle();
+
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (ten_bit_scans[bus_id].active) {
+            advanceTenBitScan(bus_id);
+        }
+    }
+
+    // Signed and against a fresh millis(): the 10-bit scan above, or another task, may have
+    // used the bus after now was read
+    for (auto& bus_pair : buses) {
+        I2CBusConfig& config = bus_pair.second;
+        if (config.initialized && config.idle_timeout_ms && !config.powered_down &&
+            !sessions[bus_pair.first > 1 ? 1 : bus_pair.first].id &&
+            (long)(millis() - config.last_activity) >= (long)config.idle_timeout_ms) {
+            // A foreign Wire user holding the lock counts as activity, also when it is this task
+            I2CBusLock& bus_lock = bus_locks[bus_pair.first > 1 ? 1 : bus_pair.first];
+            bool held_here = bus_lock.isHeldByCurrentTask();
+            I2CBusLock::Guard bus_guard(bus_lock, 0);
+            if (bus_guard && !held_here) {
+                powerDownBus(bus_pair.first);
+            }
+        }
+    }
+
+    std::vector<uint32_t> due_writes;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        for (const auto& entry : pending_writes) {
+            if (!entry.second.runs.empty() && !entry.second.flushing &&
+                (long)(millis() - entry.second.first_write) >= (long)deferred_write_deadline_ms) {
+                due_writes.push_back(entry.first);
+            }
+        }
+    }
+    for (uint32_t key : due_writes) {
+        flushPending(key);
+    }
+
+    // Reads run unlocked and by id, so other tasks and onPeriodicSample() may add or
+    // remove reads meanwhile
+    std::vector<uint16_t> due_reads;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        for (const auto& read : periodic_reads) {
+            if ((long)(now - read.next_due) >= 0) {
+                due_reads.push_back(read.id);
+            }
+        }
+    }
+    for (uint16_t id : due_reads) {
+        runPeriodicRead(id, now);
+    }
+
+    std::vector<uint32_t> due_probes;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        for (const auto& entry : device_stats) {
+            if (entry.second.quarantined && (long)(now - entry.second.next_probe) >= 0) {
+                due_probes.push_back(entry.first);
+            }
+        }
+    }
+    for (uint32_t key : due_probes) {
+        probeQuarantined(key, now);
+    }
+
+    std::vector<uint16_t> due_fifos;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        for (auto& entry : fifos) {
+            I2CFifo& fifo = entry.second;
+            if (!fifo.removed && (long)(now - fifo.next_due) >= 0) {
+                fifo.next_due = now + fifo.poll_ms;
+                due_fifos.push_back(fifo.id);
+            }
+        }
+    }
+    for (uint16_t id : due_fifos) {
+        drainFifo(id);
+        deliverFifoFrames(id);
+    }
+
+#if FLEXIBLE_I2C_COROUTINES
+    // Once a dedicated task runs the executor, update() leaves it alone
+    if (!executor.isRunning()) {
+        executor.poll();
+    }
+#endif
+
+    flash_log.update(now);
+    update_task = nullptr;
+}
+
+int FlexibleI2C::addFifo(const I2CFifoConfig& config, size_t capacity_frames, uint32_t poll_ms) {
+    if (config.bus_id > 1 || !isValidAddress(config.device_address) || config.frame_size == 0 ||
+        config.count_bytes == 0 || config.count_bytes > 2 || capacity_frames == 0 ||
+        capacity_frames * config.frame_size > FIFO_RING_MAX || config.watermark_frames > capacity_frames || poll_ms == 0) {
+        setError(INVALID_PARAMETERS);
+        return -1;
+    }
+
+    I2CBusLock::Guard state_guard(state_lock);
+    uint16_t id = next_fifo_id++;
+    I2CFifo& fifo = fifos.emplace(id, I2CFifo(config.frame_size, capacity_frames)).first->second;
+    fifo.id = id;
+    fifo.config = config;
+    fifo.poll_ms = poll_ms;
+    fifo.next_due = millis();
+
+    setError(SUCCESS);
+    return id;
+}
+
+bool FlexibleI2C::removeFifo(uint16_t id) {
+    I2CBusLock::Guard state_guard(state_lock);
+    auto it = fifos.find(id);
+    if (it == fifos.end() || it->second.removed) {
+        return false;
+    }
+    // A drain or delivery in progress still uses the entry; the last one out erases it
+    if (it->second.draining || it->second.consuming) {
+        it->second.removed = true;
+    } else {
+        fifos.erase(it);
+    }
+    return true;
+}
+
+I2CFifo* FlexibleI2C::getFifo(uint16_t id) {
+    I2CBusLock::Guard state_guard(state_lock);
+    auto it = fifos.find(id);
+    return it != fifos.end() && !it->second.removed ? &it->second : nullptr;
+}
+
+void FlexibleI2C::releaseFifo(I2CFifo& fifo) {
+    // Caller holds state_lock
+    if (fifo.removed && !fifo.draining && !fifo.consuming) {
+        fifos.erase(fifo.id);
+    }
+}
+
+int FlexibleI2C::drainFifo(uint16_t id, bool force) {
+    I2CFifo* fifo;
+    I2CFifoConfig config;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        auto it = fifos.find(id);
+        if (it == fifos.end() || it->second.removed) {
+            setError(INVALID_PARAMETERS);
+            return -1;
+        }
+        fifo = &it->second;
+        if (fifo->draining) {
+            // Another task is already pulling the data
+            setError(SUCCESS);
+            return 0;
+        }
+        fifo->draining = true;
+        config = fifo->config;
+    }
+
+    // The bus I/O runs unlocked; only this drain writes the ring's free space, and the ring's
+    // indices only move under state_lock
+    int result = runFifoDrain(*fifo, config, force);
+
+    I2CBusLock::Guard state_guard(state_lock);
+    fifo->draining = false;
+    releaseFifo(*fifo);
+    return result;
+}
+
+int FlexibleI2C::runFifoDrain(I2CFifo& fifo, const I2CFifoConfig& config, bool force) {
+    uint64_t request_us = timestampUs();
+    uint8_t raw[2] = { 0, 0 };
+    if (!readBytes(config.bus_id, config.device_address, config.count_reg, raw, config.count_bytes)) {
+        // A session elsewhere only postpones the drain
+        if (last_error != SESSION_BUSY) {
+            I2CBusLock::Guard state_guard(state_lock);
+            fifo.errors++;
+        }
+        return -1;
+    }
+    uint32_t level = raw[0];
+    if (config.count_bytes == 2) {
+        level = config.count_little_endian ? (raw[1] << 8) | raw[0] : (raw[0] << 8) | raw[1];
+    }
+    level &= config.count_mask;
+    if (config.count_in_frames) {
+        level *= config.frame_size;
+    }
+
+    // Whole frames only: a frame the sensor is still writing stays in the device, while one
+    // split by a failed burst is completed from the bytes already in the ring
+    size_t partial, wanted;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        fifo.last_level = level;
+        if (level > fifo.max_level) {
+            fifo.max_level = level;
+        }
+        partial = fifo.ring.partialBytes();
+        wanted = (level + partial) / config.frame_size;
+        if (!force && wanted < config.watermark_frames) {
+            setError(SUCCESS);
+            return 0;
+        }
+        size_t room = (fifo.ring.freeBytes() + partial) / config.frame_size;
+        if (wanted > room) {
+            wanted = room;
+            fifo.ring_full++;
+        }
+    }
+    if (wanted * config.frame_size <= partial) {
+        setError(SUCCESS);
+        return 0;
+    }
+
+    // Maximal bursts, cut at frame boundaries whenever a frame fits the Wire buffer
+    size_t burst_max = FIFO_BURST_MAX;
+    if (config.frame_size <= FIFO_BURST_MAX) {
+        burst_max -= FIFO_BURST_MAX % config.frame_size;
+    }
+
+    size_t remaining = wanted * config.frame_size - partial;
+    while (remaining) {
+        size_t span;
+        uint8_t* destination;
+        {
+            I2CBusLock::Guard state_guard(state_lock);
+            destination = fifo.ring.writeSpan(span);
+        }
+        size_t burst = remaining < burst_max ? remaining : burst_max;
+        if (burst > span) {
+            burst = span;
+        }
+        // Read straight into the ring
+        if (!readBytes(config.bus_id, config.device_address, config.data_reg, destination, burst)) {
+            if (last_error != SESSION_BUSY) {
+                I2CBusLock::Guard state_guard(state_lock);
+                fifo.errors++;
+            }
+            break;
+        }
+        I2CBusLock::Guard state_guard(state_lock);
+        fifo.ring.commit(burst);
+        fifo.bursts++;
+        fifo.bytes += burst;
+        remaining -= burst;
+    }
+
+    // Counted from the bytes committed, as consumers may have released frames meanwhile
+    size_t added = (wanted * config.frame_size - remaining) / config.frame_size;
+    I2CBusLock::Guard state_guard(state_lock);
+    fifo.frames += added;
+    if (added) {
+        fifo.drains++;
+        fifo.drain_request_us = request_us;
+        fifo.drain_complete_us = timestampUs();
+    }
+    return remaining ? -1 : (int)added;
+}
+
+void FlexibleI2C::deliverFifoFrames(uint16_t id) {
+    I2CBusLock::Guard state_guard(state_lock);
+    auto it = fifos.find(id);
+    if (it == fifos.end() || it->second.removed || it->second.consuming) {
+        return;
+    }
+    I2CFifo& fifo = it->second;
+    fifo.consuming = true;
+
+    // onFifoFrames() runs unlocked; the frames it sees stay put because no other consumer
+    // gets in while consuming is set
+    size_t count;
+    const uint8_t* frames;
+    while ((frames = fifo.ring.peek(count)) != nullptr) {
+        state_lock.unlock();
+        size_t used = onFifoFrames(fifo, frames, count);
+        state_lock.lock();
+        if (used > count) {
+            used = count;
+        }
+        fifo.ring.consume(used);
+        if (used < count || fifo.removed) {
+            break;
+        }
+    }
+
+    fifo.consuming = false;
+    releaseFifo(fifo);
+}
+
+#if FLEXIBLE_I2C_COROUTINES
+I2CAwaitable<bool> FlexibleI2C::writeRegisterAsync(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t data) {
+    return I2CAwaitable<bool>(executor, bus_id, [this, bus_id, device_address, reg_address, data]() { return writeRegister(bus_id, device_address, reg_address, data); });
+}
+
+I2CAwaitable<bool> FlexibleI2C::writeRegister16Async(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint16_t data) {
+    return I2CAwaitable<bool>(executor, bus_id, [this, bus_id, device_address, reg_address, data]() { return writeRegister16(bus_id, device_address, reg_address, data); });
+}
+
+I2CAwaitable<bool> FlexibleI2C::writeBytesAsync(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, const uint8_t* data, size_t length) {
+    return I2CAwaitable<bool>(executor, bus_id, [this, bus_id, device_address, reg_address, data, length]() { return writeBytes(bus_id, device_address, reg_address, data, length); });
+}
+
+I2CAwaitable<uint8_t> FlexibleI2C::readRegisterAsync(uint8_t bus_id, uint16_t device_address, uint8_t reg_address) {
+    return I2CAwaitable<uint8_t>(executor, bus_id, [this, bus_id, device_address, reg_address]() { return readRegister(bus_id, device_address, reg_address); });
+}
+
+I2CAwaitable<uint16_t> FlexibleI2C::readRegister16Async(uint8_t bus_id, uint16_t device_address, uint8_t reg_address) {
+    return I2CAwaitable<uint16_t>(executor, bus_id, [this, bus_id, device_address, reg_address]() { return readRegister16(bus_id, device_address, reg_address); });
+}
+
+I2CAwaitable<bool> FlexibleI2C::readBytesAsync(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t* data, size_t length) {
+    return I2CAwaitable<bool>(executor, bus_id, [this, bus_id, device_address, reg_address, data, length]() { return readBytes(bus_id, device_address, reg_address, data, length); });
+}
+#endif
+
+void FlexibleI2C::runPeriodicRead(uint16_t id, unsigned long now) {
+    I2CPeriodicRead target;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        auto it = periodic_reads.begin();
+        while (it != periodic_reads.end() && it->id != id) {
+            ++it;
+        }
+        if (it == periodic_reads.end()) {
+            return;
+        }
+        target = *it;
+    }
+
+    uint8_t buffer[4];
+    uint64_t request_us = timestampUs();
+    bool success = readBytes(target.bus_id, target.device_address, target.reg_address, buffer, target.length);
+    bool session_busy = !success && last_error == SESSION_BUSY;
+    uint64_t complete_us = timestampUs();
+
+    I2CPeriodicRead sample;
+    int32_t value = 0;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        auto it = periodic_reads.begin();
+        while (it != periodic_reads.end() && it->id != id) {
+            ++it;
+        }
+        if (it == periodic_reads.end()) {
+            // Removed while the read was on the bus
+            return;
+        }
+        I2CPeriodicRead& read = *it;
+        if (session_busy) {
+            // Nothing went out; try again at the fastest rate without counting an error
+            read.next_due = now + read.fastest_interval_ms;
+            return;
+        }
+        uint64_t previous_request_us = read.request_us;
+        read.request_us = request_us;
+        read.complete_us = complete_us;
+
+        // interval_ms is still the interval this attempt was scheduled with
+        if (previous_request_us) {
+            int64_t deviation = (int64_t)(read.request_us - previous_request_us) - (int64_t)read.interval_ms * 1000;
+            uint32_t jitter_us = deviation < 0 ? -deviation : deviation;
+            read.jitter_sum_us += jitter_us;
+            read.jitter_count++;
+            if (jitter_us > read.jitter_max_us) {
+                read.jitter_max_us = jitter_us;
+            }
+        }
+
+        if (!success) {
+            read.errors++;
+            read.interval_ms = read.fastest_interval_ms;
+            read.next_due = now + read.interval_ms;
+            return;
+        }
+
+        uint32_t raw = 0;
+        for (uint8_t i = 0; i < read.length; i++) {
+            raw = (raw << 8) | buffer[i];
+        }
+        value = raw;
+        if (read.is_signed && read.length < 4 && (raw & (1UL << (read.length * 8 - 1)))) {
+            value = (int32_t)(raw | (0xFFFFFFFFUL << (read.length * 8)));
+        }
+
+        read.samples++;
+        uint32_t latency_us = read.complete_us - read.request_us;
+        read.latency_sum_us += latency_us;
+        if (latency_us > read.latency_max_us) {
+            read.latency_max_us = latency_us;
+        }
+
+        int64_t delta = (int64_t)value - read.reference_value;
+        if (!read.has_value || delta > (int64_t)read.deadband || -delta > (int64_t)read.deadband) {
+            // Activity: snap back to the fastest rate
+            read.changes++;
+            read.reference_value = value;
+            read.interval_ms = read.fastest_interval_ms;
+        } else if (read.interval_ms < read.slowest_interval_ms) {
+            // Stable: back off geometrically toward the slowest rate
+            uint32_t next_interval = read.interval_ms + read.interval_ms / 2 + 1;
+            read.interval_ms = next_interval > read.slowest_interval_ms ? read.slowest_interval_ms : next_interval;
+        }
+
+        read.last_value = value;
+        read.has_value = true;
+        read.next_due = now + read.interval_ms;
+
+        auto history = sample_histories.find(read.id);
+        if (history != sample_histories.end()) {
+            history->second.append(read.request_us, value);
+        }
+        if (read.logged && flash_log.isOpen()) {
+            I2CLogRecord record = { read.request_us, value, read.device_address, read.bus_id, read.reg_address };
+            flash_log.append(record);
+        }
+        sample = read;
+    }
+    onPeriodicSample(sample, value);
+}
+
+uint64_t FlexibleI2C::timestampUs() {
+#if defined(ESP_PLATFORM)
+    return esp_timer_get_time();
+#else
+    // Widen the 32-bit micros() counter; needs a call at least once per ~71 minutes
+    static uint32_t last_us = 0;
+    static uint64_t high = 0;
+    uint32_t now_us = micros();
+    if (now_us < last_us) {
+        high += 1ULL << 32;
+    }
+    last_us = now_us;
+    return high | now_us;
+#endif
+}
+
+void FlexibleI2C::setTraceDepth(size_t depth) {
+    I2CBusLock::Guard state_guard(state_lock);
+    trace.assign(depth, I2CTraceEntry());
+    trace_next = 0;
+    trace_count = 0;
+}
+
+std::vector<I2CTraceEntry> FlexibleI2C::getTrace() {
+    I2CBusLock::Guard state_guard(state_lock);
+    std::vector<I2CTraceEntry> entries;
+    entries.reserve(trace_count);
+    size_t first = (trace_next + trace.size() - trace_count) % (trace.empty() ? 1 : trace.size());
+    for (size_t i = 0; i < trace_count; i++) {
+        entries.push_back(trace[(first + i) % trace.size()]);
+    }
+    return entries;
+}
+
+I2CBusStats FlexibleI2C::getBusStats(uint8_t bus_id) {
+    I2CBusLock::Guard state_guard(state_lock);
+    I2CBusStats& stats = bus_stats[bus_id > 1 ? 1 : bus_id];
+    advanceStatsWindow(stats);
+    return stats;
+}
+
+void FlexibleI2C::resetBusStats(uint8_t bus_id) {
+    if (bus_id <= 1) {
+        I2CBusLock::Guard state_guard(state_lock);
+        bus_stats[bus_id].reset();
+    }
+}
+
+std::map<uint32_t, I2CDeviceStats> FlexibleI2C::getDeviceStats() {
+    I2CBusLock::Guard state_guard(state_lock);
+    return device_stats;
+}
+
+float FlexibleI2C::getBusUtilization(uint8_t bus_id, uint8_t window_seconds) {
+    if (bus_id > 1 || window_seconds == 0) {
+        return 0.0f;
+    }
+    if (window_seconds >= I2CBusStats::WINDOW_SLOTS) {
+        window_seconds = I2CBusStats::WINDOW_SLOTS - 1;
+    }
+
+    const I2CBusStats& stats = getBusStats(bus_id);
+    uint64_t busy = 0;
+    // Slot for the current (partial) second is skipped
+    for (uint8_t i = 1; i <= window_seconds; i++) {
+        busy += stats.window_busy_us[(stats.window_second + I2CBusStats::WINDOW_SLOTS - i) % I2CBusStats::WINDOW_SLOTS];
+    }
+    return (float)busy / (window_seconds * 1000000.0f);
+}
+
+uint32_t FlexibleI2C::getBusBytesPerSecond(uint8_t bus_id, uint8_t window_seconds) {
+    if (bus_id > 1 || window_seconds == 0) {
+        return 0;
+    }
+    if (window_seconds >= I2CBusStats::WINDOW_SLOTS) {
+        window_seconds = I2CBusStats::WINDOW_SLOTS - 1;
+    }
+
+    const I2CBusStats& stats = getBusStats(bus_id);
+    uint64_t bytes = 0;
+    for (uint8_t i = 1; i <= window_seconds; i++) {
+        bytes += stats.window_bytes[(stats.window_second + I2CBusStats::WINDOW_SLOTS - i) % I2CBusStats::WINDOW_SLOTS];
+    }
+    return bytes / window_seconds;
+}
+
+void FlexibleI2C::advanceStatsWindow(I2CBusStats& stats) {
+    uint32_t now_second = millis() / 1000;
+    if (now_second == stats.window_second) {
+        return;
+    }
+
+    uint32_t elapsed = now_second - stats.window_second;
+    if (elapsed > I2CBusStats::WINDOW_SLOTS) {
+        elapsed = I2CBusStats::WINDOW_SLOTS;
+    }
+    for (uint32_t i = 1; i <= elapsed; i++) {
+        uint8_t slot = (stats.window_second + i) % I2CBusStats::WINDOW_SLOTS;
+        stats.window_busy_us[slot] = 0;
+        stats.window_bytes[slot] = 0;
+    }
+    stats.window_second = now_second;
+}
+
+uint32_t FlexibleI2C::estimateWireTimeUs(uint8_t bus_id, size_t wire_bytes, uint8_t starts) {
+    auto it = buses.find(bus_id);
+    I2CTimingModel model(it != buses.end() ? it->second.frequency : 0);
+    return model.transactionNs(wire_bytes, starts) / 1000;
+}
+
+I2CTimingEstimate FlexibleI2C::estimateTiming(uint8_t bus_id, const I2COperation& operation, uint32_t frequency) {
+    return estimateTiming(bus_id, std::vector<I2COperation>(1, operation), frequency);
+}
+
+I2CTimingEstimate FlexibleI2C::estimateTiming(uint8_t bus_id, const std::vector<I2COperation>& batch, uint32_t frequency) {
+    if (!frequency) {
+        auto it = buses.find(bus_id);
+        frequency = it != buses.end() ? it->second.frequency : 0;
+    }
+    I2CTimingModel model(frequency);
+    return model.estimate(batch.data(), batch.size());
+}
+
+void FlexibleI2C::recordTransaction(uint8_t bus_id, uint16_t address, uint32_t start_us, size_t wire_bytes, uint8_t starts, I2CError result) {
+    if (bus_id > 1) {
+        return;
+    }
+
+    if (isTenBitAddress(address)) {
+        wire_bytes++;
+    }
+    uint32_t elapsed_us = recordBusTransaction(bus_id, address, start_us, wire_bytes, starts, result);
+
+    // Both buses record here, and /metrics walks the map from the web server task
+    I2CBusLock::Guard state_guard(state_lock);
+    uint32_t key = deviceKey(bus_id, address);
+    auto found = device_stats.find(key);
+    if (found == device_stats.end()) {
+        // An address that NACKs a scan or presence probe is not a device; the bus
+        // counters already hold the attempt
+        if (presence_probe[bus_id] && result != SUCCESS) {
+            return;
+        }
+        found = device_stats.emplace(key, I2CDeviceStats()).first;
+    }
+    I2CDeviceStats& device = found->second;
+    device.transactions++;
+    device.bytes += wire_bytes;
+    device.errors[result < I2CDeviceStats::ERROR_CODES ? result : OTHER_ERROR]++;
+    device.addLatency(elapsed_us);
+    updateDeviceHealth(bus_id, address, device, result);
+}
+
+uint32_t FlexibleI2C::recordBusTransaction(uint8_t bus_id, uint16_t address, uint32_t start_us, size_t wire_bytes, uint8_t starts, I2CError result) {
+    uint32_t elapsed_us = micros() - start_us;
+    I2CBusLock::Guard state_guard(state_lock);
+    I2CBusStats& stats = bus_stats[bus_id];
+    advanceStatsWindow(stats);
+
+    stats.transactions++;
+    if (result != SUCCESS) {
+        stats.errors++;
+    }
+    stats.bytes += wire_bytes;
+    stats.busy_us += elapsed_us;
+    stats.wire_us += estimateWireTimeUs(bus_id, wire_bytes, starts);
+
+    uint8_t slot = stats.window_second % I2CBusStats::WINDOW_SLOTS;
+    stats.window_busy_us[slot] += elapsed_us;
+    stats.window_bytes[slot] += wire_bytes;
+
+    if (!trace.empty()) {
+        I2CTraceEntry& entry = trace[trace_next];
+        entry.complete_us = timestampUs();
+        entry.request_us = entry.complete_us - elapsed_us;
+        entry.device_address = address;
+        entry.bus_id = bus_id;
+        entry.result = result;
+        entry.bytes = wire_bytes > 0xFFFF ? 0xFFFF : wire_bytes;
+        trace_next = (trace_next + 1) % trace.size();
+        if (trace_count < trace.size()) {
+            trace_count++;
+        }
+    }
+    return elapsed_us;
+}
+
+void FlexibleI2C::updateDeviceHealth(uint8_t bus_id, uint16_t address, I2CDeviceStats& device, I2CError result) {
+    // Caller holds state_lock, which also covers the registry insert below
+    if (presence_probe[bus_id]) {
+        // Absent addresses NACK every scan; only an answer counts
+        if (result == SUCCESS && device.quarantined) {
+            reinstateDevice(bus_id, address);
+        }
+        return;
+    }
+
+    device.health += ((result == SUCCESS ? 1.0f : 0.0f) - device.health) / 8;
+    if (device.quarantined || quarantine_threshold <= 0 || device.health >= quarantine_threshold) {
+        return;
+    }
+
+    device.quarantined = true;
+    device.quarantines++;
+    device.quarantined_at = millis();
+    device.next_probe = device.quarantined_at + quarantine_probe_ms;
+
+    // Shown in /getI2CDevices as unresponsive, added there if it was never scanned
+    I2CDeviceInfo* info = findDevice(bus_id, address);
+    if (info) {
+        info->responsive = false;
+        markRegistryChanged();
+        device_index_version = registry_version; // positions are unchanged
+    } else {
+        known_devices.push_back(I2CDeviceInfo(address, bus_id, "Unknown Device"));
+        device_index[deviceKey(bus_id, address)] = known_devices.size() - 1;
+        markRegistryChanged();
+        device_index_version = registry_version;
+    }
+}
+
+bool FlexibleI2C::rejectQuarantined(uint8_t bus_id, uint16_t address) {
+    I2CBusLock::Guard state_guard(state_lock);
+    auto it = device_stats.find(deviceKey(bus_id, address));
+    if (it == device_stats.end() || !it->second.quarantined) {
+        return false;
+    }
+    it->second.fast_failures++;
+    setError(QUARANTINED);
+    return true;
+}
+
+void FlexibleI2C::probeQuarantined(uint32_t key, unsigned long now) {
+    uint8_t bus_id = key >> 16;
+    uint16_t address = key & 0xFFFF;
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        auto it = device_stats.find(key);
+        if (it == device_stats.end() || !it->second.quarantined) {
+            return;
+        }
+        it->second.next_probe = now + quarantine_probe_ms;
+    }
+
+    // Like the 10-bit scan, never block update(); try again at the next probe
+    if (bus_id > 1 || sessions[bus_id].id) {
+        return;
+    }
+    I2CBusLock::Guard bus_guard(bus_locks[bus_id], 0);
+    TwoWire* wire = bus_guard ? getBus(bus_id) : nullptr;
+    if (!wire) {
+        return;
+    }
+
+    // Address-only write: the cheapest frame a target has to answer
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        auto it = device_stats.find(key);
+        if (it != device_stats.end()) {
+            it->second.probes++;
+        }
+    }
+    uint32_t start_us = micros();
+    beginFrame(wire, address);
+    uint8_t error = wire->endTransmission();
+    presence_probe[bus_id] = true;
+    recordTransaction(bus_id, address, start_us, 1, 1, wireError(error));
+    presence_probe[bus_id] = false;
+}
+
+void FlexibleI2C::setQuarantinePolicy(float threshold, uint32_t probe_interval_ms) {
+    quarantine_threshold = threshold;
+    quarantine_probe_ms = probe_interval_ms ? probe_interval_ms : 1;
+    if (threshold <= 0) {
+        I2CBusLock::Guard state_guard(state_lock);
+        for (auto& entry : device_stats) {
+            if (entry.second.quarantined) {
+                reinstateDevice(entry.first >> 16, entry.first & 0xFFFF);
+            }
+        }
+    }
+}
+
+float FlexibleI2C::getDeviceHealth(uint8_t bus_id, uint16_t address) {
+    I2CBusLock::Guard state_guard(state_lock);
+    auto it = device_stats.find(deviceKey(bus_id, address));
+    return it != device_stats.end() ? it->second.health : 1.0f;
+}
+
+bool FlexibleI2C::isDeviceQuarantined(uint8_t bus_id, uint16_t address) {
+    I2CBusLock::Guard state_guard(state_lock);
+    auto it = device_stats.find(deviceKey(bus_id, address));
+    return it != device_stats.end() && it->second.quarantined;
+}
+
+void FlexibleI2C::reinstateDevice(uint8_t bus_id, uint16_t address) {
+    I2CBusLock::Guard state_guard(state_lock);
+    auto it = device_stats.find(deviceKey(bus_id, address));
+    if (it == device_stats.end() || !it->second.quarantined) {
+        return;
+    }
+    I2CDeviceStats& device = it->second;
+    device.quarantined = false;
+    // Back on probation: a few more errors quarantine it again
+    device.health = (quarantine_threshold + 1.0f) / 2;
+    registerDevice(bus_id, address);
+}
+
+bool FlexibleI2C::recoverBus(uint8_t bus_id) {
+    auto it = buses.find(bus_id);
+    if (it == buses.end() || !it->second.initialized) {
+        setError(BUS_NOT_INITIALIZED);
+        return false;
+    }
+
+    I2CBusLock::Guard bus_guard(bus_locks[bus_id > 1 ? 1 : bus_id]);
+    uint32_t start_us = micros();
+    I2CBusConfig& config = it->second;
+    config.wire_instance->end();
+
+    pinMode(config.sda_pin, INPUT_PULLUP);
+    pinMode(config.scl_pin, OUTPUT_OPEN_DRAIN);
+    digitalWrite(config.scl_pin, HIGH);
+
+    // Up to nine clocks lets any target finish the byte it is shifting out
+    for (uint8_t i = 0; i < 9 && digitalRead(config.sda_pin) == LOW; i++) {
+        digitalWrite(config.scl_pin, LOW);
+        delayMicroseconds(5);
+        digitalWrite(config.scl_pin, HIGH);
+        delayMicroseconds(5);
+    }
+
+    // STOP condition: SDA rising while SCL is high
+    pinMode(config.sda_pin, OUTPUT_OPEN_DRAIN);
+    digitalWrite(config.sda_pin, LOW);
+    delayMicroseconds(5);
+    digitalWrite(config.scl_pin, HIGH);
+    delayMicroseconds(5);
+    digitalWrite(config.sda_pin, HIGH);
+    delayMicroseconds(5);
+
+    bool success = config.wire_instance->begin(config.sda_pin, config.scl_pin, config.frequency);
+    config.initialized = success;
+    config.powered_down = false;
+    config.last_activity = millis();
+    if (!success) {
+        bus_config_version++;
+    }
+
+    I2CBusLock::Guard state_guard(state_lock);
+    I2CBusStats& stats = bus_stats[bus_id > 1 ? 1 : bus_id];
+    stats.recoveries++;
+    stats.recovery_us += micros() - start_us;
+
+    setError(success ? SUCCESS : OTHER_ERROR);
+    return success;
+}
+
+FlexibleI2C::I2CError FlexibleI2C::wireError(uint8_t code) {
+    switch (code) {
+        case 0: return SUCCESS;
+        case 1: return INVALID_PARAMETERS;    // data too long for the Wire buffer
+        case 2: return NACK_ADDRESS;
+        case 3: return NACK_DATA;
+        case 5: return TIMEOUT;
+        default: return OTHER_ERROR;
+    }
+}
+
+String FlexibleI2C::getErrorString(I2CError error) {
+    switch (error) {
+        case SUCCESS: return "Success";
+        case TIMEOUT: return "Timeout";
+        case NACK_ADDRESS: return "NACK on address";
+        case NACK_DATA: return "NACK on data";
+        case OTHER_ERROR: return "Other error";
+        case BUS_NOT_INITIALIZED: return "Bus not initialized";
+        case INVALID_PARAMETERS: return "Invalid parameters";
+        case PEC_ERROR: return "CRC/PEC mismatch";
+        case QUARANTINED: return "Device quarantined";
+        case SESSION_BUSY: return "Device reserved by another session";
+        default: return "Unknown error";
+    }
+}
+
+bool FlexibleI2C::validateBusAndAddress(uint8_t bus_id, uint16_t address) {
+    if (!isBusInitialized(bus_id)) {
+        setError(BUS_NOT_INITIALIZED);
+        return false;
+    }
+
+    if (!isValidAddress(address)) {
+        setError(INVALID_PARAMETERS);
+        return false;
+    }
+
+    return true;
+}
+
+bool FlexibleI2C::isValidAddress(uint16_t address) {
+    if (isTenBitAddress(address)) {
+        return (address & ~ADDR_10BIT) <= 0x3FF;
+    }
+    return address != 0 && address <= 127;
+}
+
+void FlexibleI2C::beginFrame(TwoWire* wire, uint16_t address) {
+    if (isTenBitAddress(address)) {
+        wire->beginTransmission(tenBitHeader(address));
+        wire->write((uint8_t)(address & 0xFF));
+    } else {
+        wire->beginTransmission((uint8_t)address);
+    }
+}
+
+uint8_t FlexibleI2C::requestFrame(TwoWire* wire, uint16_t address, uint8_t quantity, bool addressed, bool stop) {
+    if (!isTenBitAddress(address)) {
+        return wire->requestFrom((uint8_t)address, quantity, (uint8_t)stop);
+    }
+
+    // After a repeated START the target addressed by the preceding write phase answers the
+    // header byte alone; without one, send the full address first.
+    if (!addressed) {
+        beginFrame(wire, address);
+        if (wire->endTransmission(false) != 0) {
+            return 0;
+        }
+    }
+    return wire->requestFrom(tenBitHeader(address), quantity, (uint8_t)stop);
+}
+
+void FlexibleI2C::registerBuiltinEndpoints(FlexibleEndpoints& endpoints) {
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/initI2C")
+        .summary("Initialize I2C bus")
+        .description("Initialize an I2C bus with specified pins and frequency")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID (0 or 1)"),
+            REQUIRED_INT_PARAM("sda_pin", "SDA pin number"),
+            REQUIRED_INT_PARAM("scl_pin", "SCL pin number"),
+            INT_PARAM("frequency", "Bus frequency in Hz (default 100000)"),
+            INT_PARAM("idle_ms", "Power the bus down after this many idle milliseconds (default 0, never)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleInitBus);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/scanI2C")
+        .summary("Scan I2C bus for devices")
+        .description("Scan the specified I2C bus for responsive devices")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID to scan"),
+            INT_PARAM("ten_bit", "1 to start a background scan of the 10-bit space; results appear in /getI2CDevices"),
+            INT_PARAM("probes", "10-bit addresses probed per update() call (default 8)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleScanBus);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/getI2CDevices")
+        .summary("Get all known devices")
+        .description("Get known I2C devices, filtered and paginated with an opaque cursor")
+        .params({
+            INT_PARAM("bus_id", "Only devices on this bus"),
+            INT_PARAM("responsive", "Only responsive (1) or unresponsive (0) devices"),
+            INT_PARAM("quarantined", "Only quarantined (1) or active (0) devices"),
+            STR_PARAM("name", "Only devices whose name contains this text"),
+            INT_PARAM("max_age_ms", "Only devices seen within this many milliseconds"),
+            INT_PARAM("cursor", "next_cursor from the previous page"),
+            INT_PARAM("limit", "Devices per page (default 64, max 256)"),
+            INT_PARAM("since_version", "Return 304 with no body if the registry version is unchanged"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleDeviceInfo);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/getI2CBuses")
+        .summary("Get bus configuration")
+        .description("Pins, frequency and state of each bus")
+        .params({
+            INT_PARAM("since_version", "Return 304 with no body if the configuration version is unchanged"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleBusConfig);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/readI2C")
+        .summary("Read register from device")
+        .description("Read a register value from an I2C device")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format, e.g., '0x48')"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("reg_addr", "Register address (hex format)"),
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleReadRegister);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/writeI2C")
+        .summary("Write register to device")
+        .description("Write a value to a register on an I2C device")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("reg_addr", "Register address (hex format)"),
+            REQUIRED_STR_PARAM("value", "Value to write (hex format)"),
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleWriteRegister);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/pingI2C")
+        .summary("Ping I2C device")
+        .description("Check if an I2C device is responding")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handlePingDevice);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/readI2CBytes")
+        .summary("Read multiple bytes from device")
+        .description("Read multiple bytes from a register on an I2C device")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("reg_addr", "Register address (hex format)"),
+            REQUIRED_INT_PARAM("length", "Number of bytes to read"),
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleReadBytes);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/writeI2CBytes")
+        .summary("Write multiple bytes to device")
+        .description("Write multiple bytes to a register on an I2C device")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("reg_addr", "Register address (hex format)"),
+            REQUIRED_STR_PARAM("data", "Comma-separated hex values (e.g., '0x01,0x02,0x03')"),
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleWriteBytes);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/readSMBusWord")
+        .summary("SMBus read word")
+        .description("Read a little-endian 16-bit word using an SMBus command code")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("command", "SMBus command code (hex format)"),
+            INT_PARAM("pec", "Verify packet error code (0 or 1, default 0)"),
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleSMBusReadWord);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/writeSMBusWord")
+        .summary("SMBus write word")
+        .description("Write a little-endian 16-bit word using an SMBus command code")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("command", "SMBus command code (hex format)"),
+            REQUIRED_STR_PARAM("value", "Word to write (hex format)"),
+            INT_PARAM("pec", "Append packet error code (0 or 1, default 0)"),
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleSMBusWriteWord);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/readSMBusBlock")
+        .summary("SMBus block read")
+        .description("Read a length-prefixed block of up to 32 bytes")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("command", "SMBus command code (hex format)"),
+            INT_PARAM("max_length", "Largest block to accept (default 32)"),
+            INT_PARAM("pec", "Verify packet error code (0 or 1, default 0)"),
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleSMBusBlockRead);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/writeSMBusBlock")
+        .summary("SMBus block write")
+        .description("Write a length-prefixed block of up to 32 bytes")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("command", "SMBus command code (hex format)"),
+            REQUIRED_STR_PARAM("data", "Comma-separated hex values (e.g., '0x01,0x02,0x03')"),
+            INT_PARAM("pec", "Append packet error code (0 or 1, default 0)"),
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleSMBusBlockWrite);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/SMBusProcessCall")
+        .summary("SMBus process call")
+        .description("Write a word and read back a word in one combined transaction")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("command", "SMBus command code (hex format)"),
+            REQUIRED_STR_PARAM("value", "Word to send (hex format)"),
+            INT_PARAM("pec", "Use packet error code (0 or 1, default 0)"),
+            FLEXIBLE_I2C_SESSION_PARAM,
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleSMBusProcessCall);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/getI2CBusStats")
+        .summary("Get bus utilization")
+        .description("Busy time, utilization windows, throughput and estimated wire time versus measured time per bus")
+        .params({
+            INT_PARAM("bus_id", "Bus ID (omit for all buses)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleBusStats);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/estimateI2CTiming")
+        .summary("Estimate bus time")
+        .description("Predict wire time per operation and for a batch from the bus timing model, e.g. ops=readRegister*10,readBytes:14@50,scan")
+        .params({
+            INT_PARAM("bus_id", "Bus ID (default 0; its frequency unless overridden)"),
+            INT_PARAM("frequency", "Bus frequency in Hz"),
+            REQUIRED_STR_PARAM("ops", "Comma-separated name[:length][*count][@stretch_us]; names: readRegister, readRegister16, readBytes, writeRegister, writeBytes, ping, scan, scan10"),
+            INT_PARAM("ten_bit", "Address targets with 10 bits (0 or 1, default 0)"),
+            INT_PARAM("rate_hz", "Batch repetition rate, to report the bus share it takes"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleEstimateTiming);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/getI2CTrace")
+        .summary("Get transaction trace")
+        .description("Recent transactions with microsecond request and completion timestamps")
+        .params({
+            INT_PARAM("limit", "Most recent entries to return (default all)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleGetTrace);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/setI2CTrace")
+        .summary("Configure transaction trace")
+        .description("Set how many recent transactions are kept (0 disables tracing) and clear the trace")
+        .params({
+            REQUIRED_INT_PARAM("depth", "Entries to keep (0-1024)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleSetTrace);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/metrics")
+        .summary("Prometheus metrics")
+        .description("Transaction, error, byte and latency metrics per bus and device in Prometheus text format")
+        .responseType(TEXT_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return handleMetrics(params);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/recoverI2CBus")
+        .summary("Recover stuck bus")
+        .description("Clock out a target holding SDA low and re-initialize the bus")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleRecoverBus);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/beginI2CSession")
+        .summary("Open exclusive session")
+        .description("Reserve a device or the whole bus for a multi-step sequence; other requests get 409 until it ends or the lease expires. One session per bus.")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            STR_PARAM("device_addr", "Device address (hex format); omit to reserve the whole bus"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_INT_PARAM("lease_ms", "Lease after which the session is closed automatically"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleBeginSession);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/endI2CSession")
+        .summary("Close exclusive session")
+        .description("Release a session opened with /beginI2CSession")
+        .params({
+            REQUIRED_INT_PARAM("session_id", "Session ID"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleEndSession);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/addI2CPeriodicRead")
+        .summary("Add adaptive periodic read")
+        .description("Poll a register at a rate that backs off while the value is stable and snaps back on change")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("reg_addr", "Register address (hex format)"),
+            INT_PARAM("length", "Value width in bytes, 1-4 (default 1)"),
+            REQUIRED_INT_PARAM("fastest_ms", "Interval while the value is changing"),
+            REQUIRED_INT_PARAM("slowest_ms", "Interval approached while the value is stable"),
+            INT_PARAM("deadband", "Change below which the value counts as stable (default 0)"),
+            INT_PARAM("signed", "Treat the value as signed (0 or 1, default 0)"),
+            INT_PARAM("history_bytes", "Keep a compressed sample history in this much memory (default 0, off)"),
+            INT_PARAM("history_resolution_us", "History timestamp resolution (default 1000)"),
+            INT_PARAM("history_xor", "XOR-encode history values, for bit fields (0 or 1, default 0)"),
+            INT_PARAM("log", "Append samples to the flash log (0 or 1, default 0)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleAddPeriodicRead);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/getI2CSamples")
+        .summary("Query sample history")
+        .description("Decode a periodic read's compressed history in a time range as [timestamp_us, value] pairs")
+        .params({
+            REQUIRED_INT_PARAM("id", "Periodic read ID"),
+            STR_PARAM("from_us", "Range start, microseconds since boot (default oldest)"),
+            STR_PARAM("to_us", "Range end, microseconds since boot (default newest)"),
+            INT_PARAM("limit", "Samples to return (default 256, max 1024); continue from next_from_us"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleGetSamples);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/getI2CLog")
+        .summary("Get flash log status")
+        .description("List the flash log files with write statistics")
+        .params({
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleGetLog);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/readI2CLog")
+        .summary("Read flash log")
+        .description("Export the flash log a few pages per request, oldest first; continue from next_file/next_page")
+        .params({
+            INT_PARAM("file", "File index to start at (default oldest)"),
+            INT_PARAM("page", "Page within the file (default 0)"),
+            INT_PARAM("pages", "Pages to return (default 1, max 4)"),
+            INT_PARAM("raw", "Return one page's bytes instead of decoded records: a hex string, or bin with format=msgpack (0 or 1, default 0)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleReadLog);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/flushI2CLog")
+        .summary("Flush flash log")
+        .description("Write the partly filled page now")
+        .params({
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleFlushLog);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/removeI2CPeriodicRead")
+        .summary("Remove periodic read")
+        .description("Stop polling a periodic read")
+        .params({
+            REQUIRED_INT_PARAM("id", "Periodic read ID"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleRemovePeriodicRead);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/addI2CFifo")
+        .summary("Add FIFO drain")
+        .description("Drain a sensor FIFO into a frame ring once a watermark of frames is waiting")
+        .params({
+            REQUIRED_INT_PARAM("bus_id", "Bus ID"),
+            REQUIRED_STR_PARAM("device_addr", "Device address (hex format)"),
+            FLEXIBLE_I2C_TEN_BIT_PARAM,
+            REQUIRED_STR_PARAM("count_reg", "Fill level register (hex format)"),
+            INT_PARAM("count_bytes", "Fill level width in bytes (1 or 2, default 2)"),
+            INT_PARAM("count_le", "Fill level is little-endian (0 or 1, default 0)"),
+            STR_PARAM("count_mask", "Valid fill level bits (hex format, default 0xFFFF)"),
+            INT_PARAM("count_frames", "Fill level counts frames instead of bytes (0 or 1, default 0)"),
+            REQUIRED_STR_PARAM("data_reg", "FIFO data register (hex format)"),
+            REQUIRED_INT_PARAM("frame_size", "Bytes per frame"),
+            INT_PARAM("watermark", "Frames waiting before a drain (default 1)"),
+            INT_PARAM("capacity", "Ring capacity in frames (default 64)"),
+            INT_PARAM("poll_ms", "Fill level check interval (default 10)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleAddFifo);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/readI2CFifo")
+        .summary("Read FIFO frames")
+        .description("Drain a FIFO now and return (and release) the oldest frames in its ring, with drain statistics")
+        .params({
+            REQUIRED_INT_PARAM("id", "FIFO ID"),
+            INT_PARAM("max_frames", "Frames to return (default 16, max 64)"),
+            INT_PARAM("drain", "Drain the device first, ignoring the watermark (0 or 1, default 1)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleReadFifo);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/removeI2CFifo")
+        .summary("Remove FIFO drain")
+        .description("Stop draining a FIFO and free its ring")
+        .params({
+            REQUIRED_INT_PARAM("id", "FIFO ID"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleRemoveFifo);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/triggerI2C")
+        .summary("Synchronized trigger")
+        .description("Send a general call or broadcast trigger on one or both buses, then read results back with offsets from the trigger")
+        .params({
+            STR_PARAM("buses", "Bus IDs to trigger, e.g. '0,1' (default 0)"),
+            STR_PARAM("address", "Broadcast address (hex format, default 0x00 general call)"),
+            REQUIRED_STR_PARAM("data", "Comma-separated hex trigger bytes (e.g., '0x08')"),
+            STR_PARAM("reads", "Read-backs as bus:device_addr:reg_addr:length, comma-separated (e.g., '0:0x48:0x00:2,1:0x48:0x00:2')"),
+            INT_PARAM("settle_us", "Delay from each bus's trigger to its read-backs (default 0)"),
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleTrigger);
+        })
+    );
+
+    endpoints.addEndpoint(FLEXIBLE_ENDPOINT()
+        .route("/getI2CPeriodicReads")
+        .summary("List periodic reads")
+        .description("Periodic reads with their bounds, effective rates and last values")
+        .params({
+            FLEXIBLE_I2C_FORMAT_PARAM
+        })
+        .responseType(JSON_RESPONSE)
+        .handler([this](std::map<String, String>& params) {
+            return negotiate(params, &FlexibleI2C::handleGetPeriodicReads);
+        })
+    );
+}
+
+std::pair<String, int> FlexibleI2C::handleInitBus(std::map<String, String>& params, const I2CRequest& request) {
+    JsonDocument response;
+
+    if (params.find("bus_id") == params.end() || params.find("sda_pin") == params.end() || params.find("scl_pin") == params.end()) {
+        response["success"] = false;
+        response["error"] = "Missing required parameters";
+        return serializeResponse(request, response, 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint8_t sda_pin = params["sda_pin"].toInt();
+    uint8_t scl_pin = params["scl_pin"].toInt();
+    uint32_t frequency = params.find("frequency") != params.end() ? params["frequency"].toInt() : 100000;
+
+    bool success = initBus(bus_id, sda_pin, scl_pin, frequency);
+    if (success && params.find("idle_ms") != params.end()) {
+        setIdlePowerDown(bus_id, params["idle_ms"].toInt());
+    }
+
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    response["sda_pin"] = sda_pin;
+    response["scl_pin"] = scl_pin;
+    response["frequency"] = frequency;
+
+    if (!success) {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleScanBus(std::map<String, String>& params, const I2CRequest& request) {
+    JsonDocument response;
+
+    if (params.find("bus_id") == params.end()) {
+        response["success"] = false;
+        response["error"] = "Missing bus_id parameter";
+        return serializeResponse(request, response, 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+
+    if (params.find("ten_bit") != params.end() && params["ten_bit"].toInt() != 0) {
+        uint8_t probes = params.find("probes") != params.end() ? params["probes"].toInt() : 8;
+        bool started = beginTenBitScan(bus_id, probes);
+        response["success"] = started;
+        response["bus_id"] = bus_id;
+        if (!started) {
+            response["error"] = getErrorString(getLastError());
+            return serializeResponse(request, response, 400);
+        }
+        response["ten_bit_scan"] = "started";
+        return serializeResponse(request, response, 202);
+    }
+
+    std::vector<uint8_t> devices = scanBus(bus_id);
+
+    response["success"] = (getLastError() == SUCCESS);
+    response["bus_id"] = bus_id;
+    response["device_count"] = devices.size();
+    response["ten_bit_scan_running"] = isTenBitScanRunning(bus_id);
+
+    JsonArray device_array = response["devices"].to<JsonArray>();
+    for (uint8_t addr : devices) {
+        JsonObject device = device_array.createNestedObject();
+        device["address"] = addr;
+        if (!request.binary) {
+            device["address_hex"] = "0x" + String(addr, HEX);
+        }
+    }
+
+    if (getLastError() != SUCCESS) {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, response["success"] ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleDeviceInfo(std::map<String, String>& params, const I2CRequest& request) {
+    // A max_age_ms filter depends on the clock as well, so it always gets a full answer
+    if (params.find("since_version") != params.end() && (uint32_t)params["since_version"].toInt() == registry_version &&
+        params.find("max_age_ms") == params.end()) {
+        return {String(), 304};
+    }
+
+    I2CDeviceFilter filter;
+    filter.bus_id = params.find("bus_id") != params.end() ? params["bus_id"].toInt() : -1;
+    filter.responsive = params.find("responsive") != params.end() ? params["responsive"].toInt() : -1;
+    filter.quarantined = params.find("quarantined") != params.end() ? params["quarantined"].toInt() : -1;
+    filter.name = params.find("name") != params.end() ? params["name"] : String();
+    filter.max_age_ms = params.find("max_age_ms") != params.end() ? params["max_age_ms"].toInt() : 0;
+
+    size_t cursor = params.find("cursor") != params.end() ? params["cursor"].toInt() : 0;
+    size_t limit = params.find("limit") != params.end() ? params["limit"].toInt() : DEVICE_PAGE_DEFAULT;
+    if (limit == 0 || limit > DEVICE_PAGE_MAX) {
+        limit = DEVICE_PAGE_MAX;
+    }
+
+    // Held for both passes: update() and the bus tasks add devices and stats meanwhile
+    I2CBusLock::Guard state_guard(state_lock);
+    // First pass only counts, so the envelope (and MessagePack array header) can be written up front
+    unsigned long now = millis();
+    size_t matched = 0;
+    size_t returned = 0;
+    size_t next_cursor = 0;
+    for (size_t i = 0; i < known_devices.size(); i++) {
+        if (!matchesFilter(known_devices[i], filter, now)) {
+            continue;
+        }
+        matched++;
+        if (i >= cursor) {
+            if (returned < limit) {
+                returned++;
+            } else if (next_cursor == 0) {
+                next_cursor = i;
+            }
+        }
+    }
+
+    // Devices are serialized one at a time straight into the output, so memory is bounded
+    // by a single device entry plus the page being returned
+    String output;
+    output.reserve(96 + returned * 112);
+    if (request.binary) {
+        output += (char)0x86; // fixmap, 6 entries
+        appendMsgPackString(output, "success");
+        output += (char)0xc3;
+        appendMsgPackString(output, "version");
+        appendMsgPackUint(output, registry_version);
+        appendMsgPackString(output, "device_count");
+        appendMsgPackUint(output, matched);
+        appendMsgPackString(output, "returned");
+        appendMsgPackUint(output, returned);
+        appendMsgPackString(output, "next_cursor");
+        if (next_cursor) {
+            appendMsgPackUint(output, next_cursor);
+        } else {
+            output += (char)0xc0;
+        }
+        appendMsgPackString(output, "devices");
+        output += (char)0xdc; // array 16
+        output += (char)(returned >> 8);
+        output += (char)(returned & 0xFF);
+    } else {
+        output += "{\"success\":true,\"version\":" + String((unsigned long)registry_version) +
+                  ",\"device_count\":" + String((unsigned long)matched) +
+                  ",\"returned\":" + String((unsigned long)returned) +
+                  ",\"next_cursor\":" + (next_cursor ? String((unsigned long)next_cursor) : String("null")) +
+                  ",\"devices\":[";
+    }
+
+    size_t written = 0;
+    for (size_t i = cursor; i < known_devices.size() && written < returned; i++) {
+        if (!matchesFilter(known_devices[i], filter, now)) {
+            continue;
+        }
+        JsonDocument device_doc = deviceInfoToJson(known_devices[i], request);
+        if (request.binary) {
+            serializeMsgPack(device_doc, output);
+        } else {
+            if (written > 0) {
+                output += ',';
+            }
+            serializeJson(device_doc, output);
+        }
+        written++;
+    }
+
+    if (!request.binary) {
+        output += "]}";
+    }
+    return {output, 200};
+}
+
+bool FlexibleI2C::matchesFilter(const I2CDeviceInfo& device, const I2CDeviceFilter& filter, unsigned long now) {
+    if (filter.bus_id >= 0 && device.bus_id != filter.bus_id) {
+        return false;
+    }
+    if (filter.responsive >= 0 && device.responsive != (filter.responsive != 0)) {
+        return false;
+    }
+    if (filter.quarantined >= 0 && isDeviceQuarantined(device.bus_id, device.address) != (filter.quarantined != 0)) {
+        return false;
+    }
+    if (filter.name.length() > 0 && device.device_name.indexOf(filter.name) < 0) {
+        return false;
+    }
+    if (filter.max_age_ms > 0 && (device.last_seen == 0 || now - device.last_seen > filter.max_age_ms)) {
+        return false;
+    }
+    return true;
+}
+
+std::pair<String, int> FlexibleI2C::handleBusConfig(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("since_version") != params.end() && (uint32_t)params["since_version"].toInt() == bus_config_version) {
+        return {String(), 304};
+    }
+
+    JsonDocument response;
+    response["success"] = true;
+    response["version"] = bus_config_version;
+
+    JsonArray buses_array = response["buses"].to<JsonArray>();
+    for (const auto& bus_pair : buses) {
+        buses_array.add(busConfigToJson(bus_pair.first));
+    }
+    for (const auto& target_pair : targets) {
+        if (target_pair.second->isActive()) {
+            JsonObject target_obj = buses_array.createNestedObject();
+            target_obj["bus_id"] = target_pair.first;
+            target_obj["mode"] = "target";
+            setHex(request, target_obj["address"], target_pair.second->getAddress());
+        }
+    }
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleReadRegister(std::map<String, String>& params, const I2CRequest& request) {
+    JsonDocument response;
+
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() || params.find("reg_addr") == params.end()) {
+        response["success"] = false;
+        response["error"] = "Missing required parameters";
+        return serializeResponse(request, response, 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t reg_addr = strtol(params["reg_addr"].c_str(), NULL, 16);
+
+    uint8_t value = readRegister(bus_id, device_addr, reg_addr);
+    bool success = (getLastError() == SUCCESS);
+
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    setHex(request, response["reg_addr"], reg_addr);
+
+    if (success) {
+        response["value"] = value;
+        if (!request.binary) {
+            response["value_hex"] = "0x" + String(value, HEX);
+        }
+    } else {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleWriteRegister(std::map<String, String>& params, const I2CRequest& request) {
+    JsonDocument response;
+
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
+        params.find("reg_addr") == params.end() || params.find("value") == params.end()) {
+        response["success"] = false;
+        response["error"] = "Missing required parameters";
+        return serializeResponse(request, response, 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t reg_addr = strtol(params["reg_addr"].c_str(), NULL, 16);
+    uint8_t value = strtol(params["value"].c_str(), NULL, 16);
+
+    bool success = writeRegister(bus_id, device_addr, reg_addr, value);
+
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    setHex(request, response["reg_addr"], reg_addr);
+    setHex(request, response["value"], value);
+
+    if (!success) {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handlePingDevice(std::map<String, String>& params, const I2CRequest& request) {
+    JsonDocument response;
+
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end()) {
+        response["success"] = false;
+        response["error"] = "Missing required parameters";
+        return serializeResponse(request, response, 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+
+    bool present = isDevicePresent(bus_id, device_addr);
+
+    response["success"] = true;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    response["present"] = present;
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleReadBytes(std::map<String, String>& params, const I2CRequest& request) {
+    JsonDocument response;
+
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
+        params.find("reg_addr") == params.end() || params.find("length") == params.end()) {
+        response["success"] = false;
+        response["error"] = "Missing required parameters";
+        return serializeResponse(request, response, 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t reg_addr = strtol(params["reg_addr"].c_str(), NULL, 16);
+    uint8_t length = params["length"].toInt();
+
+    if (length > 64) { // Reasonable limit
+        response["success"] = false;
+        response["error"] = "Length too large (max 64 bytes)";
+        return serializeResponse(request, response, 400);
+    }
+
+    uint8_t data[64];
+    bool success = readBytes(bus_id, device_addr, reg_addr, data, length);
+
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    setHex(request, response["reg_addr"], reg_addr);
+    response["length"] = length;
+
+    if (success) {
+        setBytes(request, response["data"], data, length);
+    } else {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleWriteBytes(std::map<String, String>& params, const I2CRequest& request) {
+    JsonDocument response;
+
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
+        params.find("reg_addr") == params.end() || params.find("data") == params.end()) {
+        response["success"] = false;
+        response["error"] = "Missing required parameters";
+        return serializeResponse(request, response, 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t reg_addr = strtol(params["reg_addr"].c_str(), NULL, 16);
+
+    std::vector<uint8_t> data_bytes = parseHexBytes(params["data"]);
+
+    if (data_bytes.empty()) {
+        response["success"] = false;
+        response["error"] = "No valid data bytes provided";
+        return serializeResponse(request, response, 400);
+    }
+
+    bool success = writeBytes(bus_id, device_addr, reg_addr, data_bytes.data(), data_bytes.size());
+
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    setHex(request, response["reg_addr"], reg_addr);
+    response["bytes_written"] = data_bytes.size();
+
+    if (!success) {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleSMBusReadWord(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() || params.find("command") == params.end()) {
+        return errorResponse(request, "Missing required parameters", 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t command = strtol(params["command"].c_str(), NULL, 16);
+    bool use_pec = params.find("pec") != params.end() && params["pec"].toInt() != 0;
+
+    uint16_t value = 0;
+    bool success = smbusReadWord(bus_id, device_addr, command, value, use_pec);
+
+    JsonDocument response;
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    setHex(request, response["command"], command);
+    response["pec"] = use_pec;
+
+    if (success) {
+        response["value"] = value;
+        if (!request.binary) {
+            response["value_hex"] = "0x" + String(value, HEX);
+        }
+    } else {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleSMBusWriteWord(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
+        params.find("command") == params.end() || params.find("value") == params.end()) {
+        return errorResponse(request, "Missing required parameters", 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t command = strtol(params["command"].c_str(), NULL, 16);
+    uint16_t value = strtol(params["value"].c_str(), NULL, 16);
+    bool use_pec = params.find("pec") != params.end() && params["pec"].toInt() != 0;
+
+    bool success = smbusWriteWord(bus_id, device_addr, command, value, use_pec);
+
+    JsonDocument response;
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    setHex(request, response["command"], command);
+    setHex(request, response["value"], value);
+    response["pec"] = use_pec;
+
+    if (!success) {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleSMBusBlockRead(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() || params.find("command") == params.end()) {
+        return errorResponse(request, "Missing required parameters", 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t command = strtol(params["command"].c_str(), NULL, 16);
+    bool use_pec = params.find("pec") != params.end() && params["pec"].toInt() != 0;
+    long max_length = params.find("max_length") != params.end() ? params["max_length"].toInt() : SMBUS_BLOCK_MAX;
+
+    if (max_length < 1 || max_length > SMBUS_BLOCK_MAX) {
+        return errorResponse(request, "max_length must be between 1 and 32", 400);
+    }
+
+    uint8_t data[SMBUS_BLOCK_MAX];
+    uint8_t length = max_length;
+    bool success = smbusBlockRead(bus_id, device_addr, command, data, length, use_pec);
+
+    JsonDocument response;
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    setHex(request, response["command"], command);
+    response["pec"] = use_pec;
+
+    if (success) {
+        response["length"] = length;
+        setBytes(request, response["data"], data, length);
+    } else {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleSMBusBlockWrite(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
+        params.find("command") == params.end() || params.find("data") == params.end()) {
+        return errorResponse(request, "Missing required parameters", 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t command = strtol(params["command"].c_str(), NULL, 16);
+    bool use_pec = params.find("pec") != params.end() && params["pec"].toInt() != 0;
+
+    std::vector<uint8_t> data_bytes = parseHexBytes(params["data"]);
+    if (data_bytes.empty() || data_bytes.size() > SMBUS_BLOCK_MAX) {
+        return errorResponse(request, "Block must contain 1 to 32 bytes", 400);
+    }
+
+    bool success = smbusBlockWrite(bus_id, device_addr, command, data_bytes.data(), data_bytes.size(), use_pec);
+
+    JsonDocument response;
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    setHex(request, response["command"], command);
+    response["bytes_written"] = data_bytes.size();
+    response["pec"] = use_pec;
+
+    if (!success) {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleSMBusProcessCall(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
+        params.find("command") == params.end() || params.find("value") == params.end()) {
+        return errorResponse(request, "Missing required parameters", 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t command = strtol(params["command"].c_str(), NULL, 16);
+    uint16_t value = strtol(params["value"].c_str(), NULL, 16);
+    bool use_pec = params.find("pec") != params.end() && params["pec"].toInt() != 0;
+
+    uint16_t result = 0;
+    bool success = smbusProcessCall(bus_id, device_addr, command, value, result, use_pec);
+
+    JsonDocument response;
+    response["success"] = success;
+    response["bus_id"] = bus_id;
+    setDeviceAddress(request, response, device_addr);
+    setHex(request, response["command"], command);
+    setHex(request, response["value"], value);
+    response["pec"] = use_pec;
+
+    if (success) {
+        response["result"] = result;
+        if (!request.binary) {
+            response["result_hex"] = "0x" + String(result, HEX);
+        }
+    } else {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleBusStats(std::map<String, String>& params, const I2CRequest& request) {
+    JsonDocument response;
+    static const uint8_t windows[] = { 1, 10, 59 };
+
+    response["success"] = true;
+    JsonArray buses_array = response["buses"].to<JsonArray>();
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (params.find("bus_id") != params.end() && params["bus_id"].toInt() != bus_id) {
+            continue;
+        }
+        if (!isBusInitialized(bus_id)) {
+            continue;
+        }
+
+        const I2CBusStats& stats = getBusStats(bus_id);
+        JsonObject bus_obj = buses_array.createNestedObject();
+        bus_obj["bus_id"] = bus_id;
+        bus_obj["frequency"] = buses[bus_id].frequency;
+        bus_obj["transactions"] = stats.transactions;
+        bus_obj["errors"] = stats.errors;
+        bus_obj["bytes"] = stats.bytes;
+        bus_obj["busy_us"] = stats.busy_us;
+        bus_obj["wire_us"] = stats.wire_us;
+        // Time spent beyond the ideal wire time: clock stretching, driver and ISR overhead
+        bus_obj["overhead_us"] = stats.busy_us > stats.wire_us ? stats.busy_us - stats.wire_us : 0;
+        bus_obj["wire_efficiency"] = stats.busy_us ? (float)stats.wire_us / stats.busy_us : 0.0f;
+        bus_obj["recoveries"] = stats.recoveries;
+
+        JsonObject sessions_obj = bus_obj["sessions"].to<JsonObject>();
+        sessions_obj["count"] = stats.sessions;
+        sessions_obj["expired"] = stats.sessions_expired;
+        sessions_obj["hold_us"] = stats.session_hold_us;
+        sessions_obj["max_hold_us"] = stats.session_max_hold_us;
+        sessions_obj["wait_us"] = stats.session_wait_us;
+        sessions_obj["rejects"] = stats.session_rejects;
+        sessions_obj["active"] = sessions[bus_id].id != 0;
+
+        const I2CBusLockStats& lock_stats = bus_locks[bus_id].getStats();
+        JsonObject lock_obj = bus_obj["lock"].to<JsonObject>();
+        lock_obj["acquisitions"] = lock_stats.acquisitions;
+        lock_obj["contentions"] = lock_stats.contentions;
+        lock_obj["contention_rate"] = lock_stats.acquisitions ? (float)lock_stats.contentions / lock_stats.acquisitions : 0.0f;
+        lock_obj["timeouts"] = lock_stats.timeouts;
+        lock_obj["wait_us"] = lock_stats.wait_us;
+        lock_obj["max_wait_us"] = lock_stats.max_wait_us;
+        lock_obj["hold_us"] = lock_stats.hold_us;
+        lock_obj["max_hold_us"] = lock_stats.max_hold_us;
+
+        JsonObject power_obj = bus_obj["power"].to<JsonObject>();
+        power_obj["powered_down"] = buses[bus_id].powered_down;
+        power_obj["power_downs"] = stats.power_downs;
+        power_obj["wakeups"] = stats.wakeups;
+        power_obj["last_wake_us"] = stats.last_wake_us;
+        power_obj["max_wake_us"] = stats.max_wake_us;
+        power_obj["avg_wake_us"] = stats.wakeups ? (uint32_t)(stats.wake_us / stats.wakeups) : 0;
+
+        JsonArray windows_array = bus_obj["windows"].to<JsonArray>();
+        for (uint8_t seconds : windows) {
+            float utilization = getBusUtilization(bus_id, seconds);
+            JsonObject window = windows_array.createNestedObject();
+            window["seconds"] = seconds;
+            window["utilization"] = utilization;
+            window["idle"] = 1.0f - utilization;
+            window["bytes_per_second"] = getBusBytesPerSecond(bus_id, seconds);
+        }
+    }
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleEstimateTiming(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("ops") == params.end()) {
+        return errorResponse(request, "Missing ops parameter", 400);
+    }
+
+    uint8_t bus_id = params.find("bus_id") != params.end() ? params["bus_id"].toInt() : 0;
+    if (bus_id > 1) {
+        return errorResponse(request, "Invalid bus_id", 400);
+    }
+    bool ten_bit = params.find("ten_bit") != params.end() && params["ten_bit"].toInt() != 0;
+    uint32_t frequency = params.find("frequency") != params.end() ? params["frequency"].toInt() : 0;
+    if (!frequency) {
+        frequency = isBusInitialized(bus_id) ? buses[bus_id].frequency : 100000;
+    }
+
+    JsonDocument response;
+    response["success"] = true;
+    response["bus_id"] = bus_id;
+    response["frequency"] = frequency;
+
+    std::vector<I2COperation> batch;
+    JsonArray ops_array = response["operations"].to<JsonArray>();
+    String ops = params["ops"];
+    int start = 0;
+    while (start <= (int)ops.length()) {
+        int comma = ops.indexOf(',', start);
+        if (comma < 0) {
+            comma = ops.length();
+        }
+        String spec = ops.substring(start, comma);
+        spec.trim();
+        start = comma + 1;
+        if (spec.length() == 0) {
+            continue;
+        }
+
+        I2COperation operation;
+        if (!parseOperation(spec, ten_bit, operation)) {
+            return errorResponse(request, "Invalid operation: " + spec, 400);
+        }
+        batch.push_back(operation);
+
+        I2CTimingEstimate estimate = estimateTiming(bus_id, operation, frequency);
+        JsonObject op_obj = ops_array.createNestedObject();
+        op_obj["op"] = spec;
+        op_obj["transactions"] = estimate.transactions;
+        op_obj["bytes"] = estimate.bytes;
+        op_obj["wire_us"] = (uint32_t)(estimate.wire_ns / 1000);
+        op_obj["stretch_us"] = (uint32_t)(estimate.stretch_ns / 1000);
+        op_obj["total_us"] = estimate.totalUs();
+    }
+    if (batch.empty()) {
+        return errorResponse(request, "No operations given", 400);
+    }
+
+    I2CTimingEstimate total = estimateTiming(bus_id, batch, frequency);
+    JsonObject total_obj = response["total"].to<JsonObject>();
+    total_obj["transactions"] = total.transactions;
+    total_obj["bytes"] = total.bytes;
+    total_obj["wire_us"] = (uint32_t)(total.wire_ns / 1000);
+    total_obj["stretch_us"] = (uint32_t)(total.stretch_ns / 1000);
+    total_obj["total_us"] = total.totalUs();
+
+    if (params.find("rate_hz") != params.end() && params["rate_hz"].toInt() > 0) {
+        // Fraction of the bus the batch occupies when repeated at rate_hz
+        float share = (float)total.totalNs() * params["rate_hz"].toInt() / 1e9f;
+        total_obj["rate_hz"] = params["rate_hz"].toInt();
+        total_obj["bus_share"] = share;
+        total_obj["fits"] = share <= 1.0f;
+    }
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleGetTrace(std::map<String, String>& params, const I2CRequest& request) {
+    std::vector<I2CTraceEntry> entries = getTrace();
+    size_t first = 0;
+    if (params.find("limit") != params.end() && params["limit"].toInt() > 0 && (size_t)params["limit"].toInt() < entries.size()) {
+        first = entries.size() - params["limit"].toInt();
+    }
+
+    JsonDocument response;
+    response["success"] = true;
+    response["depth"] = getTraceDepth();
+    response["now_us"] = timestampUs();
+
+    JsonArray entries_array = response["entries"].to<JsonArray>();
+    for (size_t i = first; i < entries.size(); i++) {
+        const I2CTraceEntry& entry = entries[i];
+        JsonObject entry_obj = entries_array.createNestedObject();
+        entry_obj["bus_id"] = entry.bus_id;
+        setDeviceAddress(request, entry_obj, entry.device_address);
+        entry_obj["request_us"] = entry.request_us;
+        entry_obj["complete_us"] = entry.complete_us;
+        entry_obj["bytes"] = entry.bytes;
+        if (entry.result != SUCCESS) {
+            entry_obj["error"] = getErrorString(static_cast<I2CError>(entry.result));
+        }
+    }
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleSetTrace(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("depth") == params.end()) {
+        return errorResponse(request, "Missing depth parameter", 400);
+    }
+
+    long depth = params["depth"].toInt();
+    if (depth < 0 || depth > 1024) {
+        return errorResponse(request, "Invalid depth", 400);
+    }
+    setTraceDepth(depth);
+
+    JsonDocument response;
+    response["success"] = true;
+    response["depth"] = depth;
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleGetLog(std::map<String, String>& params, const I2CRequest& request) {
+    if (!flash_log.isOpen()) {
+        return errorResponse(request, "Flash log not started", 409);
+    }
+
+    JsonDocument response;
+    response["success"] = true;
+    response["directory"] = flash_log.getConfig().directory;
+    response["page_bytes"] = flash_log.getPageBytes();
+    response["records_per_page"] = flash_log.getRecordsPerPage();
+    response["file_bytes"] = flash_log.getConfig().file_bytes;
+    response["max_files"] = flash_log.getConfig().max_files;
+    response["boot"] = flash_log.getBoot();
+    response["buffered_records"] = flash_log.getBufferedRecords();
+    response["pages_written"] = flash_log.getPagesWritten();
+    response["records_written"] = flash_log.getRecordsWritten();
+    response["write_errors"] = flash_log.getWriteErrors();
+    response["dropped_records"] = flash_log.getDroppedRecords();
+    response["rotations"] = flash_log.getRotations();
+
+    size_t total_bytes = 0;
+    JsonArray files_array = response["files"].to<JsonArray>();
+    for (const I2CLogFileInfo& file : flash_log.getFiles()) {
+        JsonObject file_obj = files_array.add<JsonObject>();
+        file_obj["file"] = file.index;
+        file_obj["bytes"] = file.bytes;
+        file_obj["pages"] = file.bytes / flash_log.getPageBytes();
+        total_bytes += file.bytes;
+    }
+    response["total_bytes"] = total_bytes;
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleReadLog(std::map<String, String>& params, const I2CRequest& request) {
+    if (!flash_log.isOpen()) {
+        return errorResponse(request, "Flash log not started", 409);
+    }
+
+    std::vector<I2CLogFileInfo> files = flash_log.getFiles();
+    uint32_t file = params.find("file") != params.end() ? params["file"].toInt() : (files.empty() ? 0 : files.front().index);
+    uint32_t page = params.find("page") != params.end() ? params["page"].toInt() : 0;
+    size_t pages = params.find("pages") != params.end() ? params["pages"].toInt() : 1;
+    if (pages == 0 || pages > 4) {
+        pages = 4;
+    }
+    bool raw = params.find("raw") != params.end() && params["raw"].toInt() != 0;
+    if (raw) {
+        // A raw page is getPageBytes() of payload, twice that as hex
+        pages = 1;
+    }
+
+    JsonDocument response;
+    response["success"] = true;
+    JsonArray pages_array = response["pages"].to<JsonArray>();
+
+    // One page in RAM at a time; files are never loaded whole
+    std::vector<uint8_t> buffer(flash_log.getPageBytes());
+    size_t file_pos = 0;
+    bool at_end = false;
+    for (size_t attempts = 0; attempts < pages;) {
+        while (file_pos < files.size() && files[file_pos].index < file) {
+            file_pos++;
+        }
+        if (file_pos == files.size()) {
+            at_end = true;
+            break;
+        }
+        if (files[file_pos].index != file) {
+            file = files[file_pos].index;
+            page = 0;
+        }
+        if (page >= files[file_pos].bytes / buffer.size()) {
+            file++;
+            page = 0;
+            continue;
+        }
+
+        attempts++;
+        if (flash_log.readPage(file, page, buffer.data())) {
+            I2CLogPageHeader header;
+            memcpy(&header, buffer.data(), sizeof(header));
+
+            JsonObject page_obj = pages_array.add<JsonObject>();
+            page_obj["file"] = file;
+            page_obj["page"] = page;
+            page_obj["boot"] = header.boot;
+            page_obj["sequence"] = header.sequence;
+            page_obj["count"] = header.count;
+            if (raw && request.binary) {
+                page_obj["data"] = MsgPackBinary(buffer.data(), buffer.size());
+            } else if (raw) {
+                // One hex string per page rather than setBytes()'s string per byte
+                static const char digits[] = "0123456789abcdef";
+                String hex;
+                hex.reserve(buffer.size() * 2);
+                for (uint8_t byte : buffer) {
+                    hex += digits[byte >> 4];
+                    hex += digits[byte & 0x0F];
+                }
+                page_obj["data"] = hex;
+            } else {
+                // [timestamp_us, bus_id, device_addr, reg_addr, value]
+                JsonArray records_array = page_obj["records"].to<JsonArray>();
+                for (uint16_t i = 0; i < header.count; i++) {
+                    I2CLogRecord record;
+                    memcpy(&record, buffer.data() + sizeof(header) + i * sizeof(record), sizeof(record));
+                    JsonArray record_array = records_array.add<JsonArray>();
+                    record_array.add(record.timestamp_us);
+                    record_array.add(record.bus_id);
+                    record_array.add(record.device_address);
+                    record_array.add(record.reg_address);
+                    record_array.add(record.value);
+                }
+            }
+        }
+        page++;
+    }
+
+    if (at_end) {
+        response["end"] = true;
+    } else {
+        response["next_file"] = file;
+        response["next_page"] = page;
+    }
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleFlushLog(std::map<String, String>& params, const I2CRequest& request) {
+    if (!flash_log.isOpen()) {
+        return errorResponse(request, "Flash log not started", 409);
+    }
+
+    uint16_t records = flash_log.getBufferedRecords();
+    if (!flash_log.flush()) {
+        return errorResponse(request, "Flash write failed", 500);
+    }
+
+    JsonDocument response;
+    response["success"] = true;
+    response["records"] = records;
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleAddPeriodicRead(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() || params.find("reg_addr") == params.end() ||
+        params.find("fastest_ms") == params.end() || params.find("slowest_ms") == params.end()) {
+        return errorResponse(request, "Missing required parameters", 400);
+    }
+
+    uint8_t bus_id = params["bus_id"].toInt();
+    uint16_t device_addr = parseDeviceAddress(params);
+    uint8_t reg_addr = strtol(params["reg_addr"].c_str(), NULL, 16);
+    uint8_t length = params.find("length") != params.end() ? params["length"].toInt() : 1;
+    uint32_t fastest_ms = params["fastest_ms"].toInt();
+    uint32_t slowest_ms = params["slowest_ms"].toInt();
+    uint32_t deadband = params.find("deadband") != params.end() ? params["deadband"].toInt() : 0;
+    bool is_signed = params.find("signed") != params.end() && params["signed"].toInt() != 0;
+
+    int id = addPeriodicRead(bus_id, device_addr, reg_addr, length, fastest_ms, slowest_ms, deadband, is_signed);
+    if (id < 0) {
+        return errorResponse(request, getErrorString(getLastError()), 400);
+    }
+
+    if (params.find("history_bytes") != params.end() && params["history_bytes"].toInt() > 0) {
+        uint32_t resolution_us = params.find("history_resolution_us") != params.end() ? params["history_resolution_us"].toInt() : 1000;
+        bool use_xor = params.find("history_xor") != params.end() && params["history_xor"].toInt() != 0;
+        if (!enableSampleHistory(id, params["history_bytes"].toInt(), resolution_us,
+                                 use_xor ? I2CSampleStore::XOR : I2CSampleStore::DELTA)) {
+            removePeriodicRead(id);
+            return errorResponse(request, "Invalid history parameters", 400);
+        }
+    }
+    if (params.find("log") != params.end() && params["log"].toInt() != 0) {
+        setPeriodicReadLogging(id, true);
+    }
+
+    JsonDocument response;
+    response["success"] = true;
+    response["id"] = id;
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleGetSamples(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("id") == params.end()) {
+        return errorResponse(request, "Missing id parameter", 400);
+    }
+
+    uint16_t id = params["id"].toInt();
+    I2CBusLock::Guard state_guard(state_lock);
+    const I2CSampleStore* history = getSampleHistory(id);
+    if (!history) {
+        return errorResponse(request, "No sample history for this periodic read", 404);
+    }
+
+    // Microsecond timestamps outgrow toInt()'s 32 bits after about 35 minutes
+    uint64_t from_us = params.find("from_us") != params.end() ? strtoull(params["from_us"].c_str(), NULL, 10) : 0;
+    uint64_t to_us = params.find("to_us") != params.end() ? strtoull(params["to_us"].c_str(), NULL, 10) : UINT64_MAX;
+    size_t limit = params.find("limit") != params.end() ? params["limit"].toInt() : 256;
+    if (limit == 0 || limit > 1024) {
+        limit = 1024;
+    }
+
+    JsonDocument response;
+    response["success"] = true;
+    response["id"] = id;
+    response["resolution_us"] = history->getResolutionUs();
+
+    JsonArray samples_array = response["samples"].to<JsonArray>();
+    size_t returned = 0;
+    uint64_t next_from_us = 0;
+    history->query(from_us, to_us, [&](const I2CSamplePoint& point) {
+        if (returned == limit) {
+            next_from_us = point.timestamp_us;
+            return false;
+        }
+        JsonArray pair = samples_array.add<JsonArray>();
+        pair.add(point.timestamp_us);
+        pair.add(point.value);
+        returned++;
+        return true;
+    });
+
+    response["returned"] = returned;
+    if (next_from_us) {
+        response["next_from_us"] = next_from_us;
+    }
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleRemovePeriodicRead(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("id") == params.end()) {
+        return errorResponse(request, "Missing id parameter", 400);
+    }
+
+    uint16_t id = params["id"].toInt();
+    if (!removePeriodicRead(id)) {
+        return errorResponse(request, "Unknown periodic read", 404);
+    }
+
+    JsonDocument response;
+    response["success"] = true;
+    response["id"] = id;
+
+    return serializeResponse(request, response, 200);
+}
+
+std::pair<String, int> FlexibleI2C::handleGetPeriodicReads(std::map<String, String>& params, const I2CRequest& request) {
+    JsonDocument response;
+    unsigned long now = millis();
+
+    I2CBusLock::Guard state_guard(state_lock);
+    response["success"] = true;
+    response["count"] = periodic_reads.size();
+
+    JsonArray reads_array = response["reads"].to<JsonArray>();
+    for (const auto& read : periodic_reads) {
+        JsonObject read_obj = reads_array.createNestedObject();
+        read_obj["id"] = read.id;
+        read_obj["bus_id"] = read.bus_id;
+        setDeviceAddress(request, read_obj, read.device_address);
+        setHex(request, read_obj["reg_addr"], read.reg_address);
+        read_obj["length"] = read.length;
+        read_obj["fastest_ms"] = read.fastest_interval_ms;
+        read_obj["slowest_ms"] = read.slowest_interval_ms;
+        read_obj["deadband"] = read.deadband;
+        read_obj["logged"] = read.logged;
+        read_obj["interval_ms"] = read.interval_ms;
+        read_obj["rate_hz"] = 1000.0f / read.interval_ms;
+        read_obj["samples"] = read.samples;
+        read_obj["changes"] = read.changes;
+        read_obj["errors"] = read.errors;
+        if (read.has_value) {
+            read_obj["value"] = read.last_value;
+        }
+        read_obj["request_us"] = read.request_us;
+        read_obj["complete_us"] = read.complete_us;
+        read_obj["latency_us"] = (uint32_t)(read.complete_us - read.request_us);
+        read_obj["latency_max_us"] = read.latency_max_us;
+        read_obj["latency_mean_us"] = read.samples ? (uint32_t)(read.latency_sum_us / read.samples) : 0;
+        read_obj["jitter_max_us"] = read.jitter_max_us;
+        read_obj["jitter_mean_us"] = read.jitter_count ? (uint32_t)(read.jitter_sum_us / read.jitter_count) : 0;
+
+        const I2CSampleStore* history = getSampleHistory(read.id);
+        if (history) {
+            JsonObject history_obj = read_obj["history"].to<JsonObject>();
+            uint32_t stored = history->getSampleCount();
+            history_obj["samples"] = stored;
+            history_obj["blocks"] = history->getBlockCount();
+            history_obj["capacity_blocks"] = history->getCapacityBlocks();
+            history_obj["memory_bytes"] = history->getMemoryBytes();
+            history_obj["encoded_bytes"] = history->getEncodedBytes();
+            // Against raw 8-byte timestamps and 4-byte values
+            history_obj["compression"] = history->getEncodedBytes() ? stored * 12.0f / history->getEncodedBytes() : 0.0f;
+            history_obj["dropped_blocks"] = history->getDroppedBlocks();
+            uint64_t first_us, last_us;
+            if (history->getRange(first_us, last_us)) {
+                history_obj["first_us"] = first_us;
+                history_obj["last_us"] = last_us;
+            }
+        }
 
-    if (!success) {
-        response["error"] = getErrorString(getLastError());
+        // Share of reads avoided compared with polling at the fastest rate throughout
+        unsigned long age = now - read.created_at;
+        uint32_t fixed_rate_samples = age / read.fastest_interval_ms + 1;
+        read_obj["saved_ratio"] = fixed_rate_samples > read.samples ? 1.0f - (float)read.samples / fixed_rate_samples : 0.0f;
     }
 
-    String output;
-    serializeJson(response, output);
-    return {output, success ? 200 : 500};
+    return serializeResponse(request, response, 200);
 }
 
-std::pair<String, int> FlexibleI2C::handleScanBus(std::map<String, String>& params) {
-    JsonDocument response;
+std::pair<String, int> FlexibleI2C::handleAddFifo(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
+        params.find("count_reg") == params.end() || params.find("data_reg") == params.end() ||
+        params.find("frame_size") == params.end()) {
+        return errorResponse(request, "Missing required parameters", 400);
+    }
 
-    if (params.find("bus_id") == params.end()) {
-        response["success"] = false;
-        response["error"] = "Missing bus_id parameter";
-        String output;
-        serializeJson(response, output);
-        return {output, 400};
+    I2CFifoConfig config;
+    config.bus_id = params["bus_id"].toInt();
+    config.device_address = parseDeviceAddress(params);
+    config.count_reg = strtol(params["count_reg"].c_str(), NULL, 16);
+    config.count_bytes = params.find("count_bytes") != params.end() ? params["count_bytes"].toInt() : 2;
+    config.count_little_endian = params.find("count_le") != params.end() && params["count_le"].toInt() != 0;
+    config.count_mask = params.find("count_mask") != params.end() ? strtol(params["count_mask"].c_str(), NULL, 16) : 0xFFFF;
+    config.count_in_frames = params.find("count_frames") != params.end() && params["count_frames"].toInt() != 0;
+    config.data_reg = strtol(params["data_reg"].c_str(), NULL, 16);
+    config.frame_size = params["frame_size"].toInt();
+    config.watermark_frames = params.find("watermark") != params.end() ? params["watermark"].toInt() : 1;
+    size_t capacity = params.find("capacity") != params.end() ? params["capacity"].toInt() : 64;
+    uint32_t poll_ms = params.find("poll_ms") != params.end() ? params["poll_ms"].toInt() : 10;
+
+    int id = addFifo(config, capacity, poll_ms);
+    if (id < 0) {
+        return errorResponse(request, getErrorString(getLastError()), 400);
     }
 
-    uint8_t bus_id = params["bus_id"].toInt();
-    std::vector<uint8_t> devices = scanBus(bus_id);
+    JsonDocument response;
+    response["success"] = true;
+    response["id"] = id;
 
-    response["success"] = (getLastError() == SUCCESS);
-    response["bus_id"] = bus_id;
-    response["device_count"] = devices.size();
+    return serializeResponse(request, response, 200);
+}
 
-    JsonArray device_array = response["devices"].to<JsonArray>();
-    for (uint8_t addr : devices) {
-        JsonObject device = device_array.createNestedObject();
-        device["address"] = addr;
-        device["address_hex"] = "0x" + String(addr, HEX);
+std::pair<String, int> FlexibleI2C::handleReadFifo(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("id") == params.end()) {
+        return errorResponse(request, "Missing id parameter", 400);
     }
 
-    if (getLastError() != SUCCESS) {
-        response["error"] = getErrorString(getLastError());
+    uint16_t id = params["id"].toInt();
+    if (!getFifo(id)) {
+        return errorResponse(request, "Unknown FIFO", 404);
     }
 
-    String output;
-    serializeJson(response, output);
-    return {output, response["success"] ? 200 : 500};
-}
+    bool drained = true;
+    if (params.find("drain") == params.end() || params["drain"].toInt() != 0) {
+        drained = drainFifo(id, true) >= 0;
+    }
+    size_t max_frames = params.find("max_frames") != params.end() ? params["max_frames"].toInt() : 16;
+    if (max_frames == 0 || max_frames > 64) {
+        max_frames = 64;
+    }
 
-std::pair<String, int> FlexibleI2C::handleDeviceInfo(std::map<String, String>& params) {
     JsonDocument response;
-
     response["success"] = true;
-    response["device_count"] = known_devices.size();
+    response["id"] = id;
+    if (!drained) {
+        response["drain_error"] = getErrorString(getLastError());
+    }
 
-    JsonArray devices_array = response["devices"].to<JsonArray>();
-    for (const auto& device : known_devices) {
-        JsonObject device_obj = devices_array.createNestedObject();
-        device_obj["bus_id"] = device.bus_id;
-        device_obj["address"] = device.address;
-        device_obj["address_hex"] = "0x" + String(device.address, HEX);
-        device_obj["name"] = device.device_name;
-        device_obj["responsive"] = device.responsive;
-        device_obj["last_seen"] = device.last_seen;
+    // Copying the frames out is quick, so the ring stays locked throughout
+    I2CBusLock::Guard state_guard(state_lock);
+    auto it = fifos.find(id);
+    if (it == fifos.end() || it->second.removed) {
+        return errorResponse(request, "Unknown FIFO", 404);
+    }
+    I2CFifo* fifo = &it->second;
+
+    uint16_t frame_size = fifo->ring.getFrameSize();
+    JsonArray frames_array = response["frames"].to<JsonArray>();
+    size_t returned = 0;
+    // While onFifoFrames() holds frames they are not handed out here as well
+    while (!fifo->consuming && returned < max_frames) {
+        size_t count;
+        const uint8_t* frames = fifo->ring.peek(count);
+        if (!frames) {
+            break;
+        }
+        if (count > max_frames - returned) {
+            count = max_frames - returned;
+        }
+        for (size_t i = 0; i < count; i++) {
+            setBytes(request, frames_array.add<JsonVariant>(), frames + i * frame_size, frame_size);
+        }
+        fifo->ring.consume(count);
+        returned += count;
     }
 
-    String output;
-    serializeJson(response, output);
-    return {output, 200};
+    response["frame_size"] = frame_size;
+    response["returned"] = returned;
+    response["pending"] = fifo->ring.frames();
+    response["partial_bytes"] = fifo->ring.partialBytes();
+    response["level"] = fifo->last_level;
+    response["max_level"] = fifo->max_level;
+    response["drains"] = fifo->drains;
+    response["bursts"] = fifo->bursts;
+    response["frames_total"] = fifo->frames;
+    response["errors"] = fifo->errors;
+    response["ring_full"] = fifo->ring_full;
+    response["drain_request_us"] = fifo->drain_request_us;
+    response["drain_complete_us"] = fifo->drain_complete_us;
+
+    return serializeResponse(request, response, 200);
 }
 
-std::pair<String, int> FlexibleI2C::handleReadRegister(std::map<String, String>& params) {
-    JsonDocument response;
+std::pair<String, int> FlexibleI2C::handleRemoveFifo(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("id") == params.end()) {
+        return errorResponse(request, "Missing id parameter", 400);
+    }
 
-    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() || params.find("reg_addr") == params.end()) {
-        response["success"] = false;
-        response["error"] = "Missing required parameters";
-        String output;
-        serializeJson(response, output);
-        return {output, 400};
+    uint16_t id = params["id"].toInt();
+    if (!removeFifo(id)) {
+        return errorResponse(request, "Unknown FIFO", 404);
     }
 
-    uint8_t bus_id = params["bus_id"].toInt();
-    uint8_t device_addr = strtol(params["device_addr"].c_str(), NULL, 16);
-    uint8_t reg_addr = strtol(params["reg_addr"].c_str(), NULL, 16);
+    JsonDocument response;
+    response["success"] = true;
+    response["id"] = id;
 
-    uint8_t value = readRegister(bus_id, device_addr, reg_addr);
-    bool success = (getLastError() == SUCCESS);
+    return serializeResponse(request, response, 200);
+}
 
-    response["success"] = success;
-    response["bus_id"] = bus_id;
-    response["device_addr"] = "0x" + String(device_addr, HEX);
-    response["reg_addr"] = "0x" + String(reg_addr, HEX);
+std::pair<String, int> FlexibleI2C::handleTrigger(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("data") == params.end()) {
+        return errorResponse(request, "Missing data parameter", 400);
+    }
 
-    if (success) {
-        response["value"] = value;
-        response["value_hex"] = "0x" + String(value, HEX);
+    uint8_t bus_mask = 0;
+    if (params.find("buses") != params.end()) {
+        for (uint8_t bus_id : parseHexBytes(params["buses"])) {
+            bus_mask |= bus_id <= 1 ? (1 << bus_id) : 0x80;
+        }
     } else {
-        response["error"] = getErrorString(getLastError());
+        bus_mask = 1;
+    }
+    uint8_t address = params.find("address") != params.end() ? strtol(params["address"].c_str(), NULL, 16) : GENERAL_CALL;
+    std::vector<uint8_t> data = parseHexBytes(params["data"]);
+    uint32_t settle_us = params.find("settle_us") != params.end() ? params["settle_us"].toInt() : 0;
+
+    std::vector<I2CSyncRead> reads;
+    if (params.find("reads") != params.end()) {
+        String list = params["reads"];
+        int start = 0;
+        while (start < (int)list.length()) {
+            int comma = list.indexOf(',', start);
+            if (comma < 0) {
+                comma = list.length();
+            }
+            String spec = list.substring(start, comma);
+            start = comma + 1;
+
+            int first = spec.indexOf(':');
+            int second = first >= 0 ? spec.indexOf(':', first + 1) : -1;
+            int third = second >= 0 ? spec.indexOf(':', second + 1) : -1;
+            if (third < 0) {
+                return errorResponse(request, "Invalid read: " + spec, 400);
+            }
+            long device_addr = strtol(spec.substring(first + 1, second).c_str(), NULL, 16);
+            reads.push_back(I2CSyncRead(spec.substring(0, first).toInt(),
+                                        device_addr > 0x7F ? (ADDR_10BIT | device_addr) : device_addr,
+                                        strtol(spec.substring(second + 1, third).c_str(), NULL, 16),
+                                        spec.substring(third + 1).toInt()));
+        }
     }
 
-    String output;
-    serializeJson(response, output);
-    return {output, success ? 200 : 500};
-}
+    uint32_t trigger_us[2] = { 0, 0 };
+    bool success = triggerAndRead(bus_mask, address, data.data(), data.size(), reads, settle_us, trigger_us);
+    if (!success && getLastError() == INVALID_PARAMETERS) {
+        return errorResponse(request, getErrorString(INVALID_PARAMETERS), 400);
+    }
 
-std::pair<String, int> FlexibleI2C::handleWriteRegister(std::map<String, String>& params) {
     JsonDocument response;
+    response["success"] = success;
+    setHex(request, response["address"], address);
+    JsonArray buses_array = response["buses"].to<JsonArray>();
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (bus_mask & (1 << bus_id)) {
+            buses_array.add(bus_id);
+        }
+    }
+    if (bus_mask == 0x03 && trigger_us[0] && trigger_us[1]) {
+        // Only the second bus's transfer separates the two trigger instants
+        response["skew_us"] = trigger_us[1] - trigger_us[0];
+    }
+    if (!reads.empty()) {
+        JsonArray samples_array = response["samples"].to<JsonArray>();
+        for (const auto& read : reads) {
+            JsonObject sample = samples_array.createNestedObject();
+            sample["bus_id"] = read.bus_id;
+            setDeviceAddress(request, sample, read.device_address);
+            setHex(request, sample["reg_addr"], read.reg_address);
+            sample["success"] = read.success;
+            if (read.success) {
+                setBytes(request, sample["data"], read.data, read.length);
+            }
+            sample["request_offset_us"] = read.request_offset_us;
+            sample["offset_us"] = read.offset_us;
+        }
+    }
+    if (!success) {
+        response["error"] = getErrorString(getLastError());
+    }
 
-    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
-        params.find("reg_addr") == params.end() || params.find("value") == params.end()) {
-        response["success"] = false;
-        response["error"] = "Missing required parameters";
-        String output;
-        serializeJson(response, output);
-        return {output, 400};
+    return serializeResponse(request, response, success ? 200 : errorStatus());
+}
+
+std::pair<String, int> FlexibleI2C::handleRecoverBus(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("bus_id") == params.end()) {
+        return errorResponse(request, "Missing bus_id parameter", 400);
     }
 
     uint8_t bus_id = params["bus_id"].toInt();
-    uint8_t device_addr = strtol(params["device_addr"].c_str(), NULL, 16);
-    uint8_t reg_addr = strtol(params["reg_addr"].c_str(), NULL, 16);
-    uint8_t value = strtol(params["value"].c_str(), NULL, 16);
-
-    bool success = writeRegister(bus_id, device_addr, reg_addr, value);
+    bool success = recoverBus(bus_id);
 
+    JsonDocument response;
     response["success"] = success;
     response["bus_id"] = bus_id;
-    response["device_addr"] = "0x" + String(device_addr, HEX);
-    response["reg_addr"] = "0x" + String(reg_addr, HEX);
-    response["value"] = "0x" + String(value, HEX);
+    response["recoveries"] = getBusStats(bus_id).recoveries;
 
     if (!success) {
         response["error"] = getErrorString(getLastError());
     }
 
-    String output;
-    serializeJson(response, output);
-    return {output, success ? 200 : 500};
+    return serializeResponse(request, response, success ? 200 : errorStatus());
 }
 
-std::pair<String, int> FlexibleI2C::handlePingDevice(std::map<String, String>& params) {
-    JsonDocument response;
-
-    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end()) {
-        response["success"] = false;
-        response["error"] = "Missing required parameters";
-        String output;
-        serializeJson(response, output);
-        return {output, 400};
+std::pair<String, int> FlexibleI2C::handleBeginSession(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("bus_id") == params.end() || params.find("lease_ms") == params.end()) {
+        return errorResponse(request, "Missing required parameters", 400);
     }
 
     uint8_t bus_id = params["bus_id"].toInt();
-    uint8_t device_addr = strtol(params["device_addr"].c_str(), NULL, 16);
+    uint16_t device_addr = params.find("device_addr") != params.end() ? parseDeviceAddress(params) : 0;
+    uint32_t lease_ms = params["lease_ms"].toInt();
 
-    bool present = isDevicePresent(bus_id, device_addr);
+    uint32_t session_id = beginSession(bus_id, device_addr, lease_ms, 0);
 
-    response["success"] = true;
+    JsonDocument response;
+    response["success"] = session_id != 0;
     response["bus_id"] = bus_id;
-    response["device_addr"] = "0x" + String(device_addr, HEX);
-    response["present"] = present;
+    setDeviceAddress(request, response, device_addr);
 
-    String output;
-    serializeJson(response, output);
-    return {output, 200};
+    if (session_id) {
+        response["session_id"] = session_id;
+        response["lease_ms"] = lease_ms;
+    } else {
+        response["error"] = getErrorString(getLastError());
+    }
+
+    return serializeResponse(request, response, session_id ? 200 : errorStatus());
 }
 
-std::pair<String, int> FlexibleI2C::handleReadBytes(std::map<String, String>& params) {
+std::pair<String, int> FlexibleI2C::handleEndSession(std::map<String, String>& params, const I2CRequest& request) {
+    if (params.find("session_id") == params.end()) {
+        return errorResponse(request, "Missing session_id parameter", 400);
+    }
+
+    uint32_t session_id = params["session_id"].toInt();
+    if (!endSession(session_id)) {
+        if (getLastError() == SESSION_BUSY) {
+            return errorResponse(request, "Session belongs to another task", 409);
+        }
+        return errorResponse(request, "Unknown or expired session", 404);
+    }
+
     JsonDocument response;
+    response["success"] = true;
+    response["session_id"] = session_id;
+    return serializeResponse(request, response, 200);
+}
 
-    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
-        params.find("reg_addr") == params.end() || params.find("length") == params.end()) {
-        response["success"] = false;
-        response["error"] = "Missing required parameters";
-        String output;
-        serializeJson(response, output);
-        return {output, 400};
+std::pair<String, int> FlexibleI2C::handleMetrics(std::map<String, String>& params) {
+    static const char* error_labels[I2CDeviceStats::ERROR_CODES] = {
+        "success", "timeout", "nack_address", "nack_data", "other", "bus_not_initialized", "invalid_parameters", "crc"
+    };
+
+    // Written straight into the response text; no JsonDocument in between. The reserve is
+    // capped: a large registry grows the string a family at a time instead of asking for
+    // one worst-case block up front
+    static const size_t RESERVE_MAX = 8192;
+    // One consistent snapshot; bus tasks record into these maps while the text is built
+    I2CBusLock::Guard state_guard(state_lock);
+    size_t reserve = 1024 + device_stats.size() * 1536;
+    String out;
+    out.reserve(reserve < RESERVE_MAX ? reserve : RESERVE_MAX);
+
+    out += "# HELP flexi2c_bus_transactions_total Transactions issued on the bus\n# TYPE flexi2c_bus_transactions_total counter\n";
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (isBusInitialized(bus_id)) {
+            out += "flexi2c_bus_transactions_total{bus=\"" + String(bus_id) + "\"} " + String(bus_stats[bus_id].transactions) + "\n";
+        }
+    }
+    out += "# HELP flexi2c_bus_bytes_total Bytes on the wire including address bytes\n# TYPE flexi2c_bus_bytes_total counter\n";
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (isBusInitialized(bus_id)) {
+            out += "flexi2c_bus_bytes_total{bus=\"" + String(bus_id) + "\"} " + String((unsigned long)bus_stats[bus_id].bytes) + "\n";
+        }
+    }
+    out += "# HELP flexi2c_bus_busy_seconds_total Time the bus spent in transactions\n# TYPE flexi2c_bus_busy_seconds_total counter\n";
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (isBusInitialized(bus_id)) {
+            out += "flexi2c_bus_busy_seconds_total{bus=\"" + String(bus_id) + "\"} " + String(bus_stats[bus_id].busy_us / 1e6, 6) + "\n";
+        }
+    }
+    out += "# HELP flexi2c_bus_recoveries_total Stuck-bus recoveries\n# TYPE flexi2c_bus_recoveries_total counter\n";
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (isBusInitialized(bus_id)) {
+            out += "flexi2c_bus_recoveries_total{bus=\"" + String(bus_id) + "\"} " + String(bus_stats[bus_id].recoveries) + "\n";
+        }
     }
 
-    uint8_t bus_id = params["bus_id"].toInt();
-    uint8_t device_addr = strtol(params["device_addr"].c_str(), NULL, 16);
-    uint8_t reg_addr = strtol(params["reg_addr"].c_str(), NULL, 16);
-    uint8_t length = params["length"].toInt();
+    out += "# HELP flexi2c_bus_session_hold_seconds_total Time buses were reserved by sessions\n# TYPE flexi2c_bus_session_hold_seconds_total counter\n";
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (isBusInitialized(bus_id)) {
+            out += "flexi2c_bus_session_hold_seconds_total{bus=\"" + String(bus_id) + "\"} " + String(bus_stats[bus_id].session_hold_us / 1e6, 6) + "\n";
+        }
+    }
 
-    if (length > 64) { // Reasonable limit
-        response["success"] = false;
-        response["error"] = "Length too large (max 64 bytes)";
-        String output;
-        serializeJson(response, output);
-        return {output, 400};
+    out += "# HELP flexi2c_bus_wakeups_total Idle power-down re-initializations\n# TYPE flexi2c_bus_wakeups_total counter\n";
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (isBusInitialized(bus_id)) {
+            out += "flexi2c_bus_wakeups_total{bus=\"" + String(bus_id) + "\"} " + String(bus_stats[bus_id].wakeups) + "\n";
+        }
     }
 
-    uint8_t data[64];
-    bool success = readBytes(bus_id, device_addr, reg_addr, data, length);
+    out += "# HELP flexi2c_bus_wake_seconds_total Time spent re-initializing powered-down buses\n# TYPE flexi2c_bus_wake_seconds_total counter\n";
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (isBusInitialized(bus_id)) {
+            out += "flexi2c_bus_wake_seconds_total{bus=\"" + String(bus_id) + "\"} " + String(bus_stats[bus_id].wake_us / 1e6, 6) + "\n";
+        }
+    }
 
-    response["success"] = success;
-    response["bus_id"] = bus_id;
-    response["device_addr"] = "0x" + String(device_addr, HEX);
-    response["reg_addr"] = "0x" + String(reg_addr, HEX);
-    response["length"] = length;
+    out += "# HELP flexi2c_device_transactions_total Transactions per device\n# TYPE flexi2c_device_transactions_total counter\n";
+    for (const auto& entry : device_stats) {
+        String labels = metricLabels(entry.first);
+        out += "flexi2c_device_transactions_total{" + labels + "} " + String(entry.second.transactions) + "\n";
+    }
+    out += "# HELP flexi2c_device_bytes_total Bytes on the wire per device\n# TYPE flexi2c_device_bytes_total counter\n";
+    for (const auto& entry : device_stats) {
+        String labels = metricLabels(entry.first);
+        out += "flexi2c_device_bytes_total{" + labels + "} " + String((unsigned long)entry.second.bytes) + "\n";
+    }
+    out += "# HELP flexi2c_device_errors_total Failed transactions per device by I2CError\n# TYPE flexi2c_device_errors_total counter\n";
+    for (const auto& entry : device_stats) {
+        String labels = metricLabels(entry.first);
+        for (uint8_t code = 1; code < I2CDeviceStats::ERROR_CODES; code++) {
+            if (entry.second.errors[code]) {
+                out += "flexi2c_device_errors_total{" + labels + ",error=\"" + error_labels[code] + "\"} " + String(entry.second.errors[code]) + "\n";
+            }
+        }
+    }
 
-    if (success) {
-        JsonArray data_array = response["data"].to<JsonArray>();
-        for (uint8_t i = 0; i < length; i++) {
-            data_array.add("0x" + String(data[i], HEX));
+    out += "# HELP flexi2c_device_health Moving success rate per device (1 = no recent errors)\n# TYPE flexi2c_device_health gauge\n";
+    for (const auto& entry : device_stats) {
+        out += "flexi2c_device_health{" + metricLabels(entry.first) + "} " + String(entry.second.health, 3) + "\n";
+    }
+    out += "# HELP flexi2c_device_quarantined 1 while calls to the device fail fast\n# TYPE flexi2c_device_quarantined gauge\n";
+    for (const auto& entry : device_stats) {
+        out += "flexi2c_device_quarantined{" + metricLabels(entry.first) + "} " + String(entry.second.quarantined ? 1 : 0) + "\n";
+    }
+    out += "# HELP flexi2c_device_fast_failures_total Calls refused while quarantined\n# TYPE flexi2c_device_fast_failures_total counter\n";
+    for (const auto& entry : device_stats) {
+        if (entry.second.quarantines) {
+            out += "flexi2c_device_fast_failures_total{" + metricLabels(entry.first) + "} " + String(entry.second.fast_failures) + "\n";
+        }
+    }
+
+    // Per-bus histograms are the sum of the device histograms on that bus
+    I2CDeviceStats bus_latency[2];
+    out += "# HELP flexi2c_device_latency_seconds Transaction latency per device\n# TYPE flexi2c_device_latency_seconds histogram\n";
+    for (const auto& entry : device_stats) {
+        uint8_t bus_id = (entry.first >> 16) > 1 ? 1 : entry.first >> 16;
+        String labels = metricLabels(entry.first);
+        uint32_t cumulative = 0;
+        for (uint8_t bucket = 0; bucket < I2CDeviceStats::LATENCY_BUCKETS; bucket++) {
+            cumulative += entry.second.latency_buckets[bucket];
+            bus_latency[bus_id].latency_buckets[bucket] += entry.second.latency_buckets[bucket];
+            String le = bucket < I2CDeviceStats::LATENCY_BUCKETS - 1
+                ? String(I2CDeviceStats::latency_bounds_us[bucket] / 1e6, 6) : String("+Inf");
+            out += "flexi2c_device_latency_seconds_bucket{" + labels + ",le=\"" + le + "\"} " + String(cumulative) + "\n";
+        }
+        bus_latency[bus_id].latency_sum_us += entry.second.latency_sum_us;
+        bus_latency[bus_id].transactions += cumulative;
+        out += "flexi2c_device_latency_seconds_sum{" + labels + "} " + String(entry.second.latency_sum_us / 1e6, 6) + "\n";
+        out += "flexi2c_device_latency_seconds_count{" + labels + "} " + String(cumulative) + "\n";
+    }
+    out += "# HELP flexi2c_bus_latency_seconds Transaction latency per bus\n# TYPE flexi2c_bus_latency_seconds histogram\n";
+    for (uint8_t bus_id = 0; bus_id <= 1; bus_id++) {
+        if (!isBusInitialized(bus_id)) {
+            continue;
         }
+        String labels = "bus=\"" + String(bus_id) + "\"";
+        uint32_t cumulative = 0;
+        for (uint8_t bucket = 0; bucket < I2CDeviceStats::LATENCY_BUCKETS; bucket++) {
+            cumulative += bus_latency[bus_id].latency_buckets[bucket];
+            String le = bucket < I2CDeviceStats::LATENCY_BUCKETS - 1
+                ? String(I2CDeviceStats::latency_bounds_us[bucket] / 1e6, 6) : String("+Inf");
+            out += "flexi2c_bus_latency_seconds_bucket{" + labels + ",le=\"" + le + "\"} " + String(cumulative) + "\n";
+        }
+        out += "flexi2c_bus_latency_seconds_sum{" + labels + "} " + String(bus_latency[bus_id].latency_sum_us / 1e6, 6) + "\n";
+        out += "flexi2c_bus_latency_seconds_count{" + labels + "} " + String(cumulative) + "\n";
+    }
+
+    out += "# HELP flexi2c_device_responsive Whether the device answered its last scan\n# TYPE flexi2c_device_responsive gauge\n";
+    for (const auto& device : known_devices) {
+        out += "flexi2c_device_responsive{bus=\"" + String(device.bus_id) + "\",address=\"0x" + String(device.address, HEX) +
+               "\",name=\"" + device.device_name + "\"} " + (device.responsive ? "1" : "0") + "\n";
+    }
+
+    // The library has no request queues; buffered deferred writes are its only backlog
+    out += "# HELP flexi2c_pending_writes Deferred register bytes waiting to be flushed\n# TYPE flexi2c_pending_writes gauge\n";
+    for (const auto& entry : pending_writes) {
+        out += "flexi2c_pending_writes{" + metricLabels(entry.first) + "} " + String((unsigned long)entry.second.bytes) + "\n";
+    }
+    out += "# HELP flexi2c_deferred_write_errors_total Flushes of deferred writes that failed\n# TYPE flexi2c_deferred_write_errors_total counter\n";
+    out += "flexi2c_deferred_write_errors_total " + String(deferred_write_errors) + "\n";
+    out += "# HELP flexi2c_periodic_reads Registered periodic reads\n# TYPE flexi2c_periodic_reads gauge\n";
+    out += "flexi2c_periodic_reads " + String((unsigned long)getPeriodicReads().size()) + "\n";
+
+    return {out, 200};
+}
+
+uint16_t FlexibleI2C::parseDeviceAddress(std::map<String, String>& params) {
+    long address = strtol(params["device_addr"].c_str(), NULL, 16);
+    if (address < 0 || address > 0x3FF) {
+        return 0; // rejected by validateBusAndAddress
+    }
+    bool ten_bit = address > 127 || (params.find("ten_bit") != params.end() && params["ten_bit"].toInt() != 0);
+    return ten_bit ? (ADDR_10BIT | address) : address;
+}
+
+bool FlexibleI2C::parseOperation(const String& spec, bool ten_bit, I2COperation& operation) {
+    // name[:length][*count][@stretch_us]
+    String name = spec;
+    long length = -1;
+    long count = 1;
+    long stretch_us = 0;
+
+    int at = name.indexOf('@');
+    if (at >= 0) {
+        stretch_us = name.substring(at + 1).toInt();
+        name = name.substring(0, at);
+    }
+    int star = name.indexOf('*');
+    if (star >= 0) {
+        count = name.substring(star + 1).toInt();
+        name = name.substring(0, star);
+    }
+    int colon = name.indexOf(':');
+    if (colon >= 0) {
+        length = name.substring(colon + 1).toInt();
+        name = name.substring(0, colon);
+    }
+    if (count <= 0 || stretch_us < 0 || length == 0 || length > 0xFFFF) {
+        return false;
+    }
+
+    if (name == "readRegister") {
+        operation = I2COperation::readRegister(length > 0 ? length : 1, ten_bit);
+    } else if (name == "readRegister16") {
+        operation = I2COperation::readRegister(2, ten_bit);
+    } else if (name == "readBytes") {
+        operation = I2COperation::readBytes(length > 0 ? length : 1, ten_bit);
+    } else if (name == "writeRegister") {
+        operation = I2COperation::writeRegister(length > 0 ? length : 1, ten_bit);
+    } else if (name == "writeBytes") {
+        operation = I2COperation::writeBytes(length > 0 ? length : 1, ten_bit);
+    } else if (name == "ping") {
+        operation = I2COperation::ping(ten_bit);
+    } else if (name == "scan") {
+        operation = I2COperation::scan(length > 0 ? length : 126);
+    } else if (name == "scan10") {
+        // Every address probed; groups whose header is NACKed finish sooner
+        operation = I2COperation::scan(length > 0 ? length : 1024, true);
     } else {
-        response["error"] = getErrorString(getLastError());
+        return false;
     }
 
-    String output;
-    serializeJson(response, output);
-    return {output, success ? 200 : 500};
+    operation.count *= count;
+    operation.stretch_us = stretch_us;
+    return true;
 }
 
-std::pair<String, int> FlexibleI2C::handleWriteBytes(std::map<String, String>& params) {
-    JsonDocument response;
+String FlexibleI2C::metricLabels(uint32_t device_key) {
+    uint16_t address = device_key & 0xFFFF;
+    String labels = "bus=\"" + String(device_key >> 16) + "\",address=\"0x" + String(address & ~ADDR_10BIT, HEX) + "\"";
+    if (isTenBitAddress(address)) {
+        labels += ",ten_bit=\"1\"";
+    }
+    return labels;
+}
 
-    if (params.find("bus_id") == params.end() || params.find("device_addr") == params.end() ||
-        params.find("reg_addr") == params.end() || params.find("data") == params.end()) {
-        response["success"] = false;
-        response["error"] = "Missing required parameters";
-        String output;
-        serializeJson(response, output);
-        return {output, 400};
+JsonDocument FlexibleI2C::deviceInfoToJson(const I2CDeviceInfo& device, const I2CRequest& request) {
+    JsonDocument doc;
+    doc["bus_id"] = device.bus_id;
+    uint16_t address = device.address & ~ADDR_10BIT;
+    doc["address"] = address;
+    if (!request.binary) {
+        doc["address_hex"] = "0x" + String(address, HEX);
+    }
+    if (isTenBitAddress(device.address)) {
+        doc["ten_bit"] = true;
+    }
+    doc["name"] = device.device_name;
+    doc["responsive"] = device.responsive;
+    doc["last_seen"] = device.last_seen;
+    doc["last_seen_us"] = device.last_seen_us;
+
+    auto it = device_stats.find(deviceKey(device.bus_id, device.address));
+    if (it != device_stats.end()) {
+        const I2CDeviceStats& stats = it->second;
+        doc["health"] = stats.health;
+        doc["quarantined"] = stats.quarantined;
+        if (stats.quarantines) {
+            JsonObject quarantine_obj = doc["quarantine"].to<JsonObject>();
+            quarantine_obj["count"] = stats.quarantines;
+            if (stats.quarantined) {
+                quarantine_obj["since_ms"] = millis() - stats.quarantined_at;
+                quarantine_obj["next_probe_ms"] = (long)(stats.next_probe - millis()) > 0 ? stats.next_probe - millis() : 0;
+            }
+            quarantine_obj["probes"] = stats.probes;
+            quarantine_obj["fast_failures"] = stats.fast_failures;
+        }
     }
+    return doc;
+}
 
-    uint8_t bus_id = params["bus_id"].toInt();
-    uint8_t device_addr = strtol(params["device_addr"].c_str(), NULL, 16);
-    uint8_t reg_addr = strtol(params["reg_addr"].c_str(), NULL, 16);
+JsonDocument FlexibleI2C::busConfigToJson(uint8_t bus_id) {
+    JsonDocument doc;
+    auto it = buses.find(bus_id);
+    if (it != buses.end()) {
+        doc["bus_id"] = bus_id;
+        doc["sda_pin"] = it->second.sda_pin;
+        doc["scl_pin"] = it->second.scl_pin;
+        doc["frequency"] = it->second.frequency;
+        doc["initialized"] = it->second.initialized;
+        doc["idle_timeout_ms"] = it->second.idle_timeout_ms;
+    }
+    return doc;
+}
+
+void FlexibleI2C::appendMsgPackString(String& out, const char* str) {
+    size_t length = strlen(str);
+    out += (char)(0xa0 | (length & 0x1F)); // fixstr, keys are all shorter than 32
+    out.concat(str, length);
+}
+
+void FlexibleI2C::appendMsgPackUint(String& out, uint32_t value) {
+    out += (char)0xce;
+    out += (char)(value >> 24);
+    out += (char)((value >> 16) & 0xFF);
+    out += (char)((value >> 8) & 0xFF);
+    out += (char)(value & 0xFF);
+}
 
+std::vector<uint8_t> FlexibleI2C::parseHexBytes(const String& data_str) {
     // Parse comma-separated hex values
-    String data_str = params["data"];
     std::vector<uint8_t> data_bytes;
 
     int start = 0;
     int end = data_str.indexOf(',');
 
-    while (end >= 0 || start < data_str.length()) {
+    while (end >= 0 || start < (int)data_str.length()) {
         String byte_str = (end >= 0) ? data_str.substring(start, end) : data_str.substring(start);
         byte_str.trim();
 
@@ -737,51 +4720,61 @@ std::pair<String, int> FlexibleI2C::handleWriteBytes(std::map<String, String>& p
         end = data_str.indexOf(',', start);
     }
 
-    if (data_bytes.empty()) {
-        response["success"] = false;
-        response["error"] = "No valid data bytes provided";
-        String output;
-        serializeJson(response, output);
-        return {output, 400};
-    }
+    return data_bytes;
+}
 
-    bool success = writeBytes(bus_id, device_addr, reg_addr, data_bytes.data(), data_bytes.size());
+int FlexibleI2C::errorStatus() const {
+    // 409 tells the client to retry once the session holding the device has ended
+    return last_error == SESSION_BUSY ? 409 : 500;
+}
 
-    response["success"] = success;
-    response["bus_id"] = bus_id;
-    response["device_addr"] = "0x" + String(device_addr, HEX);
-    response["reg_addr"] = "0x" + String(reg_addr, HEX);
-    response["bytes_written"] = data_bytes.size();
+std::pair<String, int> FlexibleI2C::errorResponse(const I2CRequest& request, const String& message, int status) {
+    JsonDocument response;
+    response["success"] = false;
+    response["error"] = message;
+    return serializeResponse(request, response, status);
+}
 
-    if (!success) {
-        response["error"] = getErrorString(getLastError());
+std::pair<String, int> FlexibleI2C::negotiate(std::map<String, String>& params, EndpointHandler handler) {
+    I2CRequest request;
+    auto it = params.find("format");
+    request.binary = (it != params.end() && it->second == "msgpack");
+
+    // The device calls a handler makes take no request argument, so the session the request
+    // belongs to is looked up by the task serving it; handlers on other tasks keep their own
+    auto session_it = params.find("session_id");
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        http_sessions[task] = session_it != params.end() ? session_it->second.toInt() : 0;
     }
 
-    String output;
-    serializeJson(response, output);
-    return {output, success ? 200 : 500};
+    onResponseContentType(request.binary ? "application/msgpack" : "application/json");
+    std::pair<String, int> result = (this->*handler)(params, request);
+
+    {
+        I2CBusLock::Guard state_guard(state_lock);
+        http_sessions.erase(task);
+    }
+    return result;
 }
 
-JsonDocument FlexibleI2C::deviceInfoToJson(const I2CDeviceInfo& device) {
-    JsonDocument doc;
-    doc["bus_id"] = device.bus_id;
-    doc["address"] = device.address;
-    doc["address_hex"] = "0x" + String(device.address, HEX);
-    doc["name"] = device.device_name;
-    doc["responsive"] = device.responsive;
-    doc["last_seen"] = device.last_seen;
-    return doc;
+bool FlexibleI2C::httpSession(uint32_t& session_id) {
+    I2CBusLock::Guard state_guard(state_lock);
+    auto it = http_sessions.find(xTaskGetCurrentTaskHandle());
+    if (it == http_sessions.end()) {
+        return false;
+    }
+    session_id = it->second;
+    return true;
 }
 
-JsonDocument FlexibleI2C::busConfigToJson(uint8_t bus_id) {
-    JsonDocument doc;
-    auto it = buses.find(bus_id);
-    if (it != buses.end()) {
-        doc["bus_id"] = bus_id;
-        doc["sda_pin"] = it->second.sda_pin;
-        doc["scl_pin"] = it->second.scl_pin;
-        doc["frequency"] = it->second.frequency;
-        doc["initialized"] = it->second.initialized;
+std::pair<String, int> FlexibleI2C::serializeResponse(const I2CRequest& request, JsonDocument& response, int status) {
+    String output;
+    if (request.binary) {
+        serializeMsgPack(response, output);
+    } else {
+        serializeJson(response, output);
     }
-    return doc;
+    return {output, status};
 }
\ No newline at end of file
@@ -5,30 +5,219 @@
 #include <Wire.h>
 #include <FlexibleEndpoints.h>
 #include <ArduinoJson.h>
+#include "I2CCrc8.h"
+#include "I2CTarget.h"
+#include "I2CTimingModel.h"
+#include "I2CAsync.h"
+#include "I2CFifo.h"
+#include "I2CSampleStore.h"
+#include "I2CFlashLog.h"
+#include "I2CRegisterImage.h"
+#include "I2CBusLock.h"
 #include <vector>
 #include <map>
 
+// Accepted by every built-in JSON endpoint; "msgpack" switches the response to MessagePack
+#define FLEXIBLE_I2C_FORMAT_PARAM STR_PARAM("format", "Response format: json (default) or msgpack")
+// Accepted by device operations; lets the request through an open session
+#define FLEXIBLE_I2C_TEN_BIT_PARAM INT_PARAM("ten_bit", "1 if device_addr is a 10-bit address (implied above 0x7F)")
+#define FLEXIBLE_I2C_SESSION_PARAM INT_PARAM("session_id", "Session this request belongs to")
+
 struct I2CBusConfig {
     uint8_t sda_pin;
     uint8_t scl_pin;
     uint32_t frequency;
     TwoWire* wire_instance;
     bool initialized;
+    uint32_t idle_timeout_ms;     // 0 keeps the peripheral running
+    bool powered_down;            // ended for idleness; re-initialized on next use
+    unsigned long last_activity;
 
-    I2CBusConfig() : sda_pin(255), scl_pin(255), frequency(100000), wire_instance(nullptr), initialized(false) {}
+    I2CBusConfig() : sda_pin(255), scl_pin(255), frequency(100000), wire_instance(nullptr), initialized(false),
+        idle_timeout_ms(0), powered_down(false), last_activity(0) {}
     I2CBusConfig(uint8_t sda, uint8_t scl, uint32_t freq = 100000)
-        : sda_pin(sda), scl_pin(scl), frequency(freq), wire_instance(nullptr), initialized(false) {}
+        : sda_pin(sda), scl_pin(scl), frequency(freq), wire_instance(nullptr), initialized(false),
+          idle_timeout_ms(0), powered_down(false), last_activity(0) {}
 };
 
 struct I2CDeviceInfo {
-    uint8_t address;
+    uint16_t address;            // 7-bit, or 10-bit with FlexibleI2C::ADDR_10BIT set
     uint8_t bus_id;
     String device_name;
     bool responsive;
     unsigned long last_seen;
+    uint64_t last_seen_us;       // FlexibleI2C::timestampUs()
+
+    I2CDeviceInfo(uint16_t addr, uint8_t bus, String name = "")
+        : address(addr), bus_id(bus), device_name(name), responsive(false), last_seen(0), last_seen_us(0) {}
+};
+
+struct I2CPeriodicRead {
+    uint16_t id;
+    uint8_t bus_id;
+    uint16_t device_address;
+    uint8_t reg_address;
+    uint8_t length;              // 1..4 bytes, big-endian
+    bool is_signed;
+    bool logged;                  // samples also go to the flash log
+    uint32_t fastest_interval_ms; // used while the value is changing
+    uint32_t slowest_interval_ms; // approached while the value stays within the deadband
+    uint32_t deadband;
+    uint32_t interval_ms;         // current effective interval
+    unsigned long next_due;
+    unsigned long created_at;
+    int32_t last_value;
+    int32_t reference_value;      // value at the last change, compared against the deadband
+    bool has_value;
+    uint32_t samples;
+    uint32_t changes;
+    uint32_t errors;
+    // FlexibleI2C::timestampUs() of the last attempt: read issued and completed
+    uint64_t request_us;
+    uint64_t complete_us;
+    uint32_t latency_max_us;
+    uint64_t latency_sum_us;
+    // Deviation of the request-to-request interval from the scheduled one
+    uint32_t jitter_max_us;
+    uint64_t jitter_sum_us;
+    uint32_t jitter_count;
 
-    I2CDeviceInfo(uint8_t addr, uint8_t bus, String name = "")
-        : address(addr), bus_id(bus), device_name(name), responsive(false), last_seen(0) {}
+    I2CPeriodicRead()
+        : id(0), bus_id(0), device_address(0), reg_address(0), length(1), is_signed(false),
+          logged(false), fastest_interval_ms(100), slowest_interval_ms(10000), deadband(0), interval_ms(100),
+          next_due(0), created_at(0), last_value(0), reference_value(0), has_value(false),
+          samples(0), changes(0), errors(0), request_us(0), complete_us(0), latency_max_us(0),
+          latency_sum_us(0), jitter_max_us(0), jitter_sum_us(0), jitter_count(0) {}
+};
+
+struct I2CBusStats {
+    static const uint8_t WINDOW_SLOTS = 60; // one-second slots for sliding windows
+
+    uint32_t transactions;
+    uint32_t errors;
+    uint64_t bytes;        // bytes on the wire, address bytes included
+    uint64_t busy_us;      // measured from transaction start to end
+    uint64_t wire_us;      // estimated from bus frequency and byte counts
+    uint32_t window_busy_us[WINDOW_SLOTS];
+    uint32_t window_bytes[WINDOW_SLOTS];
+    uint32_t window_second; // absolute second of the newest slot
+    uint32_t recoveries;
+    uint64_t recovery_us;
+    uint32_t sessions;
+    uint32_t sessions_expired;  // ended by lease timeout instead of endSession()
+    uint64_t session_hold_us;
+    uint32_t session_max_hold_us;
+    uint64_t session_wait_us;   // time other callers spent queued behind sessions
+    uint32_t session_rejects;   // HTTP and update() calls turned away by another session
+    uint32_t power_downs;
+    uint32_t wakeups;
+    uint64_t wake_us;           // total re-initialization latency
+    uint32_t last_wake_us;
+    uint32_t max_wake_us;
+
+    I2CBusStats() { reset(); }
+    void reset() {
+        power_downs = 0;
+        wakeups = 0;
+        wake_us = 0;
+        last_wake_us = 0;
+        max_wake_us = 0;
+        sessions = 0;
+        sessions_expired = 0;
+        session_hold_us = 0;
+        session_max_hold_us = 0;
+        session_wait_us = 0;
+        session_rejects = 0;
+        transactions = 0;
+        errors = 0;
+        recoveries = 0;
+        recovery_us = 0;
+        bytes = 0;
+        busy_us = 0;
+        wire_us = 0;
+        memset(window_busy_us, 0, sizeof(window_busy_us));
+        memset(window_bytes, 0, sizeof(window_bytes));
+        window_second = millis() / 1000;
+    }
+};
+
+struct I2CDeviceStats {
+    static const uint8_t ERROR_CODES = 8;     // indexed by FlexibleI2C::I2CError
+    static const uint8_t LATENCY_BUCKETS = 10; // last bucket is +Inf
+    static const uint32_t latency_bounds_us[LATENCY_BUCKETS - 1];
+
+    uint32_t transactions;
+    uint64_t bytes;
+    uint32_t errors[ERROR_CODES];
+    uint32_t latency_buckets[LATENCY_BUCKETS];
+    uint64_t latency_sum_us;
+
+    // Health: moving success rate over recent transactions, 1.0 with no recent errors
+    float health;
+    bool quarantined;
+    uint32_t quarantines;
+    uint32_t fast_failures;       // calls refused while quarantined
+    uint32_t probes;              // pings sent while quarantined
+    unsigned long quarantined_at;
+    unsigned long next_probe;
+
+    I2CDeviceStats()
+        : transactions(0), bytes(0), latency_sum_us(0), health(1.0f), quarantined(false), quarantines(0),
+          fast_failures(0), probes(0), quarantined_at(0), next_probe(0) {
+        memset(errors, 0, sizeof(errors));
+        memset(latency_buckets, 0, sizeof(latency_buckets));
+    }
+
+    void addLatency(uint32_t elapsed_us) {
+        uint8_t bucket = 0;
+        while (bucket < LATENCY_BUCKETS - 1 && elapsed_us > latency_bounds_us[bucket]) {
+            bucket++;
+        }
+        latency_buckets[bucket]++;
+        latency_sum_us += elapsed_us;
+    }
+};
+
+// One completed transaction in the trace, timestamped with FlexibleI2C::timestampUs()
+struct I2CTraceEntry {
+    uint64_t request_us;
+    uint64_t complete_us;
+    uint16_t device_address;
+    uint8_t bus_id;
+    uint8_t result;              // FlexibleI2C::I2CError
+    uint16_t bytes;              // on the wire, including address bytes
+};
+
+struct I2CSession {
+    uint32_t id;                 // 0 when no session is active
+    uint16_t device_address;     // 0 reserves the whole bus
+    TaskHandle_t owner_task;     // nullptr for sessions opened over HTTP (owned by session_id)
+    unsigned long expires_at;
+    uint32_t started_us;
+    SemaphoreHandle_t gate;      // held for the life of the session; waiters queue on it
+
+    I2CSession() : id(0), device_address(0), owner_task(nullptr), expires_at(0), started_us(0), gate(nullptr) {}
+};
+
+// A result read back after a synchronized trigger. Offsets are relative to the trigger's
+// completion on the device's bus, so samples from both buses share one time base.
+struct I2CSyncRead {
+    static const uint8_t DATA_MAX = 8;
+
+    uint8_t bus_id;
+    uint16_t device_address;
+    uint8_t reg_address;
+    uint8_t length;
+    uint8_t data[DATA_MAX];
+    bool success;
+    int32_t request_offset_us;   // read started
+    int32_t offset_us;           // read completed
+
+    I2CSyncRead(uint8_t bus_id = 0, uint16_t device_address = 0, uint8_t reg_address = 0, uint8_t length = 1)
+        : bus_id(bus_id), device_address(device_address), reg_address(reg_address), length(length),
+          success(false), request_offset_us(0), offset_us(0) {
+        memset(data, 0, sizeof(data));
+    }
 };
 
 class FlexibleI2C {
@@ -44,29 +233,243 @@ public:
     bool isBusInitialized(uint8_t bus_id);
     TwoWire* getBus(uint8_t bus_id);
 
-    // Device scanning and management
+    // Wire-time planning with the same model the bus statistics use. frequency 0 takes the
+    // bus's configured frequency (100 kHz for an uninitialized bus).
+    I2CTimingEstimate estimateTiming(uint8_t bus_id, const I2COperation& operation, uint32_t frequency = 0);
+    I2CTimingEstimate estimateTiming(uint8_t bus_id, const std::vector<I2COperation>& batch, uint32_t frequency = 0);
+
+    // Idle power-down: after idle_ms without traffic (checked in update()) the peripheral is
+    // ended and its pins parked; getBus() transparently re-initializes it on next use. Code
+    // driving Wire directly on such a bus must use BusGuard rather than a plain lock Guard.
+    void setIdlePowerDown(uint8_t bus_id, uint32_t idle_ms);
+    bool isBusPoweredDown(uint8_t bus_id);
+
+    // Target (slave) mode: serve an emulated register file on Wire/Wire1 instead of driving the bus
+    bool initTarget(uint8_t bus_id, I2CTarget& target, uint8_t address, uint8_t sda_pin, uint8_t scl_pin, uint32_t frequency = 400000);
+    I2CTarget* getTarget(uint8_t bus_id);
+
+    // 10-bit addresses are passed to every device API with this flag set, e.g. ADDR_10BIT | 0x2A5.
+    // Plain values 1..127 stay 7-bit addresses.
+    static const uint16_t ADDR_10BIT = 0x8000;
+    static bool isTenBitAddress(uint16_t address) { return address & ADDR_10BIT; }
+    static bool isValidAddress(uint16_t address);
+
+    // Device scanning and management. scanBus() walks the 7-bit space only; the 10-bit space is
+    // scanned on request, a few probes per update() call, so it costs no bus time unless started.
     std::vector<uint8_t> scanBus(uint8_t bus_id);
+    bool beginTenBitScan(uint8_t bus_id, uint8_t probes_per_update = 8);
+    bool isTenBitScanRunning(uint8_t bus_id);
     std::vector<I2CDeviceInfo> getAllDevices();
-    bool isDevicePresent(uint8_t bus_id, uint8_t address);
+    I2CDeviceInfo* findDevice(uint8_t bus_id, uint16_t address);
+
+    // Monotonic change counters for conditional polling. The registry version moves whenever
+    // a listed field changes: a device is added, seen again (last_seen), changes
+    // responsiveness or enters quarantine. Health is a live gauge and does not move it.
+    uint32_t getRegistryVersion() const { return registry_version; }
+    uint32_t getBusConfigVersion() const { return bus_config_version; }
+    bool isDevicePresent(uint8_t bus_id, uint16_t address);
 
     // Basic I2C operations
-    bool writeRegister(uint8_t bus_id, uint8_t device_address, uint8_t reg_address, uint8_t data);
-    bool writeRegister16(uint8_t bus_id, uint8_t device_address, uint8_t reg_address, uint16_t data);
-    bool writeBytes(uint8_t bus_id, uint8_t device_address, uint8_t reg_address, const uint8_t* data, size_t length);
+    bool writeRegister(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t data);
+    bool writeRegister16(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint16_t data);
+    bool writeBytes(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, const uint8_t* data, size_t length);
+
+    uint8_t readRegister(uint8_t bus_id, uint16_t device_address, uint8_t reg_address);
+    uint16_t readRegister16(uint8_t bus_id, uint16_t device_address, uint8_t reg_address);
+    bool readBytes(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t* data, size_t length);
+
+    // SMBus protocol layer (word data is little-endian, blocks carry a length byte).
+    // With use_pec the CRC-8 packet error code is appended on writes and verified on reads.
+    static const uint8_t SMBUS_BLOCK_MAX = 32;
+    bool smbusWriteWord(uint8_t bus_id, uint16_t device_address, uint8_t command, uint16_t value, bool use_pec = false);
+    bool smbusReadWord(uint8_t bus_id, uint16_t device_address, uint8_t command, uint16_t& value, bool use_pec = false);
+    bool smbusBlockWrite(uint8_t bus_id, uint16_t device_address, uint8_t command, const uint8_t* data, uint8_t length, bool use_pec = false);
+    // length is the buffer capacity on entry and the received byte count on return
+    bool smbusBlockRead(uint8_t bus_id, uint16_t device_address, uint8_t command, uint8_t* data, uint8_t& length, bool use_pec = false);
+    bool smbusProcessCall(uint8_t bus_id, uint16_t device_address, uint8_t command, uint16_t value, uint16_t& result, bool use_pec = false);
+
+    // Word+CRC payloads (Sensirion style): each 16-bit big-endian word is followed by its CRC-8.
+    // The command is sent, delay_ms (the command's execution time) passes with the bus free,
+    // then the words are read. With retries > 0 a failed CRC repeats command and read, and all
+    // words come from the last read; failed_words lists the words that did not verify.
+    static const size_t CRC_WORDS_MAX = 42; // 126 bytes, within the 128-byte Wire buffer
+    bool readWordsCrc(uint8_t bus_id, uint16_t device_address, uint16_t command, uint16_t* words, size_t count,
+                      std::vector<size_t>* failed_words = nullptr, uint8_t retries = 0, uint16_t delay_ms = 0,
+                      const I2CCrc8& crc8 = I2CCrc8::sensirion());
+    static size_t verifyWordsCrc(const uint8_t* raw, size_t count, uint16_t* words, std::vector<size_t>* failed_words,
+                                 const I2CCrc8& crc8 = I2CCrc8::sensirion());
+
+    // General call and broadcast triggers: one frame reaches every listening target, so e.g.
+    // ADC conversions start together instead of a frame time apart per device. address is
+    // GENERAL_CALL or a broadcast (all-call) address the targets share; bus_mask selects
+    // the buses (bit 0 = bus 0). Frames for both buses are loaded before either is sent and
+    // then go out back to back; trigger_us receives each bus's completion time. Triggers
+    // count in the bus statistics and trace only, never as a device.
+    static const uint8_t GENERAL_CALL = 0x00;
+    bool generalCall(uint8_t bus_id, const uint8_t* data, size_t length);
+    bool broadcastTrigger(uint8_t bus_mask, uint8_t address, const uint8_t* data, size_t length, uint32_t* trigger_us = nullptr);
+    // Trigger, wait settle_us (e.g. the conversion time) from each bus's trigger, then read
+    // every entry back in order. Returns false if the trigger or any read failed.
+    bool triggerAndRead(uint8_t bus_mask, uint8_t address, const uint8_t* data, size_t length,
+                        std::vector<I2CSyncRead>& reads, uint32_t settle_us = 0, uint32_t* trigger_us = nullptr);
+
+    // Per-bus transaction lock, taken for every FlexibleI2C transaction. Hold a Guard on it
+    // around code that uses the TwoWire instance directly (see I2CBusLock.h); contention and
+    // wait times are reported in /getI2CBusStats.
+    I2CBusLock& getBusLock(uint8_t bus_id) { return bus_locks[bus_id > 1 ? 1 : bus_id]; }
+
+    // The bus lock plus idle power-down awareness, for foreign Wire code on a bus with
+    // setIdlePowerDown(): wakes the peripheral and counts the section as bus activity, so
+    // update() never ends it between the sections. False if the lock timed out or the bus
+    // is not initialized.
+    //   FlexibleI2C::BusGuard guard(i2c, 0);
+    //   if (guard) { display.display(); }
+    class BusGuard {
+    public:
+        BusGuard(FlexibleI2C& i2c, uint8_t bus_id, uint32_t timeout_ms = I2CBusLock::WAIT_FOREVER);
+        ~BusGuard();
+        BusGuard(const BusGuard&) = delete;
+        BusGuard& operator=(const BusGuard&) = delete;
 
-    uint8_t readRegister(uint8_t bus_id, uint8_t device_address, uint8_t reg_address);
-    uint16_t readRegister16(uint8_t bus_id, uint8_t device_address, uint8_t reg_address);
-    bool readBytes(uint8_t bus_id, uint8_t device_address, uint8_t reg_address, uint8_t* data, size_t length);
+        TwoWire* getWire() const { return wire; }
+        explicit operator bool() const { return wire != nullptr; }
 
-    // Raw I2C operations
-    bool beginTransmission(uint8_t bus_id, uint8_t address);
+    private:
+        FlexibleI2C& i2c;
+        uint8_t bus_id;
+        I2CBusLock::Guard guard;
+        TwoWire* wire;
+    };
+
+    // Raw I2C operations. The calling task holds the bus lock from beginTransmission() until a
+    // STOP or a failed call ends the transaction; another task's calls wait for it.
+    bool beginTransmission(uint8_t bus_id, uint16_t address);
     bool endTransmission(uint8_t bus_id, bool stop = true);
-    bool requestFrom(uint8_t bus_id, uint8_t address, uint8_t quantity, bool stop = true);
+    bool requestFrom(uint8_t bus_id, uint16_t address, uint8_t quantity, bool stop = true);
+
+    // Monotonic microseconds since boot (esp_timer on the target, micros() widened to 64 bits
+    // elsewhere). Sample and trace timestamps use this clock, so they never wrap.
+    static uint64_t timestampUs();
+
+    // Transaction trace: the last depth transactions with request and completion times
+    void setTraceDepth(size_t depth);   // 0 disables (the default)
+    size_t getTraceDepth() const { return trace.size(); }
+    std::vector<I2CTraceEntry> getTrace();         // oldest first
+
+    // Bus utilization metering
+    I2CBusStats getBusStats(uint8_t bus_id);  // a copy
+    void resetBusStats(uint8_t bus_id);
+    // Busy fraction over the last window_seconds completed seconds (1..60)
+    float getBusUtilization(uint8_t bus_id, uint8_t window_seconds);
+    uint32_t getBusBytesPerSecond(uint8_t bus_id, uint8_t window_seconds);
+    std::map<uint32_t, I2CDeviceStats> getDeviceStats();  // a copy
+
+    // Device health and quarantine. Every transaction moves a device's health 1/8 of the way
+    // toward 1 (success) or 0 (error). Below threshold the device is quarantined: its calls
+    // fail at once with QUARANTINED instead of costing a timeout each, and update() pings it
+    // every probe_interval_ms. The first acknowledged ping (or scan hit) reinstates it.
+    // A threshold of 0 (the default) turns quarantine off.
+    void setQuarantinePolicy(float threshold, uint32_t probe_interval_ms = 1000);
+    float getDeviceHealth(uint8_t bus_id, uint16_t address);
+    bool isDeviceQuarantined(uint8_t bus_id, uint16_t address);
+    void reinstateDevice(uint8_t bus_id, uint16_t address);
+
+    // Release a stuck bus: clock SCL until the target lets go of SDA, send STOP, re-initialize
+    bool recoverBus(uint8_t bus_id);
+
+    // Exclusive sessions for multi-step sequences. While a session is open, other callers
+    // touching the reserved device (or any device, for a whole-bus session) queue until
+    // endSession() or until the lease runs out. HTTP handlers and update() never queue: they
+    // fail with SESSION_BUSY (409 over HTTP) and update() retries on its next pass. Each bus
+    // holds one session at a time, so a second beginSession() on the bus queues (or fails
+    // with SESSION_BUSY) even for another device. Returns the session id, 0 on failure.
+    uint32_t beginSession(uint8_t bus_id, uint16_t device_address, uint32_t lease_ms, uint32_t wait_ms = 1000);
+    // Only the task that began a session ends or extends it (SESSION_BUSY otherwise); one
+    // begun over HTTP has no owner task and is ended by id.
+    bool endSession(uint32_t session_id);
+    bool extendSession(uint32_t session_id, uint32_t lease_ms);
+
+    // Deferred writes: register writes are buffered per device in program order, and a
+    // write continuing the previous one at the next register joins its auto-increment
+    // writeBytes() burst. Buffers are flushed by flush(), once deadline_ms has passed
+    // (checked in update()), or before a read of that device touches a buffered register.
+    // A burst that fails stays buffered with everything after it, is counted in
+    // getDeferredWriteErrors() and retried after another deadline.
+    void setDeferredWrites(bool enabled, uint32_t deadline_ms = 10);
+    bool isDeferredWritesEnabled() const { return deferred_writes_enabled; }
+    // Opt out devices that do not auto-increment their register pointer
+    void setWriteCoalescing(uint8_t bus_id, uint16_t device_address, bool enabled);
+    bool flush();
+    bool flushDevice(uint8_t bus_id, uint16_t device_address);
+    uint32_t getDeferredWriteCount() const { return deferred_write_count; }
+    uint32_t getCoalescedBurstCount() const { return coalesced_burst_count; }
+    uint32_t getDeferredWriteErrors() const { return deferred_write_errors; }
+
+    // Adaptive periodic reads: the interval backs off toward slowest_interval_ms while the
+    // value stays within the deadband and snaps back to fastest_interval_ms on change.
+    // Call update() from loop().
+    int addPeriodicRead(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t length,
+                        uint32_t fastest_interval_ms, uint32_t slowest_interval_ms, uint32_t deadband = 0, bool is_signed = false);
+    bool removePeriodicRead(uint16_t id);
+    std::vector<I2CPeriodicRead> getPeriodicReads();
+    // Compressed history of a periodic read's samples (timestamped at the request), kept in
+    // capacity_bytes of I2CSampleStore blocks; the oldest block goes when it is full. update()
+    // appends to the store, so read it from the task that calls update().
+    bool enableSampleHistory(uint16_t read_id, size_t capacity_bytes, uint32_t resolution_us = 1000,
+                             I2CSampleStore::ValueEncoding encoding = I2CSampleStore::DELTA);
+    void disableSampleHistory(uint16_t read_id);
+    const I2CSampleStore* getSampleHistory(uint16_t read_id) const;
+    // Persistent log of periodic read samples on a mounted LittleFS (or other fs::FS).
+    // Reads opt in with setPeriodicReadLogging(); full pages are written from update().
+    bool beginFlashLog(fs::FS& fs, const I2CFlashLogConfig& config = I2CFlashLogConfig());
+    void endFlashLog() { flash_log.end(); }
+    bool setPeriodicReadLogging(uint16_t read_id, bool enabled);
+    I2CFlashLog& getFlashLog() { return flash_log; }
+    void update();
+
+    // FIFO drains for buffered sensors (IMUs etc.): update() checks the fill level every
+    // poll_ms and, once watermark_frames are waiting, pulls whole frames with maximal bursts
+    // into the FIFO's frame ring. Consume them in place by overriding onFifoFrames(), or with
+    // getFifo(id)->ring.peek() and consume() from the task that calls update(). The map and
+    // the ring's indices are guarded by the same lock as the periodic reads, never held
+    // across a burst; a FIFO removed during a drain goes once the drain is done, and the
+    // pointer getFifo() returns is valid until then.
+    static const size_t FIFO_BURST_MAX = 128;     // the Wire buffer
+    static const size_t FIFO_RING_MAX = 32768;    // ring bytes per FIFO
+    int addFifo(const I2CFifoConfig& config, size_t capacity_frames, uint32_t poll_ms = 10);
+    bool removeFifo(uint16_t id);
+    I2CFifo* getFifo(uint16_t id);
+    // Drain now (force ignores the watermark). Returns frames added, -1 on error.
+    int drainFifo(uint16_t id, bool force = false);
+
+#if FLEXIBLE_I2C_COROUTINES
+    // Awaitable operations for coroutine drivers, queued per bus on the executor polled by
+    // update() (or run from a dedicated task with getExecutor().run()):
+    //   I2CTask readSensor() { uint8_t raw[6]; if (co_await i2c.readBytesAsync(0, 0x68, 0x3B, raw, 6)) { ... } }
+    //   i2c.getExecutor().spawn(readSensor());
+    // Buffers must stay valid until the co_await completes.
+    I2CExecutor& getExecutor() { return executor; }
+    I2CAwaitable<bool> writeRegisterAsync(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t data);
+    I2CAwaitable<bool> writeRegister16Async(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint16_t data);
+    I2CAwaitable<bool> writeBytesAsync(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, const uint8_t* data, size_t length);
+    I2CAwaitable<uint8_t> readRegisterAsync(uint8_t bus_id, uint16_t device_address, uint8_t reg_address);
+    I2CAwaitable<uint16_t> readRegister16Async(uint8_t bus_id, uint16_t device_address, uint8_t reg_address);
+    I2CAwaitable<bool> readBytesAsync(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, uint8_t* data, size_t length);
+#endif
 
     // Virtual methods for extensibility
-    virtual void onDeviceFound(uint8_t bus_id, uint8_t address) {}
-    virtual void onDeviceLost(uint8_t bus_id, uint8_t address) {}
+    virtual void onPeriodicSample(const I2CPeriodicRead& read, int32_t value) {}
+    // Complete frames after a drain, contiguous in the ring. Return how many were used; the
+    // rest stay queued. Runs unlocked, from update(); /readI2CFifo hands out no frames meanwhile.
+    virtual size_t onFifoFrames(const I2CFifo& fifo, const uint8_t* frames, size_t count) { return 0; }
+    virtual void onDeviceFound(uint8_t bus_id, uint16_t address) {}
+    virtual void onDeviceLost(uint8_t bus_id, uint16_t address) {}
     virtual void registerCustomEndpoints(FlexibleEndpoints& endpoints) {}
+    // Built-in endpoints are registered as JSON_RESPONSE, which fixes their Content-Type in
+    // FlexibleEndpoints. Called on the serving task before each built-in handler runs with
+    // the type of the body it will return (application/msgpack for format=msgpack), so a
+    // subclass can set the header on its web server.
+    virtual void onResponseContentType(const char* content_type) {}
 
     // Configuration
     void setTimeout(uint16_t timeout_ms) { i2c_timeout = timeout_ms; }
@@ -80,7 +483,10 @@ public:
         NACK_DATA = 3,
         OTHER_ERROR = 4,
         BUS_NOT_INITIALIZED = 5,
-        INVALID_PARAMETERS = 6
+        INVALID_PARAMETERS = 6,
+        PEC_ERROR = 7,
+        QUARANTINED = 8,          // refused without touching the bus
+        SESSION_BUSY = 9          // another task's session holds the device; nothing was sent
     };
 
     I2CError getLastError() const { return last_error; }
@@ -89,27 +495,262 @@ public:
 protected:
     std::map<uint8_t, I2CBusConfig> buses;
     std::vector<I2CDeviceInfo> known_devices;
+    std::map<uint8_t, I2CTarget*> targets;
     uint16_t i2c_timeout;
     I2CError last_error;
     FlexibleEndpoints* endpoints_ptr;
+    uint32_t registry_version;
+    uint32_t bus_config_version;
+    I2CBusStats bus_stats[2];
+    std::map<uint32_t, I2CDeviceStats> device_stats;
+    float quarantine_threshold;
+    uint32_t quarantine_probe_ms;
+    bool presence_probe[2];       // scans and pings: an ACK reinstates, a NACK costs no health
+    I2CSession sessions[2];
+    I2CBusLock bus_locks[2];
+    // Guards the periodic reads, sample histories, FIFOs and trace against other tasks. Never held
+    // across a bus transaction, so it can be taken with a bus lock held but not before one.
+    I2CBusLock state_lock;
+    uint32_t next_session_id;
+    std::map<TaskHandle_t, uint32_t> http_sessions;   // session_id of the request each task is serving
+    // Raw API transaction per bus. The owner holds the bus lock from beginTransmission() to
+    // the STOP, so only the owner task touches the other fields.
+    struct RawTransaction {
+        TaskHandle_t owner;
+        uint32_t start_us;
+        uint16_t address;
+        bool open;                // endTransmission(false) left the target addressed
+        RawTransaction() : owner(nullptr), start_us(0), address(0), open(false) {}
+    };
+    RawTransaction raw_transactions[2];
+    std::vector<I2CPeriodicRead> periodic_reads;
+    uint16_t next_periodic_id;
+
+    static const size_t DEFERRED_BURST_MAX = 120;   // fits the Wire buffer with address and register bytes
+    static const size_t DEFERRED_BYTES_MAX = 512;   // per device, flushed early beyond this
+    struct PendingRun {
+        uint8_t reg_address;
+        std::vector<uint8_t> data;
+    };
+    struct PendingWrites {
+        std::vector<PendingRun> runs;   // program order
+        size_t bytes;
+        unsigned long first_write;      // or the last failed flush; starts the deadline
+        TaskHandle_t flushing;          // task writing the runs out, which bypasses the buffer
+        PendingWrites() : bytes(0), first_write(0), flushing(nullptr) {}
+    };
+    std::map<uint32_t, PendingWrites> pending_writes;
+    std::map<uint32_t, bool> coalescing_disabled;
+    bool deferred_writes_enabled;
+    uint32_t deferred_write_deadline_ms;
+    uint32_t deferred_write_count;
+    uint32_t coalesced_burst_count;
+    uint32_t deferred_write_errors;
+
+    // Incremental 10-bit scan state, advanced from update()
+    struct TenBitScan {
+        bool active;
+        uint16_t next_address;
+        bool group_checked;       // the header of next_address's 256-address group was acknowledged
+        uint8_t probes_per_update;
+        uint16_t found;
+        unsigned long started_at;
+        TenBitScan() : active(false), next_address(0), group_checked(false), probes_per_update(8), found(0), started_at(0) {}
+    };
+    TenBitScan ten_bit_scans[2];
+
+    // known_devices index keyed by deviceKey(), rebuilt when the registry version moves
+    std::map<uint32_t, size_t> device_index;
+    uint32_t device_index_version;
+
+    // Keyed by id; map nodes keep each ring in place for zero-copy readers
+    std::map<uint16_t, I2CFifo> fifos;
+    uint16_t next_fifo_id;
+
+    std::map<uint16_t, I2CSampleStore> sample_histories;   // by periodic read id
+    I2CFlashLog flash_log;
+
+    std::vector<I2CTraceEntry> trace;
+    size_t trace_next;
+    size_t trace_count;
+    TaskHandle_t update_task;     // task inside update(), which never waits on a session
+    void deliverFifoFrames(uint16_t id);
+    int runFifoDrain(I2CFifo& fifo, const I2CFifoConfig& config, bool force);
+    void releaseFifo(I2CFifo& fifo);
+
+#if FLEXIBLE_I2C_COROUTINES
+    I2CExecutor executor;
+#endif
 
     void setError(I2CError error) { last_error = error; }
-    bool validateBusAndAddress(uint8_t bus_id, uint8_t address);
+    // TwoWire return codes (1 data too long, 2 NACK, 3 data NACK, 4 other, 5 timeout) do not
+    // line up with I2CError; translate before storing or labeling them
+    static I2CError wireError(uint8_t code);
+    // Subclasses that edit known_devices directly must call this
+    void markRegistryChanged() { registry_version++; }
+    bool validateBusAndAddress(uint8_t bus_id, uint16_t address);
+    void registerDevice(uint8_t bus_id, uint16_t address);
+    void advanceTenBitScan(uint8_t bus_id);
+
+    // Address phase helpers. A 10-bit address goes out as 11110 A9 A8 R/W followed by A7..A0.
+    static uint8_t tenBitHeader(uint16_t address) { return 0x78 | ((address >> 8) & 0x03); }
+    static uint8_t addressBytes(uint16_t address) { return isTenBitAddress(address) ? 2 : 1; }
+    void beginFrame(TwoWire* wire, uint16_t address);
+    uint8_t requestFrame(TwoWire* wire, uint16_t address, uint8_t quantity, bool addressed, bool stop = true);
     void registerBuiltinEndpoints(FlexibleEndpoints& endpoints);
 
+    // Transaction accounting; wire_bytes includes one address byte per START (the low byte of a
+    // 10-bit address is added here), starts counts (repeated) START conditions
+    void recordTransaction(uint8_t bus_id, uint16_t address, uint32_t start_us, size_t wire_bytes, uint8_t starts, I2CError result);
+    // Bus counters and trace only, for frames that address no single device; returns the elapsed time
+    uint32_t recordBusTransaction(uint8_t bus_id, uint16_t address, uint32_t start_us, size_t wire_bytes, uint8_t starts, I2CError result);
+    uint32_t estimateWireTimeUs(uint8_t bus_id, size_t wire_bytes, uint8_t starts);
+    void advanceStatsWindow(I2CBusStats& stats);
+    // Queues behind another task's session; HTTP handlers and update() get SESSION_BUSY instead
+    bool waitForSession(uint8_t bus_id, uint16_t address);
+    void releaseRawLock(uint8_t bus_id);
+    bool rejectQuarantined(uint8_t bus_id, uint16_t address);
+    void updateDeviceHealth(uint8_t bus_id, uint16_t address, I2CDeviceStats& device, I2CError result);
+    void probeQuarantined(uint32_t key, unsigned long now);
+    bool isSessionOwner(const I2CSession& session);
+    // Another task's session holds the device (address 0: any device on the bus)
+    bool sessionBlocks(uint8_t bus_id, uint16_t address);
+    // Owners end and extend their own sessions; HTTP-created ones have no owner task
+    bool mayEndSession(const I2CSession& session);
+    void closeSession(uint8_t bus_id, bool expired);
+
+    // Bus locks for a transaction, taken once no other task's session holds the device.
+    // Fails like waitForSession(); bus_mask selects one or both buses.
+    class TransactionGuard {
+    public:
+        TransactionGuard(FlexibleI2C& i2c, uint8_t bus_mask, uint16_t address);
+        ~TransactionGuard();
+        TransactionGuard(const TransactionGuard&) = delete;
+        TransactionGuard& operator=(const TransactionGuard&) = delete;
+
+        explicit operator bool() const { return locked; }
+
+    private:
+        void unlock();
+
+        FlexibleI2C& i2c;
+        uint8_t bus_mask;
+        bool locked;
+    };
+    void powerDownBus(uint8_t bus_id);
+    void markBusActivity(uint8_t bus_id);
+    bool wakeBus(uint8_t bus_id);
+    void runPeriodicRead(uint16_t id, unsigned long now);
+    static uint32_t deviceKey(uint8_t bus_id, uint16_t device_address) { return ((uint32_t)bus_id << 16) | device_address; }
+    bool deferWrite(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, const uint8_t* data, size_t length);
+    bool flushOverlapping(uint8_t bus_id, uint16_t device_address, uint8_t reg_address, size_t length);
+    bool flushPending(uint32_t key);
+    std::vector<uint32_t> pendingKeys(int bus_id);  // devices with buffered writes; -1 for both buses
+
+    // Per-request state, created by negotiate() and passed to the handler and its helpers
+    struct I2CRequest {
+        bool binary;              // MessagePack response
+        I2CRequest() : binary(false) {}
+    };
+
     // Endpoint handlers
-    std::pair<String, int> handleScanBus(std::map<String, String>& params);
-    std::pair<String, int> handleInitBus(std::map<String, String>& params);
-    std::pair<String, int> handleDeviceInfo(std::map<String, String>& params);
-    std::pair<String, int> handleReadRegister(std::map<String, String>& params);
-    std::pair<String, int> handleWriteRegister(std::map<String, String>& params);
-    std::pair<String, int> handlePingDevice(std::map<String, String>& params);
-    std::pair<String, int> handleReadBytes(std::map<String, String>& params);
-    std::pair<String, int> handleWriteBytes(std::map<String, String>& params);
+    std::pair<String, int> handleScanBus(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleInitBus(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleDeviceInfo(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleBusConfig(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleReadRegister(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleWriteRegister(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handlePingDevice(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleReadBytes(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleWriteBytes(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleSMBusReadWord(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleSMBusWriteWord(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleSMBusBlockRead(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleSMBusBlockWrite(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleSMBusProcessCall(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleBusStats(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleEstimateTiming(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleMetrics(std::map<String, String>& params);
+    std::pair<String, int> handleRecoverBus(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleBeginSession(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleEndSession(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleAddPeriodicRead(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleRemovePeriodicRead(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleGetPeriodicReads(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleTrigger(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleAddFifo(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleReadFifo(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleRemoveFifo(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleGetTrace(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleGetSamples(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleGetLog(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleReadLog(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleFlushLog(std::map<String, String>& params, const I2CRequest& request);
+    std::pair<String, int> handleSetTrace(std::map<String, String>& params, const I2CRequest& request);
 
     // Helper methods
-    JsonDocument deviceInfoToJson(const I2CDeviceInfo& device);
+    JsonDocument deviceInfoToJson(const I2CDeviceInfo& device, const I2CRequest& request = I2CRequest());
     JsonDocument busConfigToJson(uint8_t bus_id);
+    std::vector<uint8_t> parseHexBytes(const String& data_str);
+    std::pair<String, int> errorResponse(const I2CRequest& request, const String& message, int status);
+    // HTTP status for a failed operation: 409 while another session holds the device, else 500
+    int errorStatus() const;
+    static void appendMsgPackString(String& out, const char* str);
+    static void appendMsgPackUint(String& out, uint32_t value);
+
+    struct I2CDeviceFilter {
+        int bus_id;
+        int responsive;
+        int quarantined;
+        String name;
+        unsigned long max_age_ms;
+    };
+    static const size_t DEVICE_PAGE_DEFAULT = 64;
+    static const size_t DEVICE_PAGE_MAX = 256;
+    bool matchesFilter(const I2CDeviceInfo& device, const I2CDeviceFilter& filter, unsigned long now);
+
+    // Response format negotiation. Handlers run through negotiate() so that setHex/setBytes
+    // emit native integers and byte arrays when MessagePack was requested.
+    typedef std::pair<String, int> (FlexibleI2C::*EndpointHandler)(std::map<String, String>&, const I2CRequest&);
+    std::pair<String, int> negotiate(std::map<String, String>& params, EndpointHandler handler);
+    std::pair<String, int> serializeResponse(const I2CRequest& request, JsonDocument& response, int status);
+    // True inside an endpoint handler, with the session_id the request carried (0 for none)
+    bool httpSession(uint32_t& session_id);
+
+    template <typename T>
+    void setHex(const I2CRequest& request, T target, uint32_t value) {
+        if (request.binary) {
+            target.set(value);
+        } else {
+            target.set("0x" + String(value, HEX));
+        }
+    }
+
+    template <typename T>
+    void setBytes(const I2CRequest& request, T target, const uint8_t* data, size_t length) {
+        if (request.binary) {
+            target.set(MsgPackBinary(data, length));
+            return;
+        }
+        JsonArray data_array = target.template to<JsonArray>();
+        for (size_t i = 0; i < length; i++) {
+            data_array.add("0x" + String(data[i], HEX));
+        }
+    }
+    template <typename T>
+    void setDeviceAddress(const I2CRequest& request, T target, uint16_t address) {
+        setHex(request, target["device_addr"], address & ~ADDR_10BIT);
+        if (isTenBitAddress(address)) {
+            target["ten_bit"] = true;
+        }
+    }
+    uint16_t parseDeviceAddress(std::map<String, String>& params);
+    bool parseOperation(const String& spec, bool ten_bit, I2COperation& operation);
+    static String metricLabels(uint32_t device_key);
+    static uint8_t smbusReadAddress(uint16_t address) {
+        return ((isTenBitAddress(address) ? tenBitHeader(address) : (uint8_t)address) << 1) | 1;
+    }
+    uint8_t smbusPec(uint16_t device_address, uint8_t command, const uint8_t* data, size_t length, bool read_phase);
 };
 
 #endif // FLEXIBLE_I2C_H
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include "I2CAsync.h"
+
+#if FLEXIBLE_I2C_COROUTINES
+
+I2CExecutor::I2CExecutor() : stats(), running(false), polling(false) {
+    idle_handler = [](uint32_t idle_us) {
+        if (idle_us >= 1000) {
+            delay(idle_us / 1000);
+        } else {
+            ::yield();
+        }
+    };
+}
+
+I2CExecutor::~I2CExecutor() {
+    // Destroying a task frame also destroys the awaitables suspended inside it
+    for (auto handle : tasks) {
+        handle.destroy();
+    }
+}
+
+void I2CExecutor::spawn(I2CTask task) {
+    std::coroutine_handle<I2CTask::promise_type> handle = task.release();
+    if (!handle) {
+        return;
+    }
+    tasks.push_back(handle);
+    ready.push_back(handle);
+}
+
+void I2CExecutor::enqueue(uint8_t bus_id, std::coroutine_handle<> handle, std::function<void()> operation) {
+    // An invalid bus_id still gets a queue; the operation itself reports the error
+    uint8_t index = bus_id > 1 ? 1 : bus_id;
+    queues[index].push_back({handle, operation});
+    if (queues[index].size() > stats.max_queue_depth[index]) {
+        stats.max_queue_depth[index] = queues[index].size();
+    }
+}
+
+void I2CExecutor::addTimer(uint32_t duration_us, std::coroutine_handle<> handle) {
+    timers.push_back({(uint32_t)micros() + duration_us, handle});
+}
+
+void I2CExecutor::resume(std::coroutine_handle<> handle) {
+    stats.resumes++;
+    handle.resume();
+}
+
+bool I2CExecutor::poll() {
+    // update() may still be inside a poll when run() takes over on its own task
+    if (polling.exchange(true)) {
+        return false;
+    }
+    bool worked = false;
+    uint32_t now = micros();
+
+    for (size_t i = 0; i < timers.size();) {
+        if ((int32_t)(now - timers[i].due_us) >= 0) {
+            ready.push_back(timers[i].handle);
+            timers[i] = timers.back();
+            timers.pop_back();
+        } else {
+            i++;
+        }
+    }
+
+    // Only work present on entry, so a task that never waits cannot starve the caller
+    for (size_t count = ready.size(); count > 0; count--) {
+        std::coroutine_handle<> handle = ready.front();
+        ready.pop_front();
+        resume(handle);
+        worked = true;
+    }
+
+    // Alternate between the buses so a long queue on one does not hold up the other
+    size_t pending[2] = { queues[0].size(), queues[1].size() };
+    while (pending[0] || pending[1]) {
+        for (uint8_t bus = 0; bus <= 1; bus++) {
+            if (!pending[bus]) {
+                continue;
+            }
+            pending[bus]--;
+            Request request = queues[bus].front();
+            queues[bus].pop_front();
+            request.operation();
+            stats.operations++;
+            resume(request.handle);
+            worked = true;
+        }
+    }
+
+    for (size_t i = 0; i < tasks.size();) {
+        if (tasks[i].done()) {
+            tasks[i].destroy();
+            tasks[i] = tasks.back();
+            tasks.pop_back();
+        } else {
+            i++;
+        }
+    }
+
+    polling = false;
+    return worked;
+}
+
+uint32_t I2CExecutor::idleUs() {
+    if (!ready.empty() || !queues[0].empty() || !queues[1].empty()) {
+        return 0;
+    }
+    if (timers.empty()) {
+        return 1000;
+    }
+
+    uint32_t now = micros();
+    uint32_t idle_us = UINT32_MAX;
+    for (const Timer& timer : timers) {
+        int32_t remaining = (int32_t)(timer.due_us - now);
+        if (remaining <= 0) {
+            return 0;
+        }
+        if ((uint32_t)remaining < idle_us) {
+            idle_us = remaining;
+        }
+    }
+    return idle_us;
+}
+
+void I2CExecutor::run(bool forever) {
+    running = true;
+    while (forever || !tasks.empty()) {
+        if (!poll()) {
+            uint32_t idle_us = idleUs();
+            if (idle_us) {
+                idle_handler(idle_us);
+            }
+        }
+    }
+    running = false;
+}
+
+#endif // FLEXIBLE_I2C_COROUTINES
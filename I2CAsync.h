@@ -0,0 +1,184 @@
+#ifndef I2C_ASYNC_H
+#define I2C_ASYNC_H
+
+#include <Arduino.h>
+
+// Awaitable I2C operations for C++20 coroutines. Compiled in when the toolchain supports
+// coroutines (arduino-esp32 3.x builds with gnu++2b); otherwise this header is empty.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define FLEXIBLE_I2C_COROUTINES 1
+#else
+#define FLEXIBLE_I2C_COROUTINES 0
+#endif
+
+#if FLEXIBLE_I2C_COROUTINES
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <vector>
+
+// Coroutine type for device drivers. A task starts when spawned on an I2CExecutor or when
+// another task co_awaits it, and may itself co_await bus operations, sleeps and sub-tasks.
+class I2CTask {
+public:
+    struct promise_type {
+        std::coroutine_handle<> continuation;
+
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                // Hand control back to the awaiting task, or to the executor for a spawned one
+                std::coroutine_handle<> next = handle.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        I2CTask get_return_object() { return I2CTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    I2CTask(I2CTask&& other) noexcept : handle(other.handle) { other.handle = nullptr; }
+    I2CTask(const I2CTask&) = delete;
+    I2CTask& operator=(const I2CTask&) = delete;
+    ~I2CTask() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool done() const { return !handle || handle.done(); }
+
+    // Awaiting a sub-task runs it to completion before the caller continues
+    bool await_ready() const noexcept { return done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+    void await_resume() noexcept {}
+
+private:
+    friend class I2CExecutor;
+    std::coroutine_handle<promise_type> handle;
+
+    explicit I2CTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+    std::coroutine_handle<promise_type> release() {
+        std::coroutine_handle<promise_type> released = handle;
+        handle = nullptr;
+        return released;
+    }
+};
+
+// Single-threaded executor: one FIFO request queue per bus, serviced alternately, plus
+// timers for sleeping tasks. Operations run with the blocking FlexibleI2C API on the
+// executor's task and the awaiting coroutine is resumed right after, so getLastError() is
+// still valid when co_await returns. Spawn, poll and run from the same task.
+class I2CExecutor {
+public:
+    struct Stats {
+        uint32_t operations;
+        uint32_t resumes;
+        uint16_t max_queue_depth[2];
+    };
+
+    struct SleepAwaiter {
+        I2CExecutor& executor;
+        uint32_t duration_us;
+
+        bool await_ready() const noexcept { return duration_us == 0; }
+        void await_suspend(std::coroutine_handle<> handle) { executor.addTimer(duration_us, handle); }
+        void await_resume() noexcept {}
+    };
+
+    struct YieldAwaiter {
+        I2CExecutor& executor;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { executor.ready.push_back(handle); }
+        void await_resume() noexcept {}
+    };
+
+    I2CExecutor();
+    ~I2CExecutor();
+
+    // Takes ownership; the task starts on the next poll and is destroyed when it finishes
+    void spawn(I2CTask task);
+    size_t getTaskCount() const { return tasks.size(); }
+
+    // Due timers, ready tasks and the operations queued when the call started, once each.
+    // Returns false if there was nothing to do, or if another task is polling. FlexibleI2C::update()
+    // calls this unless run() owns the executor.
+    bool poll();
+
+    // Poll until every task has finished (or forever), idling until the next timer in between
+    void run(bool forever = false);
+    bool isRunning() const { return running; }
+
+    // Called with the time until the next timer when there is nothing to run. The default
+    // delay()s, which yields to FreeRTOS on the target; host builds advance their clock here.
+    void setIdleHandler(std::function<void(uint32_t idle_us)> handler) { idle_handler = handler; }
+
+    SleepAwaiter sleepUs(uint32_t duration_us) { return SleepAwaiter{*this, duration_us}; }
+    SleepAwaiter sleepMs(uint32_t duration_ms) { return SleepAwaiter{*this, duration_ms * 1000}; }
+    YieldAwaiter yield() { return YieldAwaiter{*this}; }
+
+    // Used by I2CAwaitable: run operation on bus_id's queue, then resume handle
+    void enqueue(uint8_t bus_id, std::coroutine_handle<> handle, std::function<void()> operation);
+
+    const Stats& getStats() const { return stats; }
+
+private:
+    struct Request {
+        std::coroutine_handle<> handle;
+        std::function<void()> operation;
+    };
+
+    struct Timer {
+        uint32_t due_us;
+        std::coroutine_handle<> handle;
+    };
+
+    std::deque<Request> queues[2];
+    std::deque<std::coroutine_handle<>> ready;
+    std::vector<Timer> timers;
+    std::vector<std::coroutine_handle<I2CTask::promise_type>> tasks;
+    std::function<void(uint32_t)> idle_handler;
+    Stats stats;
+    std::atomic<bool> running;    // inside run(); update() leaves polling to it
+    std::atomic<bool> polling;    // keeps a poll() from another task out until this one returns
+
+    void addTimer(uint32_t duration_us, std::coroutine_handle<> handle);
+    void resume(std::coroutine_handle<> handle);
+    uint32_t idleUs();
+};
+
+// Result of a FlexibleI2C *Async call: co_await it to queue the operation and get the
+// same value the blocking call returns.
+template <typename T>
+class I2CAwaitable {
+public:
+    I2CAwaitable(I2CExecutor& executor, uint8_t bus_id, std::function<T()> operation)
+        : executor(executor), bus_id(bus_id), operation(operation), result() {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) {
+        executor.enqueue(bus_id, handle, [this]() { result = operation(); });
+    }
+    T await_resume() { return result; }
+
+private:
+    I2CExecutor& executor;
+    uint8_t bus_id;
+    std::function<T()> operation;
+    T result;
+};
+
+#endif // FLEXIBLE_I2C_COROUTINES
+
+#endif // I2C_ASYNC_H
@@ -0,0 +1,80 @@
+#include "I2CBusLock.h"
+
+I2CBusLock::I2CBusLock() : mutex(xSemaphoreCreateRecursiveMutex()), owner(nullptr), depth(0), acquired_us(0), stats(), timeouts(0) {
+}
+
+I2CBusLockStats I2CBusLock::getStats() const {
+    I2CBusLockStats snapshot = stats;
+    snapshot.timeouts = timeouts;
+    return snapshot;
+}
+
+I2CBusLock::~I2CBusLock() {
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+bool I2CBusLock::isHeldByCurrentTask() const {
+    return depth && owner == xTaskGetCurrentTaskHandle();
+}
+
+bool I2CBusLock::lock(uint32_t timeout_ms) {
+    if (!mutex) {
+        return false;
+    }
+
+    // Nested calls from the owner neither wait nor count
+    if (isHeldByCurrentTask()) {
+        xSemaphoreTakeRecursive(mutex, 0);
+        depth++;
+        return true;
+    }
+
+    uint32_t start_us = micros();
+    bool contended = false;
+    if (xSemaphoreTakeRecursive(mutex, 0) != pdTRUE) {
+        // A try-lock that finds the bus busy is neither a contention nor a timeout; it did not wait
+        if (timeout_ms == 0) {
+            return false;
+        }
+        TickType_t ticks = timeout_ms == WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+        if (xSemaphoreTakeRecursive(mutex, ticks) != pdTRUE) {
+            // The one count kept outside the mutex, hence atomic
+            timeouts++;
+            return false;
+        }
+        contended = true;
+    }
+
+    // The stats are written under the mutex from here on, and in unlock() before the give
+    owner = xTaskGetCurrentTaskHandle();
+    depth = 1;
+    acquired_us = micros();
+    stats.acquisitions++;
+    if (contended) {
+        uint32_t wait_us = acquired_us - start_us;
+        stats.contentions++;
+        stats.wait_us += wait_us;
+        if (wait_us > stats.max_wait_us) {
+            stats.max_wait_us = wait_us;
+        }
+    }
+    return true;
+}
+
+void I2CBusLock::unlock() {
+    if (!isHeldByCurrentTask()) {
+        return;
+    }
+
+    if (--depth == 0) {
+        uint32_t hold_us = micros() - acquired_us;
+        stats.hold_us += hold_us;
+        if (hold_us > stats.max_hold_us) {
+            stats.max_hold_us = hold_us;
+        }
+        owner = nullptr;
+    }
+    xSemaphoreGiveRecursive(mutex);
+}
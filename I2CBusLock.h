@@ -0,0 +1,79 @@
+#ifndef I2C_BUS_LOCK_H
+#define I2C_BUS_LOCK_H
+
+#include <Arduino.h>
+#include <atomic>
+
+struct I2CBusLockStats {
+    uint32_t acquisitions;        // outermost lock() calls that succeeded
+    uint32_t contentions;         // acquisitions that had to wait for another task
+    uint32_t timeouts;            // waits that gave up; a try-lock on a busy bus is neither
+    uint64_t wait_us;
+    uint32_t max_wait_us;
+    uint64_t hold_us;
+    uint32_t max_hold_us;
+
+    I2CBusLockStats()
+        : acquisitions(0), contentions(0), timeouts(0), wait_us(0), max_wait_us(0), hold_us(0), max_hold_us(0) {}
+};
+
+// Per-bus transaction lock shared with code that drives TwoWire directly. FlexibleI2C holds
+// it for every transaction on the bus; wrap foreign Wire code in a Guard so the two never
+// interleave on the wire:
+//
+//   {
+//       I2CBusLock::Guard guard(i2c.getBusLock(0));
+//       other_driver.update();          // uses Wire internally
+//   }
+//
+// On a bus with idle power-down, use FlexibleI2C::BusGuard instead, which also wakes the
+// peripheral. The lock is recursive, so a task holding it may call FlexibleI2C. It is a
+// transaction lock, not a session: to keep other callers off a device across several calls,
+// use beginSession(), and do not hold a Guard while waiting for another task's session.
+class I2CBusLock {
+public:
+    static const uint32_t WAIT_FOREVER = 0xFFFFFFFF;
+
+    I2CBusLock();
+    ~I2CBusLock();
+
+    bool lock(uint32_t timeout_ms = WAIT_FOREVER);
+    bool tryLock() { return lock(0); }
+    void unlock();
+    bool isHeldByCurrentTask() const;
+
+    I2CBusLockStats getStats() const;
+
+    class Guard {
+    public:
+        explicit Guard(I2CBusLock& bus_lock, uint32_t timeout_ms = WAIT_FOREVER)
+            : bus_lock(&bus_lock), locked(bus_lock.lock(timeout_ms)) {}
+        // A null lock is a no-op guard, for locks taken conditionally
+        explicit Guard(I2CBusLock* bus_lock, uint32_t timeout_ms = WAIT_FOREVER)
+            : bus_lock(bus_lock), locked(bus_lock && bus_lock->lock(timeout_ms)) {}
+        ~Guard() {
+            if (locked) {
+                bus_lock->unlock();
+            }
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        bool ownsLock() const { return locked; }
+        explicit operator bool() const { return locked; }
+
+    private:
+        I2CBusLock* bus_lock;
+        bool locked;
+    };
+
+private:
+    SemaphoreHandle_t mutex;
+    TaskHandle_t owner;
+    uint32_t depth;               // recursion depth of the owner
+    uint32_t acquired_us;
+    I2CBusLockStats stats;        // written only by the holder
+    std::atomic<uint32_t> timeouts;
+};
+
+#endif
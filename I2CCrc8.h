@@ -0,0 +1,31 @@
+#ifndef I2C_CRC8_H
+#define I2C_CRC8_H
+
+#include <Arduino.h>
+
+// Table-driven CRC-8 (MSB first, no reflection). The 256-entry table is built
+// once per polynomial so each byte costs a single lookup.
+class I2CCrc8 {
+public:
+    I2CCrc8(uint8_t polynomial = 0x07, uint8_t init = 0x00, uint8_t xor_out = 0x00);
+
+    uint8_t compute(const uint8_t* data, size_t length) const;
+    uint8_t update(uint8_t crc, const uint8_t* data, size_t length) const;
+    uint8_t update(uint8_t crc, uint8_t byte) const { return table[crc ^ byte]; }
+    uint8_t begin() const { return init_value; }
+    uint8_t finish(uint8_t crc) const { return crc ^ xor_out_value; }
+
+    uint8_t getPolynomial() const { return polynomial_value; }
+
+    // Common parameter sets
+    static const I2CCrc8& smbus();      // poly 0x07, init 0x00 (SMBus PEC)
+    static const I2CCrc8& sensirion();  // poly 0x31, init 0xFF
+
+private:
+    uint8_t table[256];
+    uint8_t polynomial_value;
+    uint8_t init_value;
+    uint8_t xor_out_value;
+};
+
+#endif // I2C_CRC8_H
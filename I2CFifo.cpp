@@ -0,0 +1,56 @@
+#include "I2CFifo.h"
+
+I2CFrameRing::I2CFrameRing(uint16_t frame_size, size_t capacity_frames)
+    : storage((size_t)(frame_size ? frame_size : 1) * capacity_frames), frame_size(frame_size ? frame_size : 1),
+      head(0), tail(0), bytes(0) {
+}
+
+uint8_t* I2CFrameRing::writeSpan(size_t& length) {
+    if (storage.empty()) {
+        length = 0;
+        return nullptr;
+    }
+    // Capacity is a whole number of frames, so frames never wrap; only the span is cut at the end
+    length = storage.size() - head;
+    if (length > freeBytes()) {
+        length = freeBytes();
+    }
+    return storage.data() + head;
+}
+
+void I2CFrameRing::commit(size_t length) {
+    if (length > freeBytes()) {
+        length = freeBytes();
+    }
+    head = storage.empty() ? 0 : (head + length) % storage.size();
+    bytes += length;
+}
+
+const uint8_t* I2CFrameRing::peek(size_t& count) const {
+    count = frames();
+    if (count == 0) {
+        return nullptr;
+    }
+    size_t contiguous = (storage.size() - tail) / frame_size;
+    if (count > contiguous) {
+        count = contiguous;
+    }
+    return storage.data() + tail;
+}
+
+void I2CFrameRing::consume(size_t count) {
+    if (count > frames()) {
+        count = frames();
+    }
+    if (count == 0) {
+        return;
+    }
+    tail = (tail + count * frame_size) % storage.size();
+    bytes -= count * frame_size;
+}
+
+void I2CFrameRing::clear() {
+    head = 0;
+    tail = 0;
+    bytes = 0;
+}
@@ -0,0 +1,85 @@
+#ifndef I2C_FIFO_H
+#define I2C_FIFO_H
+
+#include <Arduino.h>
+#include <vector>
+
+// Ring buffer of fixed-size frames filled by burst reads. Writers fill the contiguous span
+// at the head in place (the drain reads straight into it); readers get contiguous runs of
+// complete frames from the tail and release them when done, so frames are never copied
+// between the bus and the consumer. Storage never moves, and the writer only adds frames,
+// so a peeked run stays valid until it is consumed.
+class I2CFrameRing {
+public:
+    I2CFrameRing(uint16_t frame_size = 1, size_t capacity_frames = 0);
+
+    uint16_t getFrameSize() const { return frame_size; }
+    size_t getCapacityFrames() const { return storage.size() / frame_size; }
+    size_t frames() const { return bytes / frame_size; }
+    // Bytes of a frame whose remainder has not been read yet, held at the head
+    size_t partialBytes() const { return bytes % frame_size; }
+    size_t freeBytes() const { return storage.size() - bytes; }
+
+    // Writer: contiguous space at the head, then commit what was filled
+    uint8_t* writeSpan(size_t& length);
+    void commit(size_t length);
+
+    // Reader: contiguous complete frames at the tail (count set to how many), then release
+    const uint8_t* peek(size_t& count) const;
+    void consume(size_t count);
+    void clear();
+
+private:
+    std::vector<uint8_t> storage;
+    uint16_t frame_size;
+    size_t head;                  // byte offset of the next write
+    size_t tail;                  // byte offset of the oldest frame
+    size_t bytes;                 // held, including a partial frame
+};
+
+// Where a sensor reports its FIFO fill level and where the data is read from
+struct I2CFifoConfig {
+    uint8_t bus_id;
+    uint16_t device_address;
+    uint8_t count_reg;            // fill level register
+    uint8_t count_bytes;          // 1 or 2
+    bool count_little_endian;
+    uint16_t count_mask;          // valid level bits, e.g. 0x0FFF
+    bool count_in_frames;         // level counts frames instead of bytes
+    uint8_t data_reg;             // FIFO data port (must not auto-increment)
+    uint16_t frame_size;          // bytes per sample frame
+    uint16_t watermark_frames;    // drain once at least this many frames are waiting
+
+    I2CFifoConfig()
+        : bus_id(0), device_address(0), count_reg(0), count_bytes(2), count_little_endian(false),
+          count_mask(0xFFFF), count_in_frames(false), data_reg(0), frame_size(1), watermark_frames(1) {}
+};
+
+struct I2CFifo {
+    uint16_t id;
+    I2CFifoConfig config;
+    I2CFrameRing ring;
+    uint32_t poll_ms;             // fill level check interval in update()
+    unsigned long next_due;
+    uint32_t drains;              // drains that moved data
+    uint32_t bursts;
+    uint32_t frames;
+    uint64_t bytes;
+    uint32_t errors;
+    uint32_t ring_full;           // drains cut short by a full ring; the rest stays in the device
+    uint32_t last_level;          // bytes waiting in the device at the last check
+    uint32_t max_level;
+    uint64_t drain_request_us;    // last drain: level read issued (FlexibleI2C::timestampUs())
+    uint64_t drain_complete_us;   // last drain: final burst completed
+    // Owned by FlexibleI2C, changed under its state lock
+    bool draining;                // one drain at a time writes the ring
+    bool consuming;               // onFifoFrames() holds peeked frames
+    bool removed;                 // removeFifo() during a drain or delivery; erased after it
+
+    I2CFifo(uint16_t frame_size = 1, size_t capacity_frames = 0)
+        : id(0), ring(frame_size, capacity_frames), poll_ms(10), next_due(0), drains(0), bursts(0),
+          frames(0), bytes(0), errors(0), ring_full(0), last_level(0), max_level(0),
+          drain_request_us(0), drain_complete_us(0), draining(false), consuming(false), removed(false) {}
+};
+
+#endif
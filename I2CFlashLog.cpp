@@ -0,0 +1,238 @@
+#include "I2CFlashLog.h"
+
+I2CFlashLog::I2CFlashLog()
+    : filesystem(nullptr), buffered(0), page_started(0), boot(0), sequence(0), first_file(0),
+      current_file(0), current_bytes(0), pages_written(0), records_written(0), write_errors(0),
+      dropped_records(0), rotations(0) {
+}
+
+size_t I2CFlashLog::getRecordsPerPage() const {
+    if (config.page_bytes < sizeof(I2CLogPageHeader)) {
+        return 0;
+    }
+    return (config.page_bytes - sizeof(I2CLogPageHeader)) / sizeof(I2CLogRecord);
+}
+
+String I2CFlashLog::filePath(uint32_t index) const {
+    char name[16];
+    snprintf(name, sizeof(name), "/%08lu.log", (unsigned long)index);
+    return config.directory + name;
+}
+
+bool I2CFlashLog::scan(uint32_t& first, uint32_t& last) {
+    File dir = filesystem->open(config.directory);
+    if (!dir || !dir.isDirectory()) {
+        return false;
+    }
+
+    bool found = false;
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+        // Some cores report the full path, others just the name
+        String name = entry.name();
+        int slash = name.lastIndexOf('/');
+        if (slash >= 0) {
+            name = name.substring(slash + 1);
+        }
+        entry.close();
+
+        if (name.length() != 12 || !name.endsWith(".log")) {
+            continue;
+        }
+        uint32_t index = strtoul(name.c_str(), NULL, 10);
+        if (!found || index < first) {
+            first = index;
+        }
+        if (!found || index > last) {
+            last = index;
+        }
+        found = true;
+    }
+    dir.close();
+    return found;
+}
+
+bool I2CFlashLog::begin(fs::FS& fs, const I2CFlashLogConfig& log_config) {
+    end();
+
+    config = log_config;
+    if (getRecordsPerPage() == 0 || config.max_files == 0) {
+        return false;
+    }
+    // Whole pages per file, at least one
+    config.file_bytes -= config.file_bytes % config.page_bytes;
+    if (config.file_bytes == 0) {
+        config.file_bytes = config.page_bytes;
+    }
+
+    filesystem = &fs;
+    if (!filesystem->exists(config.directory) && !filesystem->mkdir(config.directory)) {
+        filesystem = nullptr;
+        return false;
+    }
+
+    boot = 1;
+    sequence = 0;
+    first_file = 1;
+    current_file = 1;
+    current_bytes = 0;
+    page.assign(config.page_bytes, 0xFF);
+    buffered = 0;
+
+    uint32_t first, last;
+    if (scan(first, last)) {
+        first_file = first;
+        current_file = last;
+
+        // Continue the boot and page numbering from the newest readable page
+        for (uint32_t index = last + 1; index-- > first;) {
+            File file = filesystem->open(filePath(index), FILE_READ);
+            size_t pages = file ? file.size() / config.page_bytes : 0;
+            if (index == last) {
+                current_bytes = file ? file.size() : 0;
+            }
+            file.close();
+            if (pages && readPage(index, pages - 1, page.data())) {
+                I2CLogPageHeader header;
+                memcpy(&header, page.data(), sizeof(header));
+                boot = header.boot + 1;
+                sequence = header.sequence + 1;
+                break;
+            }
+        }
+
+        // A torn write leaves the file off a page boundary; start the next one instead
+        if (current_bytes % config.page_bytes != 0 || current_bytes >= config.file_bytes) {
+            rotate();
+        }
+    }
+    return true;
+}
+
+void I2CFlashLog::end() {
+    if (!filesystem) {
+        return;
+    }
+    flush();
+    filesystem = nullptr;
+    page.clear();
+    page.shrink_to_fit();
+}
+
+bool I2CFlashLog::append(const I2CLogRecord& record) {
+    if (!filesystem) {
+        return false;
+    }
+
+    if (buffered == 0) {
+        page_started = millis();
+    }
+    memcpy(page.data() + sizeof(I2CLogPageHeader) + buffered * sizeof(I2CLogRecord), &record, sizeof(record));
+    buffered++;
+
+    if (buffered == getRecordsPerPage()) {
+        return flush();
+    }
+    return true;
+}
+
+bool I2CFlashLog::flush() {
+    if (!filesystem || buffered == 0) {
+        return true;
+    }
+
+    I2CLogPageHeader header;
+    header.magic = PAGE_MAGIC;
+    header.boot = boot;
+    header.sequence = sequence;
+    header.count = buffered;
+    header.record_size = sizeof(I2CLogRecord);
+    memcpy(page.data(), &header, sizeof(header));
+    // Pad with the erased-flash value
+    size_t used = sizeof(header) + buffered * sizeof(I2CLogRecord);
+    memset(page.data() + used, 0xFF, config.page_bytes - used);
+
+    if (current_bytes + config.page_bytes > config.file_bytes) {
+        rotate();
+    }
+
+    File file = filesystem->open(filePath(current_file), FILE_APPEND);
+    size_t written = file ? file.write(page.data(), config.page_bytes) : 0;
+    file.close();
+
+    uint16_t records = buffered;
+    buffered = 0;
+    if (written != config.page_bytes) {
+        write_errors++;
+        dropped_records += records;
+        // Keep later pages aligned
+        if (written) {
+            rotate();
+        }
+        return false;
+    }
+
+    current_bytes += config.page_bytes;
+    sequence++;
+    pages_written++;
+    records_written += records;
+    return true;
+}
+
+void I2CFlashLog::update(unsigned long now) {
+    if (config.flush_ms && buffered && now - page_started >= config.flush_ms) {
+        flush();
+    }
+}
+
+void I2CFlashLog::rotate() {
+    current_file++;
+    current_bytes = 0;
+    rotations++;
+    while (current_file - first_file + 1 > config.max_files) {
+        filesystem->remove(filePath(first_file));
+        first_file++;
+    }
+}
+
+std::vector<I2CLogFileInfo> I2CFlashLog::getFiles() {
+    std::vector<I2CLogFileInfo> files;
+    if (!filesystem) {
+        return files;
+    }
+
+    for (uint32_t index = first_file; index <= current_file; index++) {
+        String path = filePath(index);
+        if (!filesystem->exists(path)) {
+            continue;
+        }
+        File file = filesystem->open(path, FILE_READ);
+        I2CLogFileInfo info = { index, file ? file.size() : 0 };
+        file.close();
+        files.push_back(info);
+    }
+    return files;
+}
+
+bool I2CFlashLog::readPage(uint32_t index, uint32_t page_index, uint8_t* buffer) {
+    if (!filesystem) {
+        return false;
+    }
+
+    String path = filePath(index);
+    if (!filesystem->exists(path)) {
+        return false;
+    }
+    File file = filesystem->open(path, FILE_READ);
+    size_t offset = (size_t)page_index * config.page_bytes;
+    bool ok = file && file.size() >= offset + config.page_bytes && file.seek(offset) &&
+              file.read(buffer, config.page_bytes) == config.page_bytes;
+    file.close();
+    if (!ok) {
+        return false;
+    }
+
+    I2CLogPageHeader header;
+    memcpy(&header, buffer, sizeof(header));
+    return header.magic == PAGE_MAGIC && header.record_size == sizeof(I2CLogRecord) &&
+           header.count <= getRecordsPerPage();
+}
@@ -0,0 +1,107 @@
+#ifndef I2C_FLASH_LOG_H
+#define I2C_FLASH_LOG_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <vector>
+
+// One sampled register value, as stored on flash
+struct I2CLogRecord {
+    uint64_t timestamp_us;        // FlexibleI2C::timestampUs(), since boot
+    int32_t value;
+    uint16_t device_address;      // ADDR_10BIT flag included
+    uint8_t bus_id;
+    uint8_t reg_address;
+};
+
+// Every page starts with this header; records follow and the rest of the page is padding
+struct I2CLogPageHeader {
+    uint32_t magic;
+    uint32_t boot;                // increments on every begin(), so timestamps stay comparable
+    uint32_t sequence;            // page number across all files, never reused
+    uint16_t count;               // valid records in the page
+    uint16_t record_size;
+};
+
+struct I2CFlashLogConfig {
+    String directory;
+    size_t page_bytes;            // write unit; match the filesystem block size
+    size_t file_bytes;            // rotate to a new file at this size
+    uint16_t max_files;           // oldest file removed beyond this
+    uint32_t flush_ms;            // write a partly filled page after this long; 0 waits for a full page
+
+    I2CFlashLogConfig()
+        : directory("/i2clog"), page_bytes(4096), file_bytes(256 * 1024), max_files(8), flush_ms(0) {}
+};
+
+struct I2CLogFileInfo {
+    uint32_t index;
+    size_t bytes;
+};
+
+// Append-only log of samples on a LittleFS (or any fs::FS) partition.
+//
+// Records collect in a RAM page and go to flash one whole page at a time, so every write
+// is page-sized and page-aligned within its file and a block is programmed once rather than
+// rewritten record by record. A partly filled page is written padded only by flush() and
+// end(), or after flush_ms if set: each padded write costs a whole page of wear, so a short
+// flush_ms multiplies flash writes at low sample rates, while the RAM page is what a reset can
+// lose. Files are numbered; the current one rotates at file_bytes
+// and the oldest is removed once there are more than max_files. Readers work a page at a time.
+class I2CFlashLog {
+public:
+    static const uint32_t PAGE_MAGIC = 0x4C433249; // "I2CL"
+
+    I2CFlashLog();
+
+    bool begin(fs::FS& fs, const I2CFlashLogConfig& config = I2CFlashLogConfig());
+    void end();
+    bool isOpen() const { return filesystem != nullptr; }
+
+    bool append(const I2CLogRecord& record);
+    bool flush();
+    // Time-based flush (flush_ms), called from FlexibleI2C::update()
+    void update(unsigned long now);
+
+    // Files oldest first
+    std::vector<I2CLogFileInfo> getFiles();
+    size_t getPageBytes() const { return config.page_bytes; }
+    size_t getRecordsPerPage() const;
+    // Reads page `page` of file `index` into buffer (getPageBytes() long); false past the end
+    // or if the page does not carry a valid header
+    bool readPage(uint32_t index, uint32_t page, uint8_t* buffer);
+
+    const I2CFlashLogConfig& getConfig() const { return config; }
+    uint32_t getBoot() const { return boot; }
+    uint32_t getCurrentFile() const { return current_file; }
+    uint16_t getBufferedRecords() const { return buffered; }
+    uint32_t getPagesWritten() const { return pages_written; }
+    uint32_t getRecordsWritten() const { return records_written; }
+    uint32_t getWriteErrors() const { return write_errors; }
+    uint32_t getDroppedRecords() const { return dropped_records; }
+    uint32_t getRotations() const { return rotations; }
+
+private:
+    fs::FS* filesystem;
+    I2CFlashLogConfig config;
+    std::vector<uint8_t> page;
+    uint16_t buffered;
+    unsigned long page_started;   // millis() of the first record in the page
+    uint32_t boot;
+    uint32_t sequence;
+    uint32_t first_file;
+    uint32_t current_file;
+    size_t current_bytes;
+
+    uint32_t pages_written;
+    uint32_t records_written;
+    uint32_t write_errors;
+    uint32_t dropped_records;
+    uint32_t rotations;
+
+    String filePath(uint32_t index) const;
+    bool scan(uint32_t& first, uint32_t& last);
+    void rotate();
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include "I2CRegisterImage.h"
+#include "FlexibleI2C.h"
+
+I2CRegisterImage::I2CRegisterImage(FlexibleI2C& i2c, uint8_t bus_id, uint16_t device_address, uint8_t first_reg, uint16_t count)
+    : i2c(i2c), bus_id(bus_id), device_address(device_address), first_reg(first_reg), page_size(0),
+      values(count > 256 - first_reg ? 256 - first_reg : count, 0), flags(values.size(), 0),
+      read_bursts(0), write_bursts(0), bytes_written(0) {
+}
+
+size_t I2CRegisterImage::burstLimit(size_t index, size_t length, size_t burst_max) const {
+    if (length > burst_max) {
+        length = burst_max;
+    }
+    if (page_size) {
+        size_t reg = first_reg + index;
+        size_t to_boundary = page_size - reg % page_size;
+        if (length > to_boundary) {
+            length = to_boundary;
+        }
+    }
+    return length;
+}
+
+size_t I2CRegisterImage::runLength(size_t index, uint8_t flag, size_t burst_max) const {
+    size_t length = 0;
+    while (index + length < flags.size() && (flags[index + length] & flag)) {
+        length++;
+    }
+    return burstLimit(index, length, burst_max);
+}
+
+bool I2CRegisterImage::load() {
+    return load(first_reg, values.size());
+}
+
+bool I2CRegisterImage::load(uint8_t reg, uint16_t count) {
+    if (!contains(reg) || count == 0) {
+        return false;
+    }
+    size_t index = reg - first_reg;
+    size_t end = index + count > values.size() ? values.size() : index + count;
+
+    while (index < end) {
+        size_t length = burstLimit(index, end - index, READ_BURST_MAX);
+        if (!i2c.readBytes(bus_id, device_address, first_reg + index, values.data() + index, length)) {
+            return false;
+        }
+        read_bursts++;
+        for (size_t i = index; i < index + length; i++) {
+            flags[i] = LOADED;
+        }
+        index += length;
+    }
+    return true;
+}
+
+bool I2CRegisterImage::set(uint8_t reg, uint8_t value) {
+    return set(reg, &value, 1);
+}
+
+bool I2CRegisterImage::set(uint8_t reg, const uint8_t* data, size_t length) {
+    if (!contains(reg) || !data || (size_t)(reg - first_reg) + length > values.size()) {
+        return false;
+    }
+    for (size_t i = 0, index = reg - first_reg; i < length; i++, index++) {
+        if (values[index] != data[i] || !(flags[index] & LOADED)) {
+            values[index] = data[i];
+            flags[index] = (flags[index] | DIRTY) & ~SYNCED;
+        }
+    }
+    return true;
+}
+
+bool I2CRegisterImage::setBits(uint8_t reg, uint8_t mask, uint8_t bits) {
+    if (!contains(reg)) {
+        return false;
+    }
+    uint8_t value = (values[reg - first_reg] & ~mask) | (bits & mask);
+    return set(reg, value);
+}
+
+void I2CRegisterImage::markDirty(uint8_t reg, uint16_t count) {
+    for (size_t i = 0; i < count && contains(reg + i); i++) {
+        flags[reg + i - first_reg] |= DIRTY;
+    }
+}
+
+void I2CRegisterImage::markClean(uint8_t reg, uint16_t count) {
+    for (size_t i = 0; i < count && contains(reg + i); i++) {
+        flags[reg + i - first_reg] &= ~(DIRTY | SYNCED);
+    }
+}
+
+size_t I2CRegisterImage::getDirtyCount() const {
+    size_t count = 0;
+    for (uint8_t flag : flags) {
+        if (flag & DIRTY) {
+            count++;
+        }
+    }
+    return count;
+}
+
+size_t I2CRegisterImage::getWriteBurstMax() const {
+    return FlexibleI2C::isTenBitAddress(device_address) ? WRITE_BURST_MAX - 1 : WRITE_BURST_MAX;
+}
+
+void I2CRegisterImage::markSynced(size_t index, size_t length) {
+    write_bursts++;
+    bytes_written += length;
+    for (size_t i = index; i < index + length; i++) {
+        flags[i] = LOADED | SYNCED;
+    }
+}
+
+bool I2CRegisterImage::sync() {
+    // With deferred writes enabled a successful writeBytes() may only have buffered the
+    // burst, so those registers stay dirty until the flush confirms them
+    bool deferred = i2c.isDeferredWritesEnabled();
+    std::vector<std::pair<size_t, size_t>> buffered;
+
+    bool success = true;
+    for (size_t index = 0; index < flags.size();) {
+        size_t length = runLength(index, DIRTY, getWriteBurstMax());
+        if (length == 0) {
+            index++;
+            continue;
+        }
+
+        if (!i2c.writeBytes(bus_id, device_address, first_reg + index, values.data() + index, length)) {
+            success = false;
+            break;
+        }
+        if (deferred) {
+            buffered.push_back(std::make_pair(index, length));
+        } else {
+            markSynced(index, length);
+        }
+        index += length;
+    }
+
+    if (!deferred || buffered.empty()) {
+        return success;
+    }
+    // Bursts left queued by a failed flush are rewritten by the next sync(); the values are the same
+    if (!i2c.flushDevice(bus_id, device_address)) {
+        return false;
+    }
+    for (const auto& burst : buffered) {
+        markSynced(burst.first, burst.second);
+    }
+    return success;
+}
+
+bool I2CRegisterImage::verify(std::vector<uint8_t>* mismatched) {
+    uint8_t buffer[READ_BURST_MAX];
+    bool matched = true;
+
+    for (size_t index = 0; index < flags.size();) {
+        size_t length = runLength(index, SYNCED, READ_BURST_MAX);
+        if (length == 0) {
+            index++;
+            continue;
+        }
+
+        if (!i2c.readBytes(bus_id, device_address, first_reg + index, buffer, length)) {
+            return false;
+        }
+        read_bursts++;
+        for (size_t i = 0; i < length; i++) {
+            uint8_t& flag = flags[index + i];
+            flag &= ~SYNCED;
+            if (buffer[i] != values[index + i]) {
+                flag |= DIRTY;
+                matched = false;
+                if (mismatched) {
+                    mismatched->push_back(first_reg + index + i);
+                }
+            }
+        }
+        index += length;
+    }
+    return matched;
+}
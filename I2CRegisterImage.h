@@ -0,0 +1,87 @@
+#ifndef I2C_REGISTER_IMAGE_H
+#define I2C_REGISTER_IMAGE_H
+
+#include <Arduino.h>
+#include <vector>
+
+class FlexibleI2C;
+
+// Local copy of a device's register space (display controllers, PMICs, codecs) for
+// read-modify-write configuration without a bus transaction per field.
+//
+// load() fills the image with the largest bursts the Wire buffer allows. Edits only touch
+// the image and mark changed registers dirty; sync() then writes each contiguous dirty run as
+// one auto-increment burst, and verify() reads back only what sync() wrote. Registers that
+// read back differently are marked dirty again, so the next sync() retries them. Devices that
+// wrap their register pointer at a page boundary set the page size so no burst crosses one.
+class I2CRegisterImage {
+public:
+    static const size_t READ_BURST_MAX = 128;     // the Wire buffer
+    static const size_t WRITE_BURST_MAX = 127;    // the Wire buffer less the register byte
+
+    I2CRegisterImage(FlexibleI2C& i2c, uint8_t bus_id, uint16_t device_address, uint8_t first_reg = 0, uint16_t count = 256);
+
+    void setPageSize(uint16_t bytes) { page_size = bytes; }
+    uint8_t getBusId() const { return bus_id; }
+    uint16_t getDeviceAddress() const { return device_address; }
+    uint8_t getFirstRegister() const { return first_reg; }
+    uint16_t getRegisterCount() const { return values.size(); }
+    // WRITE_BURST_MAX, less the low address byte a 10-bit target also puts in the Wire buffer
+    size_t getWriteBurstMax() const;
+
+    // Reads the device into the image, discarding unsynced edits in the range
+    bool load();
+    bool load(uint8_t reg, uint16_t count);
+
+    bool contains(uint8_t reg) const { return reg >= first_reg && (size_t)(reg - first_reg) < values.size(); }
+    bool isLoaded(uint8_t reg) const { return contains(reg) && (flags[reg - first_reg] & LOADED); }
+    uint8_t get(uint8_t reg) const { return contains(reg) ? values[reg - first_reg] : 0; }
+    // Registers are marked dirty when the value differs from the image or was never loaded
+    bool set(uint8_t reg, uint8_t value);
+    bool set(uint8_t reg, const uint8_t* data, size_t length);
+    bool setBits(uint8_t reg, uint8_t mask, uint8_t bits);
+
+    bool isDirty(uint8_t reg) const { return contains(reg) && (flags[reg - first_reg] & DIRTY); }
+    void markDirty(uint8_t reg, uint16_t count = 1);
+    void markClean(uint8_t reg, uint16_t count = 1);
+    size_t getDirtyCount() const;
+
+    // Writes the dirty runs; on a failed burst the rest stay dirty and false is returned.
+    // With deferred writes, registers are marked clean only once the flush has confirmed them.
+    bool sync();
+    // Reads back the registers written by sync() since the last verify(). Mismatching
+    // registers are listed in mismatched (if given) and marked dirty again.
+    bool verify(std::vector<uint8_t>* mismatched = nullptr);
+
+    uint32_t getReadBursts() const { return read_bursts; }
+    uint32_t getWriteBursts() const { return write_bursts; }
+    uint32_t getBytesWritten() const { return bytes_written; }
+
+private:
+    enum Flags {
+        LOADED = 0x01,            // value matches the device as last read or written
+        DIRTY = 0x02,             // edited, not yet written
+        SYNCED = 0x04             // written, not yet verified
+    };
+
+    FlexibleI2C& i2c;
+    uint8_t bus_id;
+    uint16_t device_address;
+    uint8_t first_reg;
+    uint16_t page_size;
+    std::vector<uint8_t> values;
+    std::vector<uint8_t> flags;
+
+    uint32_t read_bursts;
+    uint32_t write_bursts;
+    uint32_t bytes_written;
+
+    // Length of the run of registers with flag set starting at index, cut at burst_max and
+    // at the next page boundary
+    size_t runLength(size_t index, uint8_t flag, size_t burst_max) const;
+    size_t burstLimit(size_t index, size_t length, size_t burst_max) const;
+    // Written and confirmed: counts the burst and marks it for verify()
+    void markSynced(size_t index, size_t length);
+};
+
+#endif
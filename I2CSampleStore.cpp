@@ -0,0 +1,217 @@
+#include "I2CSampleStore.h"
+
+I2CSampleStore::I2CSampleStore(size_t capacity_bytes, uint32_t resolution_us, ValueEncoding encoding)
+    : blocks(capacity_bytes / sizeof(Block)), first_block(0), block_count(0),
+      resolution_us(resolution_us ? resolution_us : 1), encoding(encoding), dropped_blocks(0) {
+}
+
+void I2CSampleStore::clear() {
+    first_block = 0;
+    block_count = 0;
+    dropped_blocks = 0;
+}
+
+void I2CSampleStore::startBlock(uint64_t units, int32_t value) {
+    if (block_count == blocks.size()) {
+        first_block = (first_block + 1) % blocks.size();
+        block_count--;
+        dropped_blocks++;
+    }
+    block_count++;
+
+    Block& block = current();
+    block.first_units = units;
+    block.last_units = units;
+    block.last_delta_units = 0;
+    block.first_value = value;
+    block.last_value = value;
+    block.count = 1;
+    block.pending_run = 0;
+    block.used = 0;
+}
+
+void I2CSampleStore::flushRun(Block& block) {
+    if (block.pending_run) {
+        block.used += putVarint(block.data + block.used, ((uint64_t)block.pending_run << 2) | TAG_RUN);
+        block.pending_run = 0;
+    }
+}
+
+uint64_t I2CSampleStore::valueCode(int32_t previous, int32_t value) const {
+    if (encoding == XOR) {
+        return (uint32_t)previous ^ (uint32_t)value;
+    }
+    return zigzag((int64_t)value - previous);
+}
+
+int32_t I2CSampleStore::applyValueCode(int32_t previous, uint64_t code) const {
+    if (encoding == XOR) {
+        return (int32_t)((uint32_t)previous ^ (uint32_t)code);
+    }
+    return (int32_t)((int64_t)previous + unzigzag(code));
+}
+
+void I2CSampleStore::append(uint64_t timestamp_us, int32_t value) {
+    if (blocks.empty()) {
+        return;
+    }
+
+    uint64_t units = timestamp_us / resolution_us;
+    if (block_count == 0) {
+        startBlock(units, value);
+        return;
+    }
+
+    Block& block = current();
+    if (block.used + RECORD_MAX > BLOCK_BYTES) {
+        flushRun(block);
+        startBlock(units < block.last_units ? block.last_units : units, value);
+        return;
+    }
+
+    // Appends are in time order; a timestamp going backwards is stored as a repeat
+    if (units < block.last_units) {
+        units = block.last_units;
+    }
+    int64_t delta = units - block.last_units;
+    int64_t dod = delta - block.last_delta_units;
+    uint64_t code = valueCode(block.last_value, value);
+
+    if (dod == 0 && code == 0) {
+        block.pending_run++;
+    } else {
+        flushRun(block);
+        if (code == 0) {
+            block.used += putVarint(block.data + block.used, (zigzag(dod) << 2) | TAG_TIME);
+        } else if (dod == 0) {
+            block.used += putVarint(block.data + block.used, (code << 2) | TAG_VALUE);
+        } else {
+            block.used += putVarint(block.data + block.used, (zigzag(dod) << 2) | TAG_BOTH);
+            block.used += putVarint(block.data + block.used, code);
+        }
+    }
+
+    block.last_units = units;
+    block.last_delta_units = delta;
+    block.last_value = value;
+    block.count++;
+}
+
+size_t I2CSampleStore::query(uint64_t from_us, uint64_t to_us, std::function<bool(const I2CSamplePoint&)> callback) const {
+    size_t emitted = 0;
+    bool stopped = false;
+    auto emit = [&](uint64_t units, int32_t value) {
+        I2CSamplePoint point = { units * resolution_us, value };
+        if (point.timestamp_us > to_us) {
+            stopped = true;
+        } else if (point.timestamp_us >= from_us) {
+            emitted++;
+            stopped = !callback(point);
+        }
+    };
+
+    for (size_t i = 0; i < block_count && !stopped; i++) {
+        const Block& block = blocks[(first_block + i) % blocks.size()];
+        if (block.last_units * resolution_us < from_us) {
+            continue;
+        }
+        if (block.first_units * resolution_us > to_us) {
+            break;
+        }
+
+        // The first sample is in the header
+        uint64_t units = block.first_units;
+        int64_t delta = 0;
+        int32_t value = block.first_value;
+        emit(units, value);
+
+        uint32_t remaining = block.count - 1;
+        size_t position = 0;
+        while (remaining && !stopped) {
+            uint64_t repeats = 1;
+            if (position < block.used) {
+                uint64_t header;
+                position += getVarint(block.data + position, block.used - position, header);
+                uint64_t payload = header >> 2;
+                switch (header & 3) {
+                    case TAG_RUN:
+                        repeats = payload;
+                        break;
+                    case TAG_TIME:
+                        delta += unzigzag(payload);
+                        break;
+                    case TAG_VALUE:
+                        value = applyValueCode(value, payload);
+                        break;
+                    default: {
+                        uint64_t code;
+                        delta += unzigzag(payload);
+                        position += getVarint(block.data + position, block.used - position, code);
+                        value = applyValueCode(value, code);
+                        break;
+                    }
+                }
+            } else {
+                repeats = block.pending_run;
+            }
+            if (!repeats) {
+                break;
+            }
+
+            for (; repeats && remaining && !stopped; repeats--, remaining--) {
+                units += delta;
+                emit(units, value);
+            }
+        }
+    }
+    return emitted;
+}
+
+uint32_t I2CSampleStore::getSampleCount() const {
+    uint32_t count = 0;
+    for (size_t i = 0; i < block_count; i++) {
+        count += blocks[(first_block + i) % blocks.size()].count;
+    }
+    return count;
+}
+
+size_t I2CSampleStore::getEncodedBytes() const {
+    size_t bytes = 0;
+    for (size_t i = 0; i < block_count; i++) {
+        bytes += sizeof(Block) - BLOCK_BYTES + blocks[(first_block + i) % blocks.size()].used;
+    }
+    return bytes;
+}
+
+bool I2CSampleStore::getRange(uint64_t& first_us, uint64_t& last_us) const {
+    if (block_count == 0) {
+        return false;
+    }
+    first_us = blocks[first_block].first_units * resolution_us;
+    last_us = blocks[(first_block + block_count - 1) % blocks.size()].last_units * resolution_us;
+    return true;
+}
+
+size_t I2CSampleStore::putVarint(uint8_t* out, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
+
+size_t I2CSampleStore::getVarint(const uint8_t* in, size_t available, uint64_t& value) {
+    value = 0;
+    size_t length = 0;
+    while (length < available && length < 10) {
+        uint8_t byte = in[length];
+        value |= (uint64_t)(byte & 0x7F) << (7 * length);
+        length++;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return length;
+}
@@ -0,0 +1,91 @@
+#ifndef I2C_SAMPLE_STORE_H
+#define I2C_SAMPLE_STORE_H
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+
+struct I2CSamplePoint {
+    uint64_t timestamp_us;
+    int32_t value;
+};
+
+// Compressed, append-only history of (timestamp, value) samples in fixed-size blocks.
+//
+// Timestamps are kept to resolution_us and stored as delta-of-delta, values as the
+// zigzag delta from the previous value (DELTA) or the XOR with it (XOR, for bit fields).
+// Each sample is one varint record tagged with what changed, and runs of samples with the
+// same spacing and value collapse into a single run record, so a steady sampler costs
+// well under a byte per sample. The first sample of a block sits in its header, so
+// blocks decode on their own; when the store is full the oldest block is dropped.
+class I2CSampleStore {
+public:
+    enum ValueEncoding {
+        DELTA = 0,
+        XOR = 1
+    };
+
+    static const size_t BLOCK_BYTES = 240;
+
+    struct Block {
+        uint64_t first_units;     // timestamp / resolution_us
+        uint64_t last_units;
+        int64_t last_delta_units; // spacing of the last two samples, for delta-of-delta
+        int32_t first_value;
+        int32_t last_value;
+        uint32_t count;
+        uint32_t pending_run;     // trailing run not yet written to data
+        uint16_t used;
+        uint8_t data[BLOCK_BYTES];
+    };
+
+    I2CSampleStore(size_t capacity_bytes = 0, uint32_t resolution_us = 1000, ValueEncoding encoding = DELTA);
+
+    void append(uint64_t timestamp_us, int32_t value);
+    void clear();
+
+    // Decodes the samples in [from_us, to_us] oldest first; return false from the callback
+    // to stop. Blocks outside the range are skipped from their headers. Returns the number
+    // of samples passed to the callback.
+    size_t query(uint64_t from_us, uint64_t to_us, std::function<bool(const I2CSamplePoint&)> callback) const;
+
+    uint32_t getResolutionUs() const { return resolution_us; }
+    ValueEncoding getEncoding() const { return encoding; }
+    size_t getCapacityBlocks() const { return blocks.size(); }
+    size_t getBlockCount() const { return block_count; }
+    uint32_t getSampleCount() const;
+    uint32_t getDroppedBlocks() const { return dropped_blocks; }
+    size_t getMemoryBytes() const { return blocks.size() * sizeof(Block); }
+    size_t getEncodedBytes() const;
+    bool getRange(uint64_t& first_us, uint64_t& last_us) const;
+
+private:
+    std::vector<Block> blocks;
+    size_t first_block;           // oldest block in the ring
+    size_t block_count;
+    uint32_t resolution_us;
+    ValueEncoding encoding;
+    uint32_t dropped_blocks;
+
+    enum RecordTag {
+        TAG_RUN = 0,              // N repeats of the previous spacing and value
+        TAG_TIME = 1,             // spacing changed, value unchanged
+        TAG_VALUE = 2,            // value changed, spacing unchanged
+        TAG_BOTH = 3              // both changed; value code follows
+    };
+    // Worst case for a flushed run plus one record, checked before every append
+    static const size_t RECORD_MAX = 5 + 10 + 5;
+
+    Block& current() { return blocks[(first_block + block_count - 1) % blocks.size()]; }
+    void startBlock(uint64_t units, int32_t value);
+    void flushRun(Block& block);
+    uint64_t valueCode(int32_t previous, int32_t value) const;
+    int32_t applyValueCode(int32_t previous, uint64_t code) const;
+
+    static size_t putVarint(uint8_t* out, uint64_t value);
+    static size_t getVarint(const uint8_t* in, size_t available, uint64_t& value);
+    static uint64_t zigzag(int64_t value) { return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63); }
+    static int64_t unzigzag(uint64_t value) { return (int64_t)(value >> 1) ^ -(int64_t)(value & 1); }
+};
+
+#endif
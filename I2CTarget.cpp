@@ -0,0 +1,180 @@
+#include "I2CTarget.h"
+
+I2CTarget* I2CTarget::instances[2] = { nullptr, nullptr };
+
+I2CTarget::I2CTarget(size_t register_count)
+    : register_count(register_count > MAX_REGISTERS ? MAX_REGISTERS : register_count), sequence(0),
+      writer_mutex(xSemaphoreCreateMutex()), wire(nullptr), bus_id(0), target_address(0), pointer(0),
+      auto_increment(true), preloaded(false),
+      read_count(0), write_count(0), rejected_writes(0), torn_retries(0) {
+    memset(banks, 0, sizeof(banks));
+    memset(access_map, ACCESS_READ_WRITE, sizeof(access_map));
+}
+
+I2CTarget::~I2CTarget() {
+    end();
+    if (writer_mutex) {
+        vSemaphoreDelete(writer_mutex);
+    }
+}
+
+bool I2CTarget::begin(uint8_t bus_id, uint8_t address, uint8_t sda_pin, uint8_t scl_pin, uint32_t frequency) {
+    if (bus_id > 1 || address == 0 || address > 127 || instances[bus_id]) {
+        return false;
+    }
+
+    TwoWire* wire_instance = (bus_id == 0) ? &Wire : &Wire1;
+    instances[bus_id] = this;
+    this->bus_id = bus_id;
+    target_address = address;
+
+    wire_instance->onReceive(bus_id == 0 ? onReceiveBus0 : onReceiveBus1);
+    wire_instance->onRequest(bus_id == 0 ? onRequestBus0 : onRequestBus1);
+    if (!wire_instance->begin(address, sda_pin, scl_pin, frequency)) {
+        instances[bus_id] = nullptr;
+        return false;
+    }
+
+    wire = wire_instance;
+    preload();
+    return true;
+}
+
+void I2CTarget::end() {
+    if (!wire) {
+        return;
+    }
+    wire->end();
+    wire = nullptr;
+    instances[bus_id] = nullptr;
+}
+
+void I2CTarget::setAccess(uint8_t start, size_t length, uint8_t access) {
+    for (size_t i = start; i < start + length && i < register_count; i++) {
+        access_map[i] = access;
+    }
+}
+
+void I2CTarget::publish(uint8_t reg, const uint8_t* data, size_t length) {
+    if (!data || reg >= register_count) {
+        return;
+    }
+    if (reg + length > register_count) {
+        length = register_count - reg;
+    }
+
+    // Another writer holds the mutex only for two short copies; priority inheritance
+    // keeps a preempted producer from stalling the handler for longer than that
+    xSemaphoreTake(writer_mutex, portMAX_DELAY);
+    store(reg, data, length);
+    xSemaphoreGive(writer_mutex);
+}
+
+void I2CTarget::store(uint8_t reg, const uint8_t* data, size_t length) {
+    sequence.fetch_add(1, std::memory_order_acq_rel);     // odd: readers move to bank 1
+    memcpy(banks[0] + reg, data, length);
+    sequence.fetch_add(1, std::memory_order_acq_rel);     // even: readers back on bank 0
+    memcpy(banks[1] + reg, data, length);
+}
+
+void I2CTarget::publish16(uint8_t reg, uint16_t value) {
+    uint8_t data[2] = { (uint8_t)(value >> 8), (uint8_t)(value & 0xFF) };
+    publish(reg, data, 2);
+}
+
+size_t I2CTarget::snapshot(uint8_t start, uint8_t* out) {
+    size_t length = auto_increment ? register_count - start : 1;
+    if (length > PRELOAD_BYTES) {
+        length = PRELOAD_BYTES;
+    }
+
+    for (uint8_t attempt = 0;; attempt++) {
+        uint32_t before = sequence.load(std::memory_order_acquire);
+        const uint8_t* bank = banks[before & 1];
+        for (size_t i = 0; i < length; i++) {
+            out[i] = (access_map[start + i] & ACCESS_READ) ? bank[start + i] : 0xFF;
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // The bank read is never the one being written unless a writer on the other core
+        // moved on meanwhile; give up after a few attempts rather than stall the bus
+        if (sequence.load(std::memory_order_relaxed) == before || attempt == SNAPSHOT_RETRIES) {
+            return length;
+        }
+        torn_retries++;
+    }
+}
+
+void I2CTarget::preload() {
+    if (!wire || pointer >= register_count) {
+        return;
+    }
+    size_t length = snapshot(pointer, tx_buffer);
+    preloaded = wire->slaveWrite(tx_buffer, length) > 0;
+}
+
+void I2CTarget::handleReceive(int count) {
+    size_t received = 0;
+    while (wire->available() && received < sizeof(rx_buffer)) {
+        rx_buffer[received++] = wire->read();
+    }
+    if (received == 0) {
+        return;
+    }
+
+    pointer = rx_buffer[0];
+    if (received == 1) {
+        // Register pointer only: get the following read ready in the FIFO
+        preload();
+        return;
+    }
+
+    write_count++;
+    const uint8_t* data = rx_buffer + 1;
+    size_t length = auto_increment ? received - 1 : 1;
+    uint8_t reg = pointer;
+    size_t index = 0;
+
+    while (index < length) {
+        // Each writable run is one store; the callback runs unlocked so it may publish()
+        size_t run_length = 0;
+        while (index + run_length < length && reg + run_length < register_count &&
+               (access_map[reg + run_length] & ACCESS_WRITE)) {
+            run_length++;
+        }
+        if (run_length == 0) {
+            rejected_writes++;
+            index++;
+            reg++;
+            continue;
+        }
+        xSemaphoreTake(writer_mutex, portMAX_DELAY);
+        store(reg, data + index, run_length);
+        xSemaphoreGive(writer_mutex);
+        if (write_callback) {
+            write_callback(reg, data + index, run_length);
+        }
+        index += run_length;
+        reg += run_length;
+    }
+
+    if (auto_increment) {
+        pointer = reg;
+    }
+    preload();
+}
+
+void I2CTarget::handleRequest() {
+    read_count++;
+    if (preloaded) {
+        // Already sitting in the FIFO since the pointer was set
+        preloaded = false;
+        return;
+    }
+    if (pointer >= register_count) {
+        uint8_t filler = 0xFF;
+        wire->write(&filler, 1);
+        return;
+    }
+    size_t length = snapshot(pointer, tx_buffer);
+    wire->write(tx_buffer, length);
+}
@@ -0,0 +1,97 @@
+#ifndef I2C_TARGET_H
+#define I2C_TARGET_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <atomic>
+#include <functional>
+
+// Emulated register file served in I2C target (slave) mode on Wire or Wire1.
+//
+// The upstream controller writes [reg][data...] and reads from the current
+// register pointer. All storage is preallocated; the receive/request handlers
+// only copy bytes, and the next read is preloaded into the peripheral FIFO as
+// soon as the pointer is set so 400 kHz reads are answered without stretching.
+//
+// Application tasks update values with publish(). The register file is kept twice
+// and every write updates one copy after the other, so a reader always finds one copy
+// that is not being written, even when it preempts a producer halfway through. Writers
+// (producers and controller writes) are serialized by a mutex; readers never wait.
+class I2CTarget {
+public:
+    enum Access : uint8_t {
+        ACCESS_NONE = 0,
+        ACCESS_READ = 1,
+        ACCESS_WRITE = 2,
+        ACCESS_READ_WRITE = 3
+    };
+
+    typedef std::function<void(uint8_t reg, const uint8_t* data, size_t length)> WriteCallback;
+
+    static const size_t MAX_REGISTERS = 256;
+    static const size_t PRELOAD_BYTES = 32;
+    static const uint8_t SNAPSHOT_RETRIES = 4;    // against writers on the other core
+
+    I2CTarget(size_t register_count = MAX_REGISTERS);
+    ~I2CTarget();
+
+    bool begin(uint8_t bus_id, uint8_t address, uint8_t sda_pin, uint8_t scl_pin, uint32_t frequency = 400000);
+    void end();
+    bool isActive() const { return wire != nullptr; }
+    uint8_t getAddress() const { return target_address; }
+
+    // Register file layout (call before begin())
+    void setAccess(uint8_t start, size_t length, uint8_t access);
+    void setAutoIncrement(bool enabled) { auto_increment = enabled; }
+    void onWrite(WriteCallback callback) { write_callback = callback; }
+
+    // Producer path, safe to call from any task (not from an ISR)
+    void publish(uint8_t reg, const uint8_t* data, size_t length);
+    void publish(uint8_t reg, uint8_t value) { publish(reg, &value, 1); }
+    void publish16(uint8_t reg, uint16_t value);
+    uint8_t getRegister(uint8_t reg) const { return banks[sequence.load(std::memory_order_acquire) & 1][reg]; }
+
+    // Statistics
+    uint32_t getReadCount() const { return read_count; }
+    uint32_t getWriteCount() const { return write_count; }
+    uint32_t getRejectedWrites() const { return rejected_writes; }
+    uint32_t getTornRetries() const { return torn_retries; }
+
+protected:
+    void handleReceive(int count);
+    void handleRequest();
+    size_t snapshot(uint8_t start, uint8_t* out);
+    void store(uint8_t reg, const uint8_t* data, size_t length);
+    void preload();
+
+private:
+    static I2CTarget* instances[2];
+    static void onReceiveBus0(int count) { if (instances[0]) instances[0]->handleReceive(count); }
+    static void onReceiveBus1(int count) { if (instances[1]) instances[1]->handleReceive(count); }
+    static void onRequestBus0() { if (instances[0]) instances[0]->handleRequest(); }
+    static void onRequestBus1() { if (instances[1]) instances[1]->handleRequest(); }
+
+    // Odd sequence: bank 0 is being written, read bank 1; even: read bank 0
+    uint8_t banks[2][MAX_REGISTERS];
+    uint8_t access_map[MAX_REGISTERS];
+    uint8_t rx_buffer[MAX_REGISTERS + 1];
+    uint8_t tx_buffer[PRELOAD_BYTES];
+    size_t register_count;
+    std::atomic<uint32_t> sequence;
+    SemaphoreHandle_t writer_mutex;
+
+    TwoWire* wire;
+    uint8_t bus_id;
+    uint8_t target_address;
+    uint8_t pointer;
+    bool auto_increment;
+    volatile bool preloaded;
+    WriteCallback write_callback;
+
+    uint32_t read_count;
+    uint32_t write_count;
+    uint32_t rejected_writes;
+    uint32_t torn_retries;
+};
+
+#endif // I2C_TARGET_H
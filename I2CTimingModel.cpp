@@ -0,0 +1,56 @@
+#include "I2CTimingModel.h"
+
+I2CTimingEstimate& I2CTimingEstimate::operator+=(const I2CTimingEstimate& other) {
+    wire_ns += other.wire_ns;
+    stretch_ns += other.stretch_ns;
+    transactions += other.transactions;
+    bytes += other.bytes;
+    return *this;
+}
+
+I2CTimingModel::I2CTimingModel(uint32_t frequency) {
+    setFrequency(frequency);
+}
+
+void I2CTimingModel::setFrequency(uint32_t frequency) {
+    this->frequency = frequency ? frequency : 100000;
+    bit_ns = 1000000000ULL / this->frequency;
+
+    // Minimum bus free time between STOP and START (UM10204 tBUF) for the speed mode
+    if (this->frequency <= 100000) {
+        bus_free_ns = 4700;
+    } else if (this->frequency <= 400000) {
+        bus_free_ns = 1300;
+    } else {
+        bus_free_ns = 500;
+    }
+}
+
+uint64_t I2CTimingModel::transactionNs(size_t wire_bytes, uint8_t starts) const {
+    return wire_bytes * byteNs() + starts * startNs() + stopNs() + busFreeNs();
+}
+
+I2CTimingEstimate I2CTimingModel::estimate(const I2COperation& operation) const {
+    I2CTimingEstimate result;
+    size_t bytes = operation.address_bytes + operation.register_bytes + operation.write_bytes;
+    uint8_t starts = 1;
+    if (operation.read_bytes) {
+        // Repeated START and the read header; a 10-bit target only gets the header byte again
+        bytes += 1 + operation.read_bytes;
+        starts++;
+    }
+
+    result.wire_ns = transactionNs(bytes, starts) * operation.count;
+    result.stretch_ns = (uint64_t)operation.stretch_us * 1000 * operation.count;
+    result.transactions = operation.count;
+    result.bytes = bytes * operation.count;
+    return result;
+}
+
+I2CTimingEstimate I2CTimingModel::estimate(const I2COperation* operations, size_t count) const {
+    I2CTimingEstimate total;
+    for (size_t i = 0; i < count; i++) {
+        total += estimate(operations[i]);
+    }
+    return total;
+}
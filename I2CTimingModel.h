@@ -0,0 +1,77 @@
+#ifndef I2C_TIMING_MODEL_H
+#define I2C_TIMING_MODEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Wire-time model for I2C transactions, shared by FlexibleI2C's bus statistics and the host
+// simulator (extras/sim), so it only depends on the C standard headers.
+//
+// A byte takes 9 SCL periods (8 data + ACK), a START or repeated START and the STOP one
+// period each, and every transaction is followed by the bus free time (tBUF) of the speed
+// mode. Clock stretching is added on top as given by the caller.
+
+// Shape of one transaction: the write phase (address, register/command bytes, payload) and
+// an optional read phase after a repeated START.
+struct I2COperation {
+    uint8_t address_bytes;      // 1, or 2 for a 10-bit address
+    uint8_t register_bytes;     // register or command bytes written before the payload
+    size_t write_bytes;
+    size_t read_bytes;          // > 0 adds a repeated START and the read header
+    uint32_t stretch_us;        // expected clock stretching
+    uint32_t count;             // repetitions
+
+    I2COperation(uint8_t address_bytes = 1, uint8_t register_bytes = 0, size_t write_bytes = 0,
+                 size_t read_bytes = 0, uint32_t stretch_us = 0, uint32_t count = 1)
+        : address_bytes(address_bytes), register_bytes(register_bytes), write_bytes(write_bytes),
+          read_bytes(read_bytes), stretch_us(stretch_us), count(count) {}
+
+    // The shapes of FlexibleI2C's operations
+    static I2COperation readRegister(uint8_t value_bytes = 1, bool ten_bit = false) { return I2COperation(ten_bit ? 2 : 1, 1, 0, value_bytes); }
+    static I2COperation readBytes(size_t length, bool ten_bit = false) { return I2COperation(ten_bit ? 2 : 1, 1, 0, length); }
+    static I2COperation writeRegister(uint8_t value_bytes = 1, bool ten_bit = false) { return I2COperation(ten_bit ? 2 : 1, 1, value_bytes); }
+    static I2COperation writeBytes(size_t length, bool ten_bit = false) { return I2COperation(ten_bit ? 2 : 1, 1, length); }
+    static I2COperation ping(bool ten_bit = false) { return I2COperation(ten_bit ? 2 : 1); }
+    static I2COperation scan(uint16_t addresses = 126, bool ten_bit = false) { return I2COperation(ten_bit ? 2 : 1, 0, 0, 0, 0, addresses); }
+};
+
+struct I2CTimingEstimate {
+    uint64_t wire_ns;           // SCL/SDA activity and bus free time
+    uint64_t stretch_ns;
+    uint32_t transactions;
+    uint32_t bytes;             // including address bytes
+
+    I2CTimingEstimate() : wire_ns(0), stretch_ns(0), transactions(0), bytes(0) {}
+
+    uint64_t totalNs() const { return wire_ns + stretch_ns; }
+    uint32_t totalUs() const { return (totalNs() + 999) / 1000; }
+    I2CTimingEstimate& operator+=(const I2CTimingEstimate& other);
+};
+
+class I2CTimingModel {
+public:
+    explicit I2CTimingModel(uint32_t frequency = 100000);
+
+    void setFrequency(uint32_t frequency);
+    uint32_t getFrequency() const { return frequency; }
+
+    // Phase costs in nanoseconds
+    uint64_t bitNs() const { return bit_ns; }
+    uint64_t byteNs() const { return bit_ns * 9; }
+    uint64_t startNs() const { return bit_ns; }
+    uint64_t stopNs() const { return bit_ns; }
+    uint64_t busFreeNs() const { return bus_free_ns; }
+
+    // Raw form used for measured transactions: wire_bytes includes address bytes
+    uint64_t transactionNs(size_t wire_bytes, uint8_t starts) const;
+
+    I2CTimingEstimate estimate(const I2COperation& operation) const;
+    I2CTimingEstimate estimate(const I2COperation* operations, size_t count) const;
+
+private:
+    uint32_t frequency;
+    uint64_t bit_ns;
+    uint64_t bus_free_ns;
+};
+
+#endif // I2C_TIMING_MODEL_H
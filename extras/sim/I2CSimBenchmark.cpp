@@ -0,0 +1,136 @@
+#include "I2CSimBenchmark.h"
+#include <stdio.h>
+
+I2CSimBenchmark::I2CSimBenchmark(FlexibleI2C& i2c, uint8_t bus_id, I2CSimFaultInjector& faults, I2CSimRegisterFile& device)
+    : i2c(i2c), bus_id(bus_id), faults(faults), device(device) {
+}
+
+const I2CSimScenario* I2CSimBenchmark::defaultScenarios(size_t& count) {
+    typedef I2CSimFaultInjector::Fault Fault;
+    static const uint16_t ANY = I2CSimFaultInjector::ANY_ADDRESS;
+    static const I2CSimScenario scenarios[] = {
+        { "baseline",            false, Fault(),                                                         2000000, 16, false, 0 },
+        { "nack_bursts",         true,  Fault(I2CSimFaultInjector::ADDRESS_NACK, ANY, 0.01f, 0, 5),      2000000, 16, false, 0 },
+        { "timeouts",            true,  Fault(I2CSimFaultInjector::TIMEOUT, ANY, 0.005f),                2000000, 16, false, 0 },
+        { "stuck_bus_recovered", true,  Fault(I2CSimFaultInjector::STUCK_BUS, ANY, 0, 500, 1, 200000),   2000000, 16, false, 3 },
+        { "stuck_bus_waited",    true,  Fault(I2CSimFaultInjector::STUCK_BUS, ANY, 0, 500, 1, 200000),   2000000, 16, false, 0 },
+        { "corruption",          true,  Fault(I2CSimFaultInjector::CORRUPT_READ, ANY, 0.02f),            2000000, 16, false, 0 },
+        { "corruption_pec",      true,  Fault(I2CSimFaultInjector::CORRUPT_READ, ANY, 0.02f),            2000000, 2,  true,  0 },
+    };
+    count = sizeof(scenarios) / sizeof(scenarios[0]);
+    return scenarios;
+}
+
+void I2CSimBenchmark::prepareDevice() {
+    for (uint16_t reg = 0; reg < PEC_COMMAND; reg++) {
+        device.setRegister(reg, (uint8_t)(reg * 37 + 11));
+    }
+
+    // SMBus read word: little-endian data followed by PEC over both address phases
+    uint8_t address = device.getAddress();
+    const I2CCrc8& crc8 = I2CCrc8::smbus();
+    uint8_t header[3] = { (uint8_t)(address << 1), PEC_COMMAND, (uint8_t)((address << 1) | 1) };
+    uint8_t word[2] = { (uint8_t)(PEC_WORD & 0xFF), (uint8_t)(PEC_WORD >> 8) };
+    uint8_t crc = crc8.update(crc8.begin(), header, sizeof(header));
+    device.setRegister(PEC_COMMAND, word[0]);
+    device.setRegister(PEC_COMMAND + 1, word[1]);
+    device.setRegister(PEC_COMMAND + 2, crc8.finish(crc8.update(crc, word, sizeof(word))));
+}
+
+bool I2CSimBenchmark::readOnce(const I2CSimScenario& scenario, I2CSimBenchmarkResult& result) {
+    uint16_t address = device.getAddress();
+    bool success;
+    bool correct;
+    size_t length;
+
+    if (scenario.use_pec) {
+        uint16_t value = 0;
+        success = i2c.smbusReadWord(bus_id, address, PEC_COMMAND, value, true);
+        correct = value == PEC_WORD;
+        length = 2;
+    } else {
+        uint8_t data[128];
+        length = scenario.payload > sizeof(data) ? sizeof(data) : scenario.payload;
+        success = i2c.readBytes(bus_id, address, 0x00, data, length);
+        correct = true;
+        for (size_t i = 0; success && i < length; i++) {
+            correct = correct && data[i] == (uint8_t)(i * 37 + 11);
+        }
+    }
+
+    if (!success) {
+        result.failures++;
+        return false;
+    }
+    if (!correct) {
+        result.silent_corruptions++;
+        return false;
+    }
+    result.good_bytes += length;
+    return true;
+}
+
+I2CSimBenchmarkResult I2CSimBenchmark::run(const I2CSimScenario& scenario) {
+    I2CSimBenchmarkResult result = {};
+    result.scenario = scenario.name;
+
+    prepareDevice();
+    faults.clearFaults();
+    faults.resetInjected();
+    if (scenario.faulty) {
+        faults.addFault(scenario.fault);
+    }
+
+    uint64_t start_us = I2CSimClock::nowUs();
+    uint64_t outage_start_us = 0;
+    uint64_t recovery_total_us = 0;
+    uint32_t consecutive_failures = 0;
+
+    while (I2CSimClock::nowUs() - start_us < scenario.duration_us) {
+        uint64_t before_us = I2CSimClock::nowUs();
+        bool good = readOnce(scenario, result);
+        result.operations++;
+
+        if (good) {
+            if (consecutive_failures) {
+                uint64_t recovery_us = I2CSimClock::nowUs() - outage_start_us;
+                recovery_total_us += recovery_us;
+                if (recovery_us > result.max_recovery_us) {
+                    result.max_recovery_us = recovery_us;
+                }
+                result.outages++;
+            }
+            consecutive_failures = 0;
+        } else {
+            if (consecutive_failures == 0) {
+                outage_start_us = before_us;
+            }
+            consecutive_failures++;
+            if (scenario.recover_after && consecutive_failures % scenario.recover_after == 0) {
+                i2c.recoverBus(bus_id);
+                result.recoveries++;
+            }
+        }
+
+        // Guard against a library path that returns without touching the bus
+        if (I2CSimClock::nowUs() == before_us) {
+            I2CSimClock::advanceUs(1);
+        }
+    }
+
+    result.elapsed_us = I2CSimClock::nowUs() - start_us;
+    result.faults_injected = faults.getInjectedTotal();
+    result.mean_recovery_us = result.outages ? recovery_total_us / result.outages : 0;
+    faults.clearFaults();
+    return result;
+}
+
+int I2CSimBenchmark::format(const I2CSimBenchmarkResult& result, char* buffer, size_t size) {
+    return snprintf(buffer, size,
+                    "%-20s ops=%lu fail=%lu silent=%lu faults=%lu recoveries=%lu goodput=%.0f B/s "
+                    "outages=%lu recovery_mean=%luus recovery_max=%luus",
+                    result.scenario, (unsigned long)result.operations, (unsigned long)result.failures,
+                    (unsigned long)result.silent_corruptions, (unsigned long)result.faults_injected,
+                    (unsigned long)result.recoveries, result.goodput(), (unsigned long)result.outages,
+                    (unsigned long)result.mean_recovery_us, (unsigned long)result.max_recovery_us);
+}
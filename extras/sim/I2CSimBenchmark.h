@@ -0,0 +1,63 @@
+#ifndef I2C_SIM_BENCHMARK_H
+#define I2C_SIM_BENCHMARK_H
+
+#include <FlexibleI2C.h>
+#include "I2CSimFaults.h"
+
+// Recovery benchmarks: drive FlexibleI2C reads against a simulated register file through a
+// fault injector for a stretch of simulated time, and report how long outages last and how
+// much verified payload still gets through. Needs a host build with the Arduino core
+// backed by I2CSimClock (see I2CSimClock).
+
+struct I2CSimScenario {
+    const char* name;
+    bool faulty;                       // false for the fault-free baseline
+    I2CSimFaultInjector::Fault fault;
+    uint32_t duration_us;              // simulated run length
+    uint8_t payload;                   // bytes per plain read
+    bool use_pec;                      // SMBus word reads with PEC instead of plain reads
+    uint8_t recover_after;             // consecutive failures before recoverBus(); 0 = never
+};
+
+struct I2CSimBenchmarkResult {
+    const char* scenario;
+    uint32_t operations;
+    uint32_t failures;                 // reported by the library
+    uint32_t silent_corruptions;       // reported as success with wrong data
+    uint32_t faults_injected;
+    uint32_t recoveries;               // recoverBus() calls
+    uint32_t outages;                  // runs of failed reads that ended in a good read
+    uint64_t good_bytes;               // verified payload
+    uint64_t elapsed_us;
+    uint32_t mean_recovery_us;         // first failed read of an outage to the next good read
+    uint32_t max_recovery_us;
+
+    float goodput() const { return elapsed_us ? good_bytes * 1e6f / elapsed_us : 0; }
+};
+
+class I2CSimBenchmark {
+public:
+    I2CSimBenchmark(FlexibleI2C& i2c, uint8_t bus_id, I2CSimFaultInjector& faults, I2CSimRegisterFile& device);
+
+    I2CSimBenchmarkResult run(const I2CSimScenario& scenario);
+
+    // Baseline, NACK bursts, timeouts, stuck bus with and without recovery, corruption with and without PEC
+    static const I2CSimScenario* defaultScenarios(size_t& count);
+
+    // One line: counters, goodput (bytes per simulated second) and recovery times
+    static int format(const I2CSimBenchmarkResult& result, char* buffer, size_t size);
+
+private:
+    static const uint8_t PEC_COMMAND = 0x80;
+    static const uint16_t PEC_WORD = 0x1234;
+
+    FlexibleI2C& i2c;
+    uint8_t bus_id;
+    I2CSimFaultInjector& faults;
+    I2CSimRegisterFile& device;
+
+    void prepareDevice();
+    bool readOnce(const I2CSimScenario& scenario, I2CSimBenchmarkResult& result);
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "I2CSimBus.h"
+
+I2CSimBus::I2CSimBus(uint32_t frequency)
+    : timing_model(frequency), timeout_us(50000), rng_state(1), open_device(nullptr) {
+}
+
+I2CSimBus::~I2CSimBus() {
+    for (I2CSimDevice* device : owned_devices) {
+        delete device;
+    }
+}
+
+void I2CSimBus::attach(I2CSimDevice* device, bool owned) {
+    if (!device) {
+        return;
+    }
+    devices.push_back(device);
+    if (owned) {
+        owned_devices.push_back(device);
+    }
+}
+
+I2CSimDevice* I2CSimBus::find(uint16_t address) {
+    for (I2CSimDevice* device : devices) {
+        I2CSimDevice* routed = device->route(address);
+        if (routed) {
+            return routed;
+        }
+    }
+    return nullptr;
+}
+
+void I2CSimBus::advance(uint64_t ns) {
+    I2CSimClock::advanceNs(ns);
+    stats.busy_ns += ns;
+}
+
+bool I2CSimBus::stall(uint64_t ns) {
+    // The controller gives up on a target that holds SCL low past the timeout
+    uint64_t timeout_ns = (uint64_t)timeout_us * 1000;
+    bool timed_out = ns > timeout_ns;
+    if (timed_out) {
+        ns = timeout_ns;
+        stats.timeouts++;
+    }
+    advance(ns);
+    stats.stretch_ns += ns;
+    return !timed_out;
+}
+
+float I2CSimBus::random() {
+    // xorshift32: cheap and reproducible for a given seed
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state / 4294967296.0f;
+}
+
+uint64_t I2CSimBus::stretchNs(I2CSimDevice* device, bool read) {
+    uint64_t stretch_us = device->stretchBeforeByte(read, I2CSimClock::nowUs());
+    const I2CSimTiming& timing = device->getTiming();
+    if (timing.stretch_probability > 0 && random() < timing.stretch_probability) {
+        stretch_us += timing.stretch_us;
+    }
+    return stretch_us * 1000;
+}
+
+bool I2CSimBus::tenBitHeaderAcked(uint8_t header) {
+    // Every 10-bit target sharing the two high address bits acknowledges the header byte
+    uint16_t high = (uint16_t)(header & 0x03) << 8;
+    for (uint16_t low = 0; low <= 0xFF; low++) {
+        if (find(I2C_SIM_ADDR_10BIT | high | low)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void I2CSimBus::finish(I2CSimDevice* device, bool stop) {
+    if (!stop) {
+        open_device = device;
+        return;
+    }
+    advance(timing_model.stopNs() + timing_model.busFreeNs());
+    if (device) {
+        device->onStop(I2CSimClock::nowUs());
+    }
+    open_device = nullptr;
+}
+
+uint8_t I2CSimBus::transmit(uint8_t address, const uint8_t* data, size_t length, bool stop) {
+    stats.transactions++;
+    advance(timing_model.startNs() + timing_model.byteNs()); // (repeated) START and the address byte
+    stats.bytes++;
+
+    I2CSimDevice* device = nullptr;
+    size_t index = 0;
+    if ((address & 0x7C) == 0x78) {
+        if (!tenBitHeaderAcked(address)) {
+            stats.address_nacks++;
+            finish(nullptr, true);
+            return 2;
+        }
+        if (length == 0) {
+            finish(nullptr, stop);
+            return 0;
+        }
+        advance(timing_model.byteNs());
+        stats.bytes++;
+        index = 1;
+        device = find(I2C_SIM_ADDR_10BIT | ((uint16_t)(address & 0x03) << 8) | data[0]);
+        if (!device || !device->onAddress(false, I2CSimClock::nowUs())) {
+            stats.data_nacks++;
+            finish(nullptr, true);
+            return 2;
+        }
+    } else {
+        device = find(address);
+        if (!device || !device->onAddress(false, I2CSimClock::nowUs())) {
+            stats.address_nacks++;
+            finish(nullptr, true);
+            return 2;
+        }
+    }
+
+    if (!stall((uint64_t)device->getTiming().latency_us * 1000)) {
+        finish(device, true);
+        return 5;
+    }
+    for (; index < length; index++) {
+        if (!stall(stretchNs(device, false))) {
+            finish(device, true);
+            return 5;
+        }
+        advance(timing_model.byteNs());
+        stats.bytes++;
+        if (!device->onWrite(data[index], I2CSimClock::nowUs())) {
+            stats.data_nacks++;
+            finish(device, true);
+            return 2;
+        }
+    }
+
+    finish(device, stop);
+    return 0;
+}
+
+size_t I2CSimBus::receive(uint8_t address, uint8_t* data, size_t length, bool stop) {
+    stats.transactions++;
+    advance(timing_model.startNs() + timing_model.byteNs());
+    stats.bytes++;
+
+    I2CSimDevice* device = nullptr;
+    if ((address & 0x7C) == 0x78) {
+        // A 10-bit read header only reaches the target addressed by the preceding write phase
+        if (open_device && (open_device->getAddress() & I2C_SIM_ADDR_10BIT) &&
+            ((open_device->getAddress() >> 8) & 0x03) == (address & 0x03)) {
+            device = open_device;
+        }
+    } else {
+        device = find(address);
+    }
+    if (!device || !device->onAddress(true, I2CSimClock::nowUs())) {
+        stats.address_nacks++;
+        finish(nullptr, true);
+        return 0;
+    }
+
+    if (!stall((uint64_t)device->getTiming().latency_us * 1000)) {
+        finish(device, true);
+        return 0;
+    }
+    for (size_t i = 0; i < length; i++) {
+        if (!stall(stretchNs(device, true))) {
+            finish(device, true);
+            return 0;
+        }
+        data[i] = device->onRead(I2CSimClock::nowUs());
+        advance(timing_model.byteNs());
+        stats.bytes++;
+    }
+
+    finish(device, stop);
+    return length;
+}
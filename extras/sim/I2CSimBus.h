@@ -0,0 +1,80 @@
+#ifndef I2C_SIM_BUS_H
+#define I2C_SIM_BUS_H
+
+#include <I2CTimingModel.h>
+#include "I2CSimDevices.h"
+
+// A simulated I2C bus: routes transactions to attached devices and advances I2CSimClock by
+// the time each one would take on the wire (the library's I2CTimingModel), plus device
+// latency and clock stretching.
+// Return codes follow the ESP32 TwoWire driver: 0 ok, 2 any NACK, 5 timeout. The driver never
+// reports 3, so an address NACK and a data NACK are told apart only in Stats.
+class I2CSimBus {
+public:
+    struct Stats {
+        uint32_t transactions;
+        uint32_t address_nacks;
+        uint32_t data_nacks;
+        uint32_t timeouts;
+        uint64_t bytes;
+        uint64_t busy_ns;
+        uint64_t stretch_ns;
+
+        Stats() { reset(); }
+        void reset() {
+            transactions = 0;
+            address_nacks = 0;
+            data_nacks = 0;
+            timeouts = 0;
+            bytes = 0;
+            busy_ns = 0;
+            stretch_ns = 0;
+        }
+    };
+
+    explicit I2CSimBus(uint32_t frequency = 100000);
+    virtual ~I2CSimBus();
+
+    // Owned devices are deleted with the bus
+    void attach(I2CSimDevice* device, bool owned = false);
+    I2CSimDevice* find(uint16_t address);
+
+    // {"frequency": 400000, "timeout_us": 50000, "seed": 1, "devices": [...]}
+    bool configure(JsonVariantConst config);
+
+    virtual void setFrequency(uint32_t frequency) { timing_model.setFrequency(frequency); }
+    uint32_t getFrequency() const { return timing_model.getFrequency(); }
+    const I2CTimingModel& getTimingModel() const { return timing_model; }
+    virtual void setTimeoutUs(uint32_t timeout_us) { this->timeout_us = timeout_us; }
+    uint32_t getTimeoutUs() const { return timeout_us; }
+    void setSeed(uint32_t seed) { rng_state = seed ? seed : 1; }
+
+    // Called when the controller is (re)initialized, e.g. at the end of a bus recovery
+    virtual void onBusReset() {}
+
+    // One transaction each, as issued by TwoWire::endTransmission / requestFrom. `address` is
+    // the 7-bit address byte; a 10-bit header (11110xx) is decoded against the first data byte.
+    virtual uint8_t transmit(uint8_t address, const uint8_t* data, size_t length, bool stop);
+    virtual size_t receive(uint8_t address, uint8_t* data, size_t length, bool stop);
+
+    const Stats& getStats() const { return stats; }
+    void resetStats() { stats.reset(); }
+
+protected:
+    std::vector<I2CSimDevice*> devices;
+    std::vector<I2CSimDevice*> owned_devices;
+    I2CTimingModel timing_model;
+    uint32_t timeout_us;
+    uint32_t rng_state;
+    I2CSimDevice* open_device;    // still addressed after a transaction without STOP
+    Stats stats;
+
+    void advance(uint64_t ns);
+    bool stall(uint64_t ns);
+    uint64_t stretchNs(I2CSimDevice* device, bool read);
+    float random();
+    bool tenBitHeaderAcked(uint8_t header);
+    void finish(I2CSimDevice* device, bool stop);
+};
+
+#endif
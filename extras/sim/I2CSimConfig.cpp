@@ -0,0 +1,85 @@
+#include "I2CSimBus.h"
+#include <stdlib.h>
+#include <string.h>
+
+// JSON descriptions for simulated devices. Common keys: "type", "address" (hex string or
+// number), "ten_bit", and the timing model "latency_us", "stretch_us", "stretch_probability".
+//
+//   {"type": "registers", "address": "0x20", "values": {"0x0f": 51}, "auto_increment": true}
+//   {"type": "eeprom", "address": "0x50", "size": 4096, "page_size": 32, "write_cycle_us": 5000}
+//   {"type": "temperature", "address": "0x48", "conversion_us": 100000, "celsius": 21.5, "hold": false}
+//   {"type": "imu", "address": "0x68", "rate_hz": 1000, "fifo_size": 1024}
+//   {"type": "mux", "address": "0x70", "channels": [[...devices on channel 0...], [...]]}
+
+static uint16_t parseAddress(JsonVariantConst config, uint16_t fallback) {
+    uint16_t address = fallback;
+    JsonVariantConst value = config["address"];
+    if (value.is<const char*>()) {
+        address = strtol(value.as<const char*>(), NULL, 16);
+    } else if (value.is<int>()) {
+        address = value.as<int>();
+    }
+    if (config["ten_bit"] | false) {
+        address |= I2C_SIM_ADDR_10BIT;
+    }
+    return address;
+}
+
+I2CSimDevice* I2CSimDevice::fromJson(JsonVariantConst config) {
+    const char* type = config["type"] | "";
+    I2CSimDevice* device = nullptr;
+
+    if (strcmp(type, "registers") == 0) {
+        I2CSimRegisterFile* registers = new I2CSimRegisterFile(parseAddress(config, 0x20));
+        for (JsonPairConst value : config["values"].as<JsonObjectConst>()) {
+            registers->setRegister(strtol(value.key().c_str(), NULL, 16), value.value().as<uint8_t>());
+        }
+        registers->setAutoIncrement(config["auto_increment"] | true);
+        device = registers;
+    } else if (strcmp(type, "eeprom") == 0) {
+        device = new I2CSimEeprom(parseAddress(config, 0x50), config["size"] | 256, config["page_size"] | 8,
+                                  config["write_cycle_us"] | 5000);
+    } else if (strcmp(type, "temperature") == 0) {
+        I2CSimTemperatureSensor* sensor = new I2CSimTemperatureSensor(parseAddress(config, 0x48),
+                                                                      config["conversion_us"] | 100000, config["hold"] | false);
+        sensor->setTemperature(config["celsius"] | 25.0f);
+        device = sensor;
+    } else if (strcmp(type, "imu") == 0) {
+        device = new I2CSimImu(parseAddress(config, 0x68), config["rate_hz"] | 1000, config["fifo_size"] | 1024);
+    } else if (strcmp(type, "mux") == 0) {
+        I2CSimMux* mux = new I2CSimMux(parseAddress(config, 0x70));
+        uint8_t channel = 0;
+        for (JsonVariantConst devices : config["channels"].as<JsonArrayConst>()) {
+            for (JsonVariantConst child_config : devices.as<JsonArrayConst>()) {
+                I2CSimDevice* child = fromJson(child_config);
+                if (!child || !mux->attach(channel, child, true)) {
+                    delete child;
+                    delete mux;
+                    return nullptr;
+                }
+            }
+            channel++;
+        }
+        device = mux;
+    }
+
+    if (device) {
+        device->setTiming(config["latency_us"] | 0, config["stretch_us"] | 0, config["stretch_probability"] | 0.0f);
+    }
+    return device;
+}
+
+bool I2CSimBus::configure(JsonVariantConst config) {
+    setFrequency(config["frequency"] | getFrequency());
+    setTimeoutUs(config["timeout_us"] | timeout_us);
+    setSeed(config["seed"] | rng_state);
+
+    for (JsonVariantConst device_config : config["devices"].as<JsonArrayConst>()) {
+        I2CSimDevice* device = I2CSimDevice::fromJson(device_config);
+        if (!device) {
+            return false;
+        }
+        attach(device, true);
+    }
+    return true;
+}
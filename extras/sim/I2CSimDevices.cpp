@@ -0,0 +1,336 @@
+#include "I2CSimDevices.h"
+#include <math.h>
+#include <string.h>
+
+uint64_t I2CSimClock::now_ns = 0;
+
+void I2CSimDevice::setTiming(uint32_t latency_us, uint32_t stretch_us, float stretch_probability) {
+    timing.latency_us = latency_us;
+    timing.stretch_us = stretch_us;
+    timing.stretch_probability = stretch_probability;
+}
+
+I2CSimDevice* I2CSimDevice::route(uint16_t target) {
+    return target == address ? this : nullptr;
+}
+
+// ---- Register file
+
+I2CSimRegisterFile::I2CSimRegisterFile(uint16_t address)
+    : I2CSimDevice(address), pointer(0), pointer_pending(false), auto_increment(true) {
+    memset(registers, 0, sizeof(registers));
+}
+
+bool I2CSimRegisterFile::onAddress(bool read, uint64_t now_us) {
+    // A write starts with the register pointer; a read continues from the current one
+    pointer_pending = !read;
+    return true;
+}
+
+bool I2CSimRegisterFile::onWrite(uint8_t data, uint64_t now_us) {
+    if (pointer_pending) {
+        pointer = data;
+        pointer_pending = false;
+        return true;
+    }
+
+    writeRegister(pointer, data, now_us);
+    if (incrementsAfter(pointer)) {
+        pointer++;
+    }
+    return true;
+}
+
+uint8_t I2CSimRegisterFile::onRead(uint64_t now_us) {
+    uint8_t value = readRegister(pointer, now_us);
+    if (incrementsAfter(pointer)) {
+        pointer++;
+    }
+    return value;
+}
+
+// ---- 24Cxx EEPROM
+
+I2CSimEeprom::I2CSimEeprom(uint16_t address, size_t size, uint16_t page_size, uint32_t write_cycle_us)
+    : I2CSimDevice(address), memory(size ? size : 1, 0xFF), page_size(page_size ? page_size : 1),
+      write_cycle_us(write_cycle_us), address_bytes(size > 2048 ? 2 : 1), block_mask(0), routed_block(0),
+      address_bytes_pending(0), pointer(0), written(false), busy_until_us(0) {
+    if (size > 256 && size <= 2048) {
+        block_mask = (size / 256) - 1;
+    }
+}
+
+I2CSimDevice* I2CSimEeprom::route(uint16_t target) {
+    if (target & I2C_SIM_ADDR_10BIT) {
+        return target == address ? this : nullptr;
+    }
+    if ((target & ~block_mask) != address) {
+        return nullptr;
+    }
+    routed_block = target & block_mask;
+    return this;
+}
+
+bool I2CSimEeprom::onAddress(bool read, uint64_t now_us) {
+    // Acknowledge polling: the part ignores its address until the write cycle completes
+    if (isBusy(now_us)) {
+        return false;
+    }
+    if (!read) {
+        address_bytes_pending = address_bytes;
+        written = false;
+    }
+    return true;
+}
+
+bool I2CSimEeprom::onWrite(uint8_t data, uint64_t now_us) {
+    if (address_bytes_pending) {
+        if (address_bytes == 2) {
+            pointer = address_bytes_pending == 2 ? data : ((pointer << 8) | data);
+        } else {
+            pointer = ((uint32_t)routed_block << 8) | data;
+        }
+        address_bytes_pending--;
+        pointer %= memory.size();
+        return true;
+    }
+
+    // Page writes wrap at the page boundary rather than running into the next page
+    uint32_t page_base = pointer - (pointer % page_size);
+    memory[pointer] = data;
+    pointer = page_base + ((pointer - page_base + 1) % page_size);
+    if (pointer >= memory.size()) {
+        pointer = page_base;
+    }
+    written = true;
+    return true;
+}
+
+uint8_t I2CSimEeprom::onRead(uint64_t now_us) {
+    uint8_t value = memory[pointer];
+    pointer = (pointer + 1) % memory.size();
+    return value;
+}
+
+void I2CSimEeprom::onStop(uint64_t now_us) {
+    if (written) {
+        busy_until_us = now_us + write_cycle_us;
+        written = false;
+    }
+}
+
+// ---- Temperature sensor
+
+I2CSimTemperatureSensor::I2CSimTemperatureSensor(uint16_t address, uint32_t conversion_us, bool hold)
+    : I2CSimRegisterFile(address), temperature(25.0f), conversion_us(conversion_us ? conversion_us : 1), hold(hold),
+      converting(true), conversion_done_us(I2CSimClock::nowUs() + this->conversion_us) {
+}
+
+void I2CSimTemperatureSensor::update(uint64_t now_us) {
+    if (!converting || now_us < conversion_done_us) {
+        return;
+    }
+
+    latch();
+    if (registers[REG_CONFIG] & CONFIG_ONE_SHOT) {
+        converting = false;
+        return;
+    }
+    // Continuous mode: skip the conversions that completed unobserved
+    uint64_t periods = (now_us - conversion_done_us) / conversion_us + 1;
+    conversion_done_us += periods * conversion_us;
+}
+
+void I2CSimTemperatureSensor::latch() {
+    int16_t raw = (int16_t)lroundf(temperature / 0.0625f);
+    uint16_t left_justified = (uint16_t)raw << 4;
+    registers[REG_TEMPERATURE] = left_justified >> 8;
+    registers[REG_TEMPERATURE + 1] = left_justified & 0xFF;
+    registers[REG_CONFIG] |= CONFIG_READY;
+}
+
+uint32_t I2CSimTemperatureSensor::stretchBeforeByte(bool read, uint64_t now_us) {
+    // Hold-master reads: stretch SCL from the first temperature byte until the result is in
+    if (!hold || !read || pointer != REG_TEMPERATURE || !converting || now_us >= conversion_done_us) {
+        return 0;
+    }
+    return conversion_done_us - now_us;
+}
+
+uint8_t I2CSimTemperatureSensor::readRegister(uint8_t reg, uint64_t now_us) {
+    update(now_us);
+    uint8_t value = registers[reg];
+    if (reg == REG_TEMPERATURE) {
+        registers[REG_CONFIG] &= ~CONFIG_READY;
+    }
+    return value;
+}
+
+void I2CSimTemperatureSensor::writeRegister(uint8_t reg, uint8_t value, uint64_t now_us) {
+    if (reg != REG_CONFIG) {
+        return; // the result registers are read-only
+    }
+
+    update(now_us);
+    registers[REG_CONFIG] = (value & CONFIG_ONE_SHOT) | (registers[REG_CONFIG] & CONFIG_READY);
+    if (value & CONFIG_ONE_SHOT) {
+        if (value & CONFIG_START) {
+            converting = true;
+            conversion_done_us = now_us + conversion_us;
+            registers[REG_CONFIG] &= ~CONFIG_READY;
+        }
+    } else if (!converting) {
+        // Back to continuous mode
+        converting = true;
+        conversion_done_us = now_us + conversion_us;
+    }
+}
+
+// ---- IMU with FIFO
+
+I2CSimImu::I2CSimImu(uint16_t address, uint32_t rate_hz, size_t fifo_size)
+    : I2CSimRegisterFile(address), rate_hz(rate_hz ? rate_hz : 1), fifo_size(fifo_size - fifo_size % FRAME_SIZE),
+      fifo_enabled_us(I2CSimClock::nowUs()), frames_produced(0), next_index(0), dropped_frames(0), data_ready(false) {
+    registers[REG_WHO_AM_I] = 0x68;
+    registers[REG_USER_CTRL] = USER_CTRL_FIFO_EN;
+    generator = [](uint32_t index, int16_t accel[3]) {
+        accel[0] = (int16_t)(index & 0x7FFF);
+        accel[1] = -accel[0];
+        accel[2] = 16384; // 1 g at +/-2 g full scale
+    };
+}
+
+void I2CSimImu::update(uint64_t now_us) {
+    if (!(registers[REG_USER_CTRL] & USER_CTRL_FIFO_EN) || now_us < fifo_enabled_us) {
+        return;
+    }
+
+    uint64_t due = (now_us - fifo_enabled_us) * rate_hz / 1000000;
+    if (due <= frames_produced) {
+        return;
+    }
+
+    // Frames that would be pushed straight out again are only counted
+    uint64_t backlog = due - frames_produced;
+    uint64_t capacity = fifo_size / FRAME_SIZE;
+    if (backlog > capacity + 1) {
+        uint64_t skipped = backlog - capacity - 1;
+        dropped_frames += skipped;
+        next_index += skipped;
+        frames_produced += skipped;
+        registers[REG_INT_STATUS] |= INT_FIFO_OVERFLOW;
+    }
+    while (frames_produced < due) {
+        pushFrame();
+        frames_produced++;
+    }
+    data_ready = true;
+}
+
+void I2CSimImu::pushFrame() {
+    if (fifo_size < FRAME_SIZE) {
+        dropped_frames++;
+        next_index++;
+        return;
+    }
+    if (fifo.size() + FRAME_SIZE > fifo_size) {
+        fifo.erase(fifo.begin(), fifo.begin() + FRAME_SIZE);
+        dropped_frames++;
+        registers[REG_INT_STATUS] |= INT_FIFO_OVERFLOW;
+    }
+
+    int16_t accel[3];
+    generator(next_index++, accel);
+    for (uint8_t axis = 0; axis < 3; axis++) {
+        fifo.push_back((uint16_t)accel[axis] >> 8);
+        fifo.push_back((uint16_t)accel[axis] & 0xFF);
+    }
+}
+
+uint8_t I2CSimImu::readRegister(uint8_t reg, uint64_t now_us) {
+    update(now_us);
+
+    switch (reg) {
+        case REG_INT_STATUS: {
+            uint8_t status = registers[REG_INT_STATUS] | (data_ready ? INT_DATA_READY : 0);
+            registers[REG_INT_STATUS] = 0;
+            data_ready = false;
+            return status;
+        }
+        case REG_FIFO_COUNT_H:
+            return fifo.size() >> 8;
+        case REG_FIFO_COUNT_L:
+            return fifo.size() & 0xFF;
+        case REG_FIFO_R_W: {
+            if (fifo.empty()) {
+                return 0xFF;
+            }
+            uint8_t value = fifo.front();
+            fifo.pop_front();
+            return value;
+        }
+        default:
+            return registers[reg];
+    }
+}
+
+void I2CSimImu::writeRegister(uint8_t reg, uint8_t value, uint64_t now_us) {
+    if (reg == REG_WHO_AM_I || reg == REG_FIFO_COUNT_H || reg == REG_FIFO_COUNT_L || reg == REG_INT_STATUS) {
+        return;
+    }
+    if (reg != REG_USER_CTRL) {
+        registers[reg] = value;
+        return;
+    }
+
+    update(now_us);
+    bool was_enabled = registers[REG_USER_CTRL] & USER_CTRL_FIFO_EN;
+    if (value & USER_CTRL_FIFO_RESET) {
+        fifo.clear();
+    }
+    registers[REG_USER_CTRL] = value & ~USER_CTRL_FIFO_RESET; // self-clearing
+    if (!was_enabled && (value & USER_CTRL_FIFO_EN)) {
+        fifo_enabled_us = now_us;
+        frames_produced = 0;
+    }
+}
+
+// ---- Mux
+
+I2CSimMux::I2CSimMux(uint16_t address) : I2CSimDevice(address), control(0) {
+}
+
+I2CSimMux::~I2CSimMux() {
+    for (I2CSimDevice* device : owned_devices) {
+        delete device;
+    }
+}
+
+bool I2CSimMux::attach(uint8_t channel, I2CSimDevice* device, bool owned) {
+    if (channel >= CHANNELS || !device) {
+        return false;
+    }
+    channels[channel].push_back(device);
+    if (owned) {
+        owned_devices.push_back(device);
+    }
+    return true;
+}
+
+I2CSimDevice* I2CSimMux::route(uint16_t target) {
+    if (target == address) {
+        return this;
+    }
+    for (uint8_t channel = 0; channel < CHANNELS; channel++) {
+        if (!(control & (1 << channel))) {
+            continue;
+        }
+        for (I2CSimDevice* device : channels[channel]) {
+            I2CSimDevice* routed = device->route(target);
+            if (routed) {
+                return routed;
+            }
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,226 @@
+#ifndef I2C_SIM_DEVICES_H
+#define I2C_SIM_DEVICES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <functional>
+#include <vector>
+#include <ArduinoJson.h>
+
+// Simulated I2C targets for host-side benchmarks. Devices are driven byte by byte by
+// I2CSimBus; all times are simulated bus time in microseconds.
+
+// 10-bit addresses use the same flag as FlexibleI2C::ADDR_10BIT
+#define I2C_SIM_ADDR_10BIT 0x8000
+
+// Simulated time shared by every bus and device. A host Arduino shim should back
+// micros()/millis()/delay() with it so library timestamps follow bus time.
+class I2CSimClock {
+public:
+    static uint64_t nowNs() { return now_ns; }
+    static uint64_t nowUs() { return now_ns / 1000; }
+    static void advanceNs(uint64_t ns) { now_ns += ns; }
+    static void advanceUs(uint64_t us) { now_ns += us * 1000; }
+
+private:
+    static uint64_t now_ns;
+};
+
+struct I2CSimTiming {
+    uint32_t latency_us;          // clock stretch after the address byte (fetching the first byte)
+    uint32_t stretch_us;          // clock stretch before a data byte, when one occurs
+    float stretch_probability;    // chance of a stretch on each data byte
+
+    I2CSimTiming() : latency_us(0), stretch_us(0), stretch_probability(0) {}
+};
+
+class I2CSimDevice {
+public:
+    explicit I2CSimDevice(uint16_t address) : address(address) {}
+    virtual ~I2CSimDevice() {}
+
+    uint16_t getAddress() const { return address; }
+    const I2CSimTiming& getTiming() const { return timing; }
+    void setTiming(uint32_t latency_us, uint32_t stretch_us = 0, float stretch_probability = 0);
+
+    // The device that answers `target` at or behind this one: this, a mux child, or nullptr
+    virtual I2CSimDevice* route(uint16_t target);
+
+    // Transaction callbacks. Returning false from onAddress/onWrite NACKs that byte.
+    virtual bool onAddress(bool read, uint64_t now_us) { return true; }
+    virtual bool onWrite(uint8_t data, uint64_t now_us) { return true; }
+    virtual uint8_t onRead(uint64_t now_us) { return 0xFF; }
+    virtual void onStop(uint64_t now_us) {}
+
+    // Behaviour-driven clock stretch before the next byte, on top of the timing model
+    virtual uint32_t stretchBeforeByte(bool read, uint64_t now_us) { return 0; }
+
+    // Build a device from a JSON description (see I2CSimConfig.cpp); nullptr if invalid
+    static I2CSimDevice* fromJson(JsonVariantConst config);
+
+protected:
+    uint16_t address;
+    I2CSimTiming timing;
+};
+
+// 256 byte-wide registers behind an 8-bit pointer. The first byte of a write sets the
+// pointer; data bytes and reads auto-increment it.
+class I2CSimRegisterFile : public I2CSimDevice {
+public:
+    explicit I2CSimRegisterFile(uint16_t address);
+
+    void setRegister(uint8_t reg, uint8_t value) { registers[reg] = value; }
+    uint8_t getRegister(uint8_t reg) const { return registers[reg]; }
+    void setAutoIncrement(bool enabled) { auto_increment = enabled; }
+
+    bool onAddress(bool read, uint64_t now_us) override;
+    bool onWrite(uint8_t data, uint64_t now_us) override;
+    uint8_t onRead(uint64_t now_us) override;
+
+protected:
+    uint8_t registers[256];
+    uint8_t pointer;
+    bool pointer_pending;
+    bool auto_increment;
+
+    // Hooks for devices built on the register file
+    virtual uint8_t readRegister(uint8_t reg, uint64_t now_us) { return registers[reg]; }
+    virtual void writeRegister(uint8_t reg, uint8_t value, uint64_t now_us) { registers[reg] = value; }
+    virtual bool incrementsAfter(uint8_t reg) { return auto_increment; }
+};
+
+// 24Cxx EEPROM. Up to 256 bytes uses one address byte; 24C04..24C16 add block bits to the
+// device address; 24C32 and larger use two address bytes. Writes wrap within a page and
+// the part NACKs its address for write_cycle_us after each write.
+class I2CSimEeprom : public I2CSimDevice {
+public:
+    I2CSimEeprom(uint16_t address = 0x50, size_t size = 256, uint16_t page_size = 8, uint32_t write_cycle_us = 5000);
+
+    uint8_t* data() { return memory.data(); }
+    size_t size() const { return memory.size(); }
+    bool isBusy(uint64_t now_us) const { return now_us < busy_until_us; }
+
+    I2CSimDevice* route(uint16_t target) override;
+    bool onAddress(bool read, uint64_t now_us) override;
+    bool onWrite(uint8_t data, uint64_t now_us) override;
+    uint8_t onRead(uint64_t now_us) override;
+    void onStop(uint64_t now_us) override;
+
+private:
+    std::vector<uint8_t> memory;
+    uint16_t page_size;
+    uint32_t write_cycle_us;
+    uint8_t address_bytes;
+    uint8_t block_mask;           // device address bits used as memory address bits
+    uint8_t routed_block;
+    uint8_t address_bytes_pending;
+    uint32_t pointer;
+    bool written;
+    uint64_t busy_until_us;
+};
+
+// Temperature sensor with a conversion delay, TMP102-like register map:
+//   0x00/0x01 temperature, 12-bit left-justified, 0.0625 C per LSB
+//   0x02 config: bit 0 one-shot start, bit 1 one-shot mode, bit 7 result ready
+// In continuous mode a conversion completes every conversion_us. With hold enabled, reading
+// the temperature during a conversion stretches the clock until the result is ready.
+class I2CSimTemperatureSensor : public I2CSimRegisterFile {
+public:
+    static const uint8_t REG_TEMPERATURE = 0x00;
+    static const uint8_t REG_CONFIG = 0x02;
+    static const uint8_t CONFIG_START = 0x01;
+    static const uint8_t CONFIG_ONE_SHOT = 0x02;
+    static const uint8_t CONFIG_READY = 0x80;
+
+    I2CSimTemperatureSensor(uint16_t address = 0x48, uint32_t conversion_us = 100000, bool hold = false);
+
+    void setTemperature(float celsius) { temperature = celsius; }
+
+    uint32_t stretchBeforeByte(bool read, uint64_t now_us) override;
+
+protected:
+    uint8_t readRegister(uint8_t reg, uint64_t now_us) override;
+    void writeRegister(uint8_t reg, uint8_t value, uint64_t now_us) override;
+
+private:
+    float temperature;
+    uint32_t conversion_us;
+    bool hold;
+    bool converting;
+    uint64_t conversion_done_us;
+
+    void update(uint64_t now_us);
+    void latch();
+};
+
+// IMU with a sample FIFO, MPU-6050-like register map. Frames are 6 bytes (accel X/Y/Z,
+// big-endian) produced at rate_hz while the FIFO is enabled. When the FIFO is full the
+// oldest frame is dropped and the overflow flag set (cleared by reading INT_STATUS).
+class I2CSimImu : public I2CSimRegisterFile {
+public:
+    static const uint8_t REG_INT_STATUS = 0x3A;
+    static const uint8_t REG_USER_CTRL = 0x6A;
+    static const uint8_t REG_FIFO_COUNT_H = 0x72;
+    static const uint8_t REG_FIFO_COUNT_L = 0x73;
+    static const uint8_t REG_FIFO_R_W = 0x74;
+    static const uint8_t REG_WHO_AM_I = 0x75;
+    static const uint8_t INT_FIFO_OVERFLOW = 0x10;
+    static const uint8_t INT_DATA_READY = 0x01;
+    static const uint8_t USER_CTRL_FIFO_EN = 0x40;
+    static const uint8_t USER_CTRL_FIFO_RESET = 0x04;
+    static const uint8_t FRAME_SIZE = 6;
+
+    // Fills one frame for sample `index`; the default encodes the index so drops are visible
+    typedef std::function<void(uint32_t index, int16_t accel[3])> SampleGenerator;
+
+    I2CSimImu(uint16_t address = 0x68, uint32_t rate_hz = 1000, size_t fifo_size = 1024);
+
+    void setGenerator(SampleGenerator generator) { this->generator = generator; }
+    size_t getFifoLevel() const { return fifo.size(); }
+    uint32_t getDroppedFrames() const { return dropped_frames; }
+
+protected:
+    uint8_t readRegister(uint8_t reg, uint64_t now_us) override;
+    void writeRegister(uint8_t reg, uint8_t value, uint64_t now_us) override;
+    bool incrementsAfter(uint8_t reg) override { return reg != REG_FIFO_R_W && auto_increment; }
+
+private:
+    uint32_t rate_hz;
+    size_t fifo_size;
+    std::deque<uint8_t> fifo;
+    SampleGenerator generator;
+    uint64_t fifo_enabled_us;     // sample times are counted from here
+    uint32_t frames_produced;     // since the FIFO was enabled
+    uint32_t next_index;
+    uint32_t dropped_frames;
+    bool data_ready;
+
+    void update(uint64_t now_us);
+    void pushFrame();
+};
+
+// TCA9548A-style 8-channel mux. Writing the control byte selects channels; devices on the
+// selected channels answer through route().
+class I2CSimMux : public I2CSimDevice {
+public:
+    static const uint8_t CHANNELS = 8;
+
+    explicit I2CSimMux(uint16_t address = 0x70);
+    ~I2CSimMux() override;
+
+    // Owned devices are deleted with the mux
+    bool attach(uint8_t channel, I2CSimDevice* device, bool owned = false);
+    uint8_t getControl() const { return control; }
+
+    I2CSimDevice* route(uint16_t target) override;
+    bool onWrite(uint8_t data, uint64_t now_us) override { control = data; return true; }
+    uint8_t onRead(uint64_t now_us) override { return control; }
+
+private:
+    uint8_t control;
+    std::vector<I2CSimDevice*> channels[CHANNELS];
+    std::vector<I2CSimDevice*> owned_devices;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "I2CSimFaults.h"
+#include <stdlib.h>
+#include <string.h>
+
+I2CSimFaultInjector::I2CSimFaultInjector(I2CSimBus& inner)
+    : I2CSimBus(inner.getFrequency()), inner(inner), stuck(false), stuck_until_us(0), ten_bit_address(0) {
+    timeout_us = inner.getTimeoutUs();
+    resetInjected();
+}
+
+void I2CSimFaultInjector::addFault(const Fault& fault) {
+    FaultState state;
+    state.fault = fault;
+    state.transactions = 0;
+    state.burst_remaining = 0;
+    faults.push_back(state);
+}
+
+void I2CSimFaultInjector::clearFaults() {
+    faults.clear();
+    stuck = false;
+}
+
+uint32_t I2CSimFaultInjector::getInjectedTotal() const {
+    uint32_t total = 0;
+    for (uint8_t type = 0; type < FAULT_TYPES; type++) {
+        total += injected[type];
+    }
+    return total;
+}
+
+void I2CSimFaultInjector::resetInjected() {
+    memset(injected, 0, sizeof(injected));
+}
+
+void I2CSimFaultInjector::setFrequency(uint32_t frequency) {
+    I2CSimBus::setFrequency(frequency);
+    inner.setFrequency(frequency);
+}
+
+void I2CSimFaultInjector::setTimeoutUs(uint32_t timeout_us) {
+    I2CSimBus::setTimeoutUs(timeout_us);
+    inner.setTimeoutUs(timeout_us);
+}
+
+void I2CSimFaultInjector::onBusReset() {
+    stuck = false;
+    inner.onBusReset();
+}
+
+const I2CSimFaultInjector::Fault* I2CSimFaultInjector::nextFault(uint16_t address, bool read) {
+    const Fault* fired = nullptr;
+    for (FaultState& state : faults) {
+        const Fault& fault = state.fault;
+        if (fault.address != ANY_ADDRESS && fault.address != address) {
+            continue;
+        }
+        if ((fault.type == CORRUPT_READ && !read) || (fault.type == DATA_NACK && read)) {
+            continue;
+        }
+
+        // Every fault sees every transaction so patterns stay aligned; the first one fires
+        state.transactions++;
+        bool fire = false;
+        if (state.burst_remaining) {
+            state.burst_remaining--;
+            fire = true;
+        } else if ((fault.every_n && state.transactions % fault.every_n == 0) ||
+                   (fault.probability > 0 && random() < fault.probability)) {
+            state.burst_remaining = fault.burst_length - 1;
+            fire = true;
+        }
+        if (fire && !fired) {
+            fired = &fault;
+        }
+    }
+    return fired;
+}
+
+bool I2CSimFaultInjector::checkStuck() {
+    if (stuck && I2CSimClock::nowUs() >= stuck_until_us) {
+        stuck = false;
+    }
+    return stuck;
+}
+
+void I2CSimFaultInjector::failTimeout() {
+    // The controller waits out its timeout before reporting the failure
+    advance(timing_model.startNs() + (uint64_t)timeout_us * 1000 + timing_model.stopNs() + timing_model.busFreeNs());
+}
+
+uint8_t I2CSimFaultInjector::transmit(uint8_t address, const uint8_t* data, size_t length, bool stop) {
+    if (checkStuck()) {
+        failTimeout();
+        return 5;
+    }
+
+    uint16_t target = address;
+    if ((address & 0x7C) == 0x78 && length > 0) {
+        target = I2C_SIM_ADDR_10BIT | ((uint16_t)(address & 0x03) << 8) | data[0];
+        ten_bit_address = target;
+    }
+
+    const Fault* fault = nextFault(target, false);
+    if (!fault) {
+        return inner.transmit(address, data, length, stop);
+    }
+
+    injected[fault->type]++;
+    switch (fault->type) {
+        case ADDRESS_NACK:
+            advance(timing_model.transactionNs(1, 1));
+            return 2;
+        case DATA_NACK:
+            advance(timing_model.transactionNs(2, 1));
+            return 2;
+        case STUCK_BUS:
+            stuck = true;
+            stuck_until_us = I2CSimClock::nowUs() + fault->stuck_us;
+            failTimeout();
+            return 5;
+        case TIMEOUT:
+        default:
+            failTimeout();
+            return 5;
+    }
+}
+
+size_t I2CSimFaultInjector::receive(uint8_t address, uint8_t* data, size_t length, bool stop) {
+    if (checkStuck()) {
+        failTimeout();
+        return 0;
+    }
+
+    uint16_t target = (address & 0x7C) == 0x78 ? ten_bit_address : address;
+    const Fault* fault = nextFault(target, true);
+    if (!fault) {
+        return inner.receive(address, data, length, stop);
+    }
+
+    injected[fault->type]++;
+    switch (fault->type) {
+        case CORRUPT_READ: {
+            size_t received = inner.receive(address, data, length, stop);
+            if (received) {
+                uint32_t bit = (uint32_t)(random() * received * 8) % (received * 8);
+                data[bit / 8] ^= 1 << (bit % 8);
+            }
+            return received;
+        }
+        case ADDRESS_NACK:
+            advance(timing_model.transactionNs(1, 1));
+            return 0;
+        case STUCK_BUS:
+            stuck = true;
+            stuck_until_us = I2CSimClock::nowUs() + fault->stuck_us;
+            failTimeout();
+            return 0;
+        case TIMEOUT:
+        default:
+            failTimeout();
+            return 0;
+    }
+}
+
+bool I2CSimFaultInjector::configureFaults(JsonVariantConst config) {
+    static const char* const type_names[FAULT_TYPES] = { "nack", "data_nack", "timeout", "stuck", "corrupt" };
+
+    setSeed(config["seed"] | rng_state);
+    for (JsonVariantConst entry : config["faults"].as<JsonArrayConst>()) {
+        const char* name = entry["type"] | "";
+        int type = -1;
+        for (uint8_t i = 0; i < FAULT_TYPES; i++) {
+            if (strcmp(name, type_names[i]) == 0) {
+                type = i;
+            }
+        }
+        if (type < 0) {
+            return false;
+        }
+
+        uint16_t address = ANY_ADDRESS;
+        JsonVariantConst value = entry["address"];
+        if (value.is<const char*>()) {
+            address = strtol(value.as<const char*>(), NULL, 16);
+        } else if (value.is<int>()) {
+            address = value.as<int>();
+        }
+        if (address != ANY_ADDRESS && (entry["ten_bit"] | false)) {
+            address |= I2C_SIM_ADDR_10BIT;
+        }
+
+        addFault(Fault(static_cast<FaultType>(type), address, entry["probability"] | 0.0f, entry["every_n"] | 0,
+                       entry["burst"] | 1, entry["stuck_us"] | 100000));
+    }
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef I2C_SIM_FAULTS_H
+#define I2C_SIM_FAULTS_H
+
+#include "I2CSimBus.h"
+
+// Fault-injection wrapper around a simulated bus. Attach TwoWire to the injector instead of
+// the bus; transactions pass through unless a configured fault fires for the target.
+//
+// Faults fire with a probability per transaction and/or on a fixed pattern (every Nth
+// transaction to the target), and once triggered last for a burst of consecutive
+// transactions. A stuck bus holds SDA low for stuck_us, failing every transaction, until it
+// times out or the controller is re-initialized (FlexibleI2C::recoverBus does both the
+// clocking and the re-initialization).
+class I2CSimFaultInjector : public I2CSimBus {
+public:
+    static const uint16_t ANY_ADDRESS = 0xFFFF;
+
+    enum FaultType {
+        ADDRESS_NACK = 0,
+        DATA_NACK = 1,
+        TIMEOUT = 2,
+        STUCK_BUS = 3,
+        CORRUPT_READ = 4,         // flips one bit of the data read back
+        FAULT_TYPES = 5
+    };
+
+    struct Fault {
+        FaultType type;
+        uint16_t address;         // ANY_ADDRESS for every target
+        float probability;        // chance per transaction of starting a burst
+        uint32_t every_n;         // also start a burst on every Nth transaction (0 = off)
+        uint16_t burst_length;    // transactions affected per burst
+        uint32_t stuck_us;        // STUCK_BUS: time SDA stays low without a recovery
+
+        Fault(FaultType type = ADDRESS_NACK, uint16_t address = ANY_ADDRESS, float probability = 0,
+              uint32_t every_n = 0, uint16_t burst_length = 1, uint32_t stuck_us = 100000)
+            : type(type), address(address), probability(probability), every_n(every_n),
+              burst_length(burst_length ? burst_length : 1), stuck_us(stuck_us) {}
+    };
+
+    explicit I2CSimFaultInjector(I2CSimBus& inner);
+
+    void addFault(const Fault& fault);
+    void clearFaults();
+
+    // {"seed": 7, "faults": [{"type": "nack", "address": "0x50", "probability": 0.01, "burst": 3}]}
+    // Types: nack, data_nack, timeout, stuck, corrupt; "every_n" and "stuck_us" as in Fault.
+    bool configureFaults(JsonVariantConst config);
+
+    bool isStuck() const { return stuck; }
+    uint32_t getInjected(FaultType type) const { return injected[type]; }
+    uint32_t getInjectedTotal() const;
+    void resetInjected();
+
+    void setFrequency(uint32_t frequency) override;
+    void setTimeoutUs(uint32_t timeout_us) override;
+    void onBusReset() override;
+    uint8_t transmit(uint8_t address, const uint8_t* data, size_t length, bool stop) override;
+    size_t receive(uint8_t address, uint8_t* data, size_t length, bool stop) override;
+
+private:
+    struct FaultState {
+        Fault fault;
+        uint32_t transactions;    // to this fault's target, for every_n
+        uint16_t burst_remaining;
+    };
+
+    I2CSimBus& inner;
+    std::vector<FaultState> faults;
+    bool stuck;
+    uint64_t stuck_until_us;
+    uint16_t ten_bit_address;     // last 10-bit target addressed, for header-only reads
+    uint32_t injected[FAULT_TYPES];
+
+    const Fault* nextFault(uint16_t address, bool read);
+    bool checkStuck();
+    void failTimeout();
+};
+
+#endif
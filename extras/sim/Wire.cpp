@@ -0,0 +1,105 @@
+#include "Wire.h"
+
+TwoWire Wire(0);
+TwoWire Wire1(1);
+
+TwoWire::TwoWire(uint8_t bus_num)
+    : bus_num(bus_num), sim_bus(nullptr), initialized(false), clock(100000), timeout_ms(50),
+      tx_address(0), tx_length(0), tx_overflow(false), rx_length(0), rx_index(0) {
+}
+
+bool TwoWire::begin(int sda, int scl, uint32_t frequency) {
+    initialized = true;
+    setClock(frequency ? frequency : clock);
+    setTimeOut(timeout_ms);
+    if (sim_bus) {
+        sim_bus->onBusReset();
+    }
+    return true;
+}
+
+bool TwoWire::begin(uint8_t address, int sda, int scl, uint32_t frequency) {
+    return false;
+}
+
+bool TwoWire::end() {
+    initialized = false;
+    return true;
+}
+
+bool TwoWire::setClock(uint32_t frequency) {
+    clock = frequency;
+    if (sim_bus) {
+        sim_bus->setFrequency(frequency);
+    }
+    return true;
+}
+
+void TwoWire::setTimeOut(uint16_t timeout_ms) {
+    this->timeout_ms = timeout_ms;
+    if (sim_bus) {
+        sim_bus->setTimeoutUs((uint32_t)timeout_ms * 1000);
+    }
+}
+
+void TwoWire::beginTransmission(uint16_t address) {
+    tx_address = address;
+    tx_length = 0;
+    tx_overflow = false;
+}
+
+uint8_t TwoWire::endTransmission(bool stop) {
+    if (!initialized) {
+        return 4;
+    }
+    if (tx_overflow) {
+        return 1;
+    }
+    if (!sim_bus) {
+        return 2; // an empty bus
+    }
+    return sim_bus->transmit(tx_address, tx_buffer, tx_length, stop);
+}
+
+size_t TwoWire::requestFrom(uint16_t address, size_t quantity, bool stop) {
+    rx_length = 0;
+    rx_index = 0;
+    if (!initialized || !sim_bus || quantity == 0) {
+        return 0;
+    }
+    if (quantity > I2C_BUFFER_LENGTH) {
+        quantity = I2C_BUFFER_LENGTH;
+    }
+    rx_length = sim_bus->receive(address, rx_buffer, quantity, stop);
+    return rx_length;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (tx_length >= I2C_BUFFER_LENGTH) {
+        tx_overflow = true;
+        return 0;
+    }
+    tx_buffer[tx_length++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (!write(data[i])) {
+            return i;
+        }
+    }
+    return length;
+}
+
+int TwoWire::available() {
+    return rx_length - rx_index;
+}
+
+int TwoWire::read() {
+    return rx_index < rx_length ? rx_buffer[rx_index++] : -1;
+}
+
+int TwoWire::peek() {
+    return rx_index < rx_length ? rx_buffer[rx_index] : -1;
+}
@@ -0,0 +1,75 @@
+#ifndef TwoWire_h
+#define TwoWire_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include "I2CSimBus.h"
+
+#ifndef I2C_BUFFER_LENGTH
+#define I2C_BUFFER_LENGTH 128
+#endif
+
+// Host-side stand-in for the ESP32 TwoWire driver, backed by an I2CSimBus. Put this
+// directory ahead of the Arduino core on the include path, with the library root after it
+// (for I2CTimingModel), and attach a bus:
+//
+//   I2CSimBus bus(400000);
+//   bus.attach(new I2CSimEeprom(0x50, 4096, 32), true);
+//   Wire.attach(&bus);
+//
+// Only controller mode is simulated; begin() in target mode fails.
+class TwoWire {
+public:
+    explicit TwoWire(uint8_t bus_num);
+
+    void attach(I2CSimBus* bus) { sim_bus = bus; }
+    I2CSimBus* getSimBus() const { return sim_bus; }
+
+    bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0);
+    bool begin(uint8_t address, int sda, int scl, uint32_t frequency);
+    bool end();
+    bool setClock(uint32_t frequency);
+    uint32_t getClock() const { return clock; }
+    void setTimeOut(uint16_t timeout_ms);
+    uint16_t getTimeOut() const { return timeout_ms; }
+
+    void beginTransmission(uint16_t address);
+    void beginTransmission(uint8_t address) { beginTransmission((uint16_t)address); }
+    void beginTransmission(int address) { beginTransmission((uint16_t)address); }
+    uint8_t endTransmission(bool stop = true);
+
+    size_t requestFrom(uint16_t address, size_t quantity, bool stop = true);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t stop) { return requestFrom((uint16_t)address, (size_t)quantity, stop != 0); }
+    uint8_t requestFrom(int address, int quantity) { return requestFrom((uint16_t)address, (size_t)quantity, true); }
+
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t length);
+    int available();
+    int read();
+    int peek();
+    void flush() {}
+
+    void onReceive(void (*callback)(int)) {}
+    void onRequest(void (*callback)(void)) {}
+    size_t slaveWrite(const uint8_t* data, size_t length) { return 0; }
+
+private:
+    uint8_t bus_num;
+    I2CSimBus* sim_bus;
+    bool initialized;
+    uint32_t clock;
+    uint16_t timeout_ms;
+
+    uint8_t tx_address;
+    uint8_t tx_buffer[I2C_BUFFER_LENGTH];
+    size_t tx_length;
+    bool tx_overflow;
+    uint8_t rx_buffer[I2C_BUFFER_LENGTH];
+    size_t rx_length;
+    size_t rx_index;
+};
+
+extern TwoWire Wire;
+extern TwoWire Wire1;
+
+#endif